@@ -5,19 +5,62 @@
 // Inclusion de librerias estandar
 #include <iostream>       // Para entrada/salida por consola
 #include <fstream>        // Para manejo de archivos
+#include <sstream>        // Para armar informes en memoria (modo servidor)
 #include <string>         // Para uso de cadenas de texto
+#include <string_view>    // Para leer campos sin copiarlos
+#include <charconv>       // Para convertir numeros sin excepciones (esquema de campos)
+#include <utility>        // Para index_sequence (esquema de campos)
 #include <algorithm>      // Para algoritmos como transform, sort, etc.
 #include <cctype>         // Para funciones de caracteres como tolower, isalpha
 #include <sys/stat.h>     // Para operaciones del sistema de archivos (stat)
 #include <ctime>          // Para manejo de fechas y horas
 #include <vector>         // Para contenedor vector
+#include <unordered_set>  // Para conjuntos hash (borrado por lotes)
+#include <unordered_map>  // Para la tabla de la cache de registros (modo acotado)
+#include <list>           // Para el orden LRU de la cache de registros
+#include <optional>       // Para campos opcionales en actualizaciones parciales
+#include <cstdint>        // Para enteros de tamano fijo (hashes)
+#include <cstdio>         // Para snprintf
+#include <map>            // Para contenedor map (puntos de control)
+#include <set>            // Para conjuntos ordenados (celdas de agregados pendientes)
+#include <tuple>          // Para claves compuestas de agregados
+#include <thread>         // Para hilos (seguimiento de archivos)
+#include <atomic>         // Para banderas compartidas entre hilos
+#include <chrono>         // Para intervalos de espera
+#include <functional>     // Para funciones de retorno (callbacks)
+#include <mutex>          // Para exclusion mutua
+#include <shared_mutex>   // Para cerrojos de lectores/escritor
+#include <climits>        // Para limites numericos (SIZE_MAX)
+#include <cmath>          // Para ceil (cuantiles)
+#include <random>         // Para generadores pseudoaleatorios por hilo
+#include <filesystem>     // Para crear y borrar directorios temporales
+#include <memory>         // Para punteros inteligentes
+#include <new>            // Para operator new alineado (bloques del filtro de Bloom)
+#include <queue>          // Para colas de tareas y mezcla de resultados
+#include <future>         // Para resultados de tareas en otros hilos
+#include <condition_variable> // Para despertar hilos del pool
+#include <deque>          // Para la cola del registro de eventos
+#include <array>          // Para contadores de eventos
+#include <csignal>        // Para SIGINT y SIGTERM en el modo servidor
+#include <unistd.h>       // Para unlink (socket Unix) y pwrite
+#include <fcntl.h>        // Para open (escritura posicional del generador)
+#include <sys/mman.h>     // Para proyectar la instantanea en memoria (mmap)
+#include <cstddef>        // Para offsetof (hash de la cabecera de la instantanea)
+#ifdef LINUX
+#include <malloc.h>       // Para malloc_usable_size (memoria real de las cadenas)
+#endif
 
 // Librerias de terceros 
 #include <boost/multi_index_container.hpp>      // Contenedor con multiples indices 
 #include <boost/multi_index/ordered_index.hpp>  // Indices ordenados 
 #include <boost/multi_index/member.hpp>         // Para acceso a miembros de struct
-#include <boost/multi_index/sequenced_index.hpp> // Indice secuencial
+#include <boost/multi_index/random_access_index.hpp> // Indice de acceso aleatorio
+#include <boost/asio.hpp>                       // E/S asincrona del modo servidor
 #include <leveldb/db.h>                         // Base de datos clave-valor embedida
+#include <leveldb/write_batch.h>                // Escrituras agrupadas en LevelDB
+#include <leveldb/filter_policy.h>              // Filtro de Bloom por tabla de LevelDB
+#include <leveldb/cache.h>                      // Cache de bloques propia (para medir su uso)
+#include <zlib.h>                               // Compresion gzip de las partes del respaldo
 
 
 using namespace std;
@@ -33,10 +76,11 @@ struct PacienteData {
     string modality;           // Modalidad del estudio (ej: CT, MRI, XRAY)
     string sex;                // Genero del paciente
     long long tamanoArchivo;   // Tamaño del archivo en bytes
+    uint64_t secuencia;        // Orden global de insercion (modos fragmentado y acotado)
     
     // Constructor por defecto necesario para multi_index
-    // Inicializa tamanoArchivo a 0
-    PacienteData() : tamanoArchivo(0) {}
+    // Inicializa tamanoArchivo y secuencia a 0
+    PacienteData() : tamanoArchivo(0), secuencia(0) {}
     
     // Constructor para conversion desde DataPaciente
     // Permite crear PacienteData a partir de otro tipo de estructura
@@ -47,8 +91,57 @@ struct PacienteData {
     DataPaciente toDataPaciente() const;
 };
 
+// Bytes pedidos por los contenedores de pacientes a AsignadorContado, separados en
+// nodos (uno por paciente con el PacienteData y los enlaces de todos los indices,
+// mas un nodo cabecera por contenedor) y arreglos (los punteros del indice de
+// acceso aleatorio). Son globales: suman todos los contenedores del proceso
+struct ContabilidadMemoria {
+    static inline atomic<int64_t> nodos{0};
+    static inline atomic<int64_t> bytesNodos{0};
+    static inline atomic<int64_t> bytesArreglos{0};
+    static inline atomic<size_t> tamanoNodo{0};  // sizeof del nodo, conocido en la primera alta
+};
+
+// Asignador que delega en std::allocator y lleva la cuenta en ContabilidadMemoria
+// Multi-index lo reasigna (rebind) al tipo de nodo y al de los punteros del indice
+// aleatorio; el nodo es el unico de esos tipos que contiene un PacienteData entero
+template <typename T>
+struct AsignadorContado {
+    typedef T value_type;
+
+    AsignadorContado() noexcept {}
+    template <typename U> AsignadorContado(const AsignadorContado<U>&) noexcept {}
+
+    T* allocate(size_t cantidad) {
+        T* memoria = allocator<T>().allocate(cantidad);
+        registrar(cantidad, 1);
+        return memoria;
+    }
+
+    void deallocate(T* memoria, size_t cantidad) noexcept {
+        registrar(cantidad, -1);
+        allocator<T>().deallocate(memoria, cantidad);
+    }
+
+    template <typename U> bool operator==(const AsignadorContado<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const AsignadorContado<U>&) const noexcept { return false; }
+
+private:
+    static void registrar(size_t cantidad, int64_t signo) {
+        int64_t bytes = signo * (int64_t) (cantidad * sizeof(T));
+        if (sizeof(T) >= sizeof(PacienteData) && cantidad == 1) {
+            ContabilidadMemoria::nodos.fetch_add(signo, memory_order_relaxed);
+            ContabilidadMemoria::bytesNodos.fetch_add(bytes, memory_order_relaxed);
+            ContabilidadMemoria::tamanoNodo.store(sizeof(T), memory_order_relaxed);
+        } else {
+            ContabilidadMemoria::bytesArreglos.fetch_add(bytes, memory_order_relaxed);
+        }
+    }
+};
+
 // Definicion del contenedor multi-index
 // Crea un contenedor que permite multiples formas de acceder a los datos
+// Sus nodos y arreglos se piden a AsignadorContado para medir la memoria real
 typedef multi_index_container<
     PacienteData,  // Tipo de dato almacenado
     indexed_by<    // Definicion de los indices disponibles
@@ -64,11 +157,66 @@ typedef multi_index_container<
         // Indice por genero (ordenado, permite multiples valores iguales)  
         ordered_non_unique<member<PacienteData, string, &PacienteData::sex>>,
         
-        // Indice secuencial (mantiene el orden de insercion)
-        sequenced<>
-    >
+        // Indice de acceso aleatorio (mantiene el orden de insercion y
+        // permite acceder a cualquier posicion en tiempo constante)
+        random_access<>,
+
+        // Indice por fecha de estudio (AAAAMMDD ordena igual que la fecha)
+        // Permite recorrer rangos de fechas para purgas de retencion
+        ordered_non_unique<member<PacienteData, string, &PacienteData::studyDate>>
+    >,
+    AsignadorContado<PacienteData>
 > PacienteContainer;  // Tipo definido para el contenedor de pacientes
 
+// Estructura con los cambios parciales de un paciente
+// Solo se modifican los campos que tienen valor; el ID nunca cambia
+struct ActualizacionPaciente {
+    optional<string> patientName;      // Nuevo nombre
+    optional<string> studyDate;        // Nueva fecha en formato AAAAMMDD
+    optional<string> modality;         // Reclasificacion de modalidad
+    optional<string> sex;              // Nuevo sexo (acepta codigos M/F/O)
+    optional<long long> tamanoArchivo; // Correccion de tamano
+
+    // Indica si no hay ningun campo por actualizar
+    bool vacia() const {
+        return !patientName && !studyDate && !modality && !sex && !tamanoArchivo;
+    }
+
+    // Indica si algun texto trae '|' o un salto de linea: separan los campos del
+    // valor guardado y las lineas del formato compacto, y corromperian el registro
+    bool contieneSeparador() const {
+        for (const optional<string>* campo : {&patientName, &studyDate, &modality, &sex}) {
+            if (*campo && (*campo)->find_first_of("|\r\n") != string::npos) return true;
+        }
+        return false;
+    }
+};
+
+// Estructura con el criterio de un borrado masivo
+// Un paciente se borra si cumple todas las condiciones indicadas
+struct CriterioBorrado {
+    optional<string> modality;         // Modalidad exacta
+    optional<string> fechaDesde;       // Fecha minima AAAAMMDD (inclusive)
+    optional<string> fechaHasta;       // Fecha maxima AAAAMMDD (inclusive)
+    optional<long long> tamanoMinimo;  // Tamano minimo en bytes (inclusive)
+    optional<long long> tamanoMaximo;  // Tamano maximo en bytes (inclusive)
+
+    // Indica si no se indico ninguna condicion (se rechaza para no borrar todo por error)
+    bool vacio() const {
+        return !modality && !fechaDesde && !fechaHasta && !tamanoMinimo && !tamanoMaximo;
+    }
+
+    // Evalua el criterio sobre los campos de un paciente
+    bool cumple(const string& modalidad, const string& fecha, long long tamano) const {
+        if (modality && modalidad != *modality) return false;
+        if (fechaDesde && fecha < *fechaDesde) return false;
+        if (fechaHasta && fecha > *fechaHasta) return false;
+        if (tamanoMinimo && tamano < *tamanoMinimo) return false;
+        if (tamanoMaximo && tamano > *tamanoMaximo) return false;
+        return true;
+    }
+};
+
 // Funcion para convertir a minusculas
 // Toma una cadena de texto y devuelve una version en minusculas
 string aMinusculas(const string& str) {
@@ -84,6 +232,477 @@ string aMinusculas(const string& str) {
     return resultado;
 }
 
+// Indica si 'texto' contiene 'patron' (ya en minusculas) sin distinguir mayusculas
+// Igual que aMinusculas(texto).find(patron), pero sin copiar el texto
+bool contieneSinMayusculas(string_view texto, const string& patron) {
+    if (patron.empty()) return true;
+    return search(texto.begin(), texto.end(), patron.begin(), patron.end(), [](char a, char b) {
+        return (char) ::tolower(a) == b;
+    }) != texto.end();
+}
+
+// Campos del valor de un paciente en LevelDB (la clave es el ID), en el orden en
+// que se guardan. El formato compacto de archivo es el ID seguido de estos campos
+enum class CampoPaciente { NOMBRE, FECHA, MODALIDAD, SEXO, TAMANO, TOTAL };
+
+// Descripcion de cada campo: nombre para busquedas, etiqueta para mostrar, si se
+// puede buscar por el en LevelDB y su miembro en PacienteData (que fija el tipo)
+template <CampoPaciente C> struct DescriptorCampo;
+
+template <> struct DescriptorCampo<CampoPaciente::NOMBRE> {
+    static constexpr const char* nombre = "nombre";
+    static constexpr const char* etiqueta = "Nombre";
+    static constexpr const char* sufijo = "";
+    static constexpr bool buscable = true;
+    static constexpr string PacienteData::* miembro = &PacienteData::patientName;
+};
+
+template <> struct DescriptorCampo<CampoPaciente::FECHA> {
+    static constexpr const char* nombre = "fecha";
+    static constexpr const char* etiqueta = "Fecha";
+    static constexpr const char* sufijo = "";
+    static constexpr bool buscable = false;
+    static constexpr string PacienteData::* miembro = &PacienteData::studyDate;
+};
+
+template <> struct DescriptorCampo<CampoPaciente::MODALIDAD> {
+    static constexpr const char* nombre = "modalidad";
+    static constexpr const char* etiqueta = "Modalidad";
+    static constexpr const char* sufijo = "";
+    static constexpr bool buscable = true;
+    static constexpr string PacienteData::* miembro = &PacienteData::modality;
+};
+
+template <> struct DescriptorCampo<CampoPaciente::SEXO> {
+    static constexpr const char* nombre = "sexo";
+    static constexpr const char* etiqueta = "Sexo";
+    static constexpr const char* sufijo = "";
+    static constexpr bool buscable = true;
+    static constexpr string PacienteData::* miembro = &PacienteData::sex;
+};
+
+template <> struct DescriptorCampo<CampoPaciente::TAMANO> {
+    static constexpr const char* nombre = "tamano";
+    static constexpr const char* etiqueta = "Tamano";
+    static constexpr const char* sufijo = " bytes";
+    static constexpr bool buscable = false;
+    static constexpr long long PacienteData::* miembro = &PacienteData::tamanoArchivo;
+};
+
+// Esquema del registro de un paciente
+// Serializacion, lectura y acceso por campo se generan en compilacion a partir de
+// los DescriptorCampo: recorrer los campos se expande en codigo lineal, sin indices
+// ni vectores intermedios. El valor guardado es nombre|fecha|modalidad|sexo|tamano
+struct EsquemaPaciente {
+    static const size_t CAMPOS = (size_t) CampoPaciente::TOTAL;
+    typedef make_index_sequence<CAMPOS> Indices;
+
+    // Bit del campo en la mascara de campos que devuelve parsear()
+    template <CampoPaciente C>
+    static constexpr int bit() { return 1 << (int) C; }
+
+    // Valor tipado de un campo
+    template <CampoPaciente C>
+    static auto& valor(PacienteData& paciente) { return paciente.*DescriptorCampo<C>::miembro; }
+
+    template <CampoPaciente C>
+    static const auto& valor(const PacienteData& paciente) { return paciente.*DescriptorCampo<C>::miembro; }
+
+    // Valor de un campo como texto (el mismo que se guarda)
+    static string comoTexto(const string& valor) { return valor; }
+    static string comoTexto(long long valor) { return to_string(valor); }
+
+    // Construye el valor que se guarda en LevelDB
+    static string serializar(const PacienteData& paciente) {
+        string resultado;
+        resultado.reserve(paciente.patientName.size() + 48);
+        serializarCampos(paciente, resultado, Indices());
+        return resultado;
+    }
+
+    // Lee un valor guardado (o el resto de una linea compacta despues del ID)
+    // Devuelve -1 si faltan campos; si no, la mascara de los que no se pudieron
+    // convertir a su tipo (0 = todo correcto). Los campos de mas se ignoran
+    static int parsear(string_view texto, PacienteData& paciente) {
+        size_t inicio = 0;
+        int fallidos = 0;
+        return parsearCampos(texto, inicio, paciente, fallidos, Indices()) ? fallidos : -1;
+    }
+
+    // Texto del campo C dentro de un valor guardado, sin leer los demas campos
+    template <CampoPaciente C>
+    static bool extraer(string_view texto, string_view& campo) {
+        size_t inicio = 0;
+        for (int i = 0; i < (int) C; ++i) {
+            size_t barra = texto.find('|', inicio);
+            if (barra == string_view::npos) return false;
+            inicio = barra + 1;
+        }
+        size_t fin = texto.find('|', inicio);
+        campo = texto.substr(inicio, fin == string_view::npos ? string_view::npos : fin - inicio);
+        return true;
+    }
+
+    // Llama a funcion(integral_constant<CampoPaciente, C>) para cada campo, en orden
+    template <typename Funcion>
+    static void paraCadaCampo(Funcion&& funcion) {
+        paraCadaCampo(funcion, Indices());
+    }
+
+    // Llama a funcion(integral_constant<CampoPaciente, C>) con el campo buscable de
+    // ese nombre; devuelve false si no hay ninguno. Se resuelve una vez por consulta
+    template <typename Funcion>
+    static bool conCampoBuscable(const string& nombre, Funcion&& funcion) {
+        bool encontrado = false;
+        paraCadaCampo([&](auto campo) {
+            typedef DescriptorCampo<decltype(campo)::value> Descriptor;
+            if constexpr (Descriptor::buscable) {
+                if (!encontrado && nombre == Descriptor::nombre) {
+                    encontrado = true;
+                    funcion(campo);
+                }
+            }
+        });
+        return encontrado;
+    }
+
+private:
+    static void escribirTexto(string& destino, const string& valor) { destino += valor; }
+
+    static void escribirTexto(string& destino, long long valor) {
+        char numero[24];
+        destino.append(numero, to_chars(numero, numero + sizeof(numero), valor).ptr);
+    }
+
+    static bool leerTexto(string_view texto, string& valor) {
+        valor.assign(texto.data(), texto.size());
+        return true;
+    }
+
+    // Como stoll: admite espacios al inicio e ignora lo que siga al numero
+    static bool leerTexto(string_view texto, long long& valor) {
+        size_t inicio = 0;
+        while (inicio < texto.size() && isspace((unsigned char) texto[inicio])) inicio++;
+        return from_chars(texto.data() + inicio, texto.data() + texto.size(), valor).ec == errc();
+    }
+
+    template <size_t... I>
+    static void serializarCampos(const PacienteData& paciente, string& destino, index_sequence<I...>) {
+        ((I > 0 ? (void) (destino += '|') : (void) 0,
+          escribirTexto(destino, valor<(CampoPaciente) I>(paciente))), ...);
+    }
+
+    template <size_t... I>
+    static bool parsearCampos(string_view texto, size_t& inicio, PacienteData& paciente, int& fallidos,
+                              index_sequence<I...>) {
+        return (parsearCampo<(CampoPaciente) I>(texto, inicio, paciente, fallidos) && ...);
+    }
+
+    template <CampoPaciente C>
+    static bool parsearCampo(string_view texto, size_t& inicio, PacienteData& paciente, int& fallidos) {
+        if (inicio > texto.size()) return false;  // La linea termino antes de este campo
+        size_t fin = texto.find('|', inicio);
+        string_view campo = texto.substr(inicio, fin == string_view::npos ? string_view::npos : fin - inicio);
+        inicio = fin == string_view::npos ? texto.size() + 1 : fin + 1;
+        if (!leerTexto(campo, valor<C>(paciente))) fallidos |= bit<C>();
+        return true;
+    }
+
+    template <typename Funcion, size_t... I>
+    static void paraCadaCampo(Funcion& funcion, index_sequence<I...>) {
+        (funcion(integral_constant<CampoPaciente, (CampoPaciente) I>()), ...);
+    }
+};
+
+// Funcion de hash de 64 bits para cadenas
+// FNV-1a seguido de una mezcla final para repartir bien los bits altos y bajos
+uint64_t hash64(const char* datos, size_t longitud) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < longitud; ++i) {
+        h ^= (unsigned char) datos[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash64(const string& cadena) {
+    return hash64(cadena.data(), cadena.size());
+}
+
+// Asignador que entrega memoria alineada a 'Alineacion' bytes
+// El filtro de Bloom lo usa para que cada bloque de 512 bits caiga en una sola linea de cache
+template <typename T, size_t Alineacion>
+struct AsignadorAlineado {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AsignadorAlineado<U, Alineacion> other; };
+
+    AsignadorAlineado() noexcept {}
+    template <typename U> AsignadorAlineado(const AsignadorAlineado<U, Alineacion>&) noexcept {}
+
+    T* allocate(size_t cantidad) {
+        return static_cast<T*>(::operator new(cantidad * sizeof(T), align_val_t(Alineacion)));
+    }
+
+    void deallocate(T* memoria, size_t) noexcept {
+        ::operator delete(memoria, align_val_t(Alineacion));
+    }
+
+    template <typename U> bool operator==(const AsignadorAlineado<U, Alineacion>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const AsignadorAlineado<U, Alineacion>&) const noexcept { return false; }
+};
+
+// Clase FiltroBloom
+// Filtro de Bloom por bloques para descartar rapidamente IDs que no existen.
+// Cada clave marca SONDAS bits dentro de un unico bloque de 512 bits (una linea
+// de cache), por lo que cada consulta cuesta un solo acceso a memoria.
+// No admite borrados: el dueno debe reconstruirlo cuando acumula muchos.
+class FiltroBloom {
+    private:
+        static const size_t BITS_POR_CLAVE = 10;   // Aproximadamente 1% de falsos positivos
+        static const int SONDAS = 6;               // Bits marcados por clave
+        static const size_t PALABRAS_POR_BLOQUE = 8; // 8 x 64 bits = 512 bits por bloque
+
+        static const size_t BYTES_LINEA_CACHE = 64;
+
+        // Bloques consecutivos de PALABRAS_POR_BLOQUE palabras, alineados a linea de cache
+        vector<uint64_t, AsignadorAlineado<uint64_t, BYTES_LINEA_CACHE>> bits;
+        size_t numBloques;       // Cantidad de bloques
+        size_t capacidad;        // Claves previstas antes de considerarse saturado
+        size_t elementos;        // Claves agregadas desde la ultima limpieza
+
+        // Devuelve el inicio del bloque que corresponde al hash
+        size_t inicioBloque(uint64_t h) const {
+            return (size_t) ((h >> 32) % numBloques) * PALABRAS_POR_BLOQUE;
+        }
+
+    public:
+        // Constructor - reserva espacio para la capacidad indicada
+        explicit FiltroBloom(size_t capacidadInicial = 1024) {
+            redimensionar(capacidadInicial);
+        }
+
+        // Reinicia el filtro vacio con una nueva capacidad
+        void redimensionar(size_t nuevaCapacidad) {
+            capacidad = max(nuevaCapacidad, (size_t) 64);
+            numBloques = (capacidad * BITS_POR_CLAVE + 511) / 512;
+            bits.assign(numBloques * PALABRAS_POR_BLOQUE, 0);
+            elementos = 0;
+        }
+
+        // Vacia el filtro conservando su capacidad
+        void limpiar() {
+            fill(bits.begin(), bits.end(), 0);
+            elementos = 0;
+        }
+
+        // Agrega una clave al filtro
+        void agregar(const string& clave) {
+            uint64_t h = hash64(clave);
+            uint64_t* bloque = &bits[inicioBloque(h)];
+            // Los 32 bits bajos del hash eligen las posiciones dentro del bloque
+            uint32_t sonda = (uint32_t) h;
+            for (int i = 0; i < SONDAS; ++i) {
+                uint32_t bit = sonda & 511;
+                bloque[bit >> 6] |= 1ULL << (bit & 63);
+                sonda = (sonda >> 9) | (sonda << 23);
+                sonda ^= (uint32_t) (h >> 32) * (i + 1);
+            }
+            elementos++;
+        }
+
+        // Devuelve false si la clave seguro no fue agregada
+        // true significa "posiblemente presente" y requiere confirmar en el indice
+        bool puedeContener(const string& clave) const {
+            uint64_t h = hash64(clave);
+            const uint64_t* bloque = &bits[inicioBloque(h)];
+            uint32_t sonda = (uint32_t) h;
+            for (int i = 0; i < SONDAS; ++i) {
+                uint32_t bit = sonda & 511;
+                if ((bloque[bit >> 6] & (1ULL << (bit & 63))) == 0) return false;
+                sonda = (sonda >> 9) | (sonda << 23);
+                sonda ^= (uint32_t) (h >> 32) * (i + 1);
+            }
+            return true;
+        }
+
+        // Indica si se agregaron mas claves de las previstas (aumentan los falsos positivos)
+        bool saturado() const {
+            return elementos > capacidad;
+        }
+
+        size_t getElementos() const { return elementos; }
+        size_t getCapacidad() const { return capacidad; }
+};
+
+// Clase ArbolReconciliacion
+// Arbol de Merkle sobre rangos de IDs para comparar la memoria con LevelDB.
+// Cada hoja cubre un rango de claves [limites[i-1], limites[i]) y guarda la suma
+// de los hashes de sus registros; como la suma es conmutativa, insertar, borrar o
+// modificar un registro actualiza su hoja y el camino a la raiz en O(log H).
+// Del lado de LevelDB las hojas se marcan sucias al escribir y solo esas se
+// recalculan con un escaneo de su rango, asi la verificacion cuesta O(rangos cambiados).
+class ArbolReconciliacion {
+    private:
+        vector<string> limites;          // Claves que separan las hojas (ordenadas)
+        size_t numHojas;                 // Potencia de dos >= limites.size() + 1
+        vector<uint64_t> nodosMemoria;   // Arbol en arreglo: raiz en 1, hojas desde numHojas
+        vector<uint64_t> nodosBaseDatos; // Mismo arbol para el lado de LevelDB
+        vector<bool> hojaSucia;          // Hojas de LevelDB que deben recalcularse
+        size_t hojasSucias;              // Cantidad de hojas marcadas como sucias
+        bool construido;                 // Indica si ya se definieron los limites
+
+        // Combina dos hijos en el hash del nodo padre
+        static uint64_t combinar(uint64_t izquierdo, uint64_t derecho) {
+            uint64_t datos[2] = { izquierdo, derecho };
+            return hash64((const char*) datos, sizeof(datos));
+        }
+
+        // Recalcula los ancestros de una hoja
+        void actualizarCamino(vector<uint64_t>& nodos, size_t hoja) {
+            for (size_t nodo = (numHojas + hoja) / 2; nodo >= 1; nodo /= 2) {
+                nodos[nodo] = combinar(nodos[2 * nodo], nodos[2 * nodo + 1]);
+            }
+        }
+
+        // Recorre los nodos distintos desde 'nodo' y acumula las hojas que difieren
+        void descender(size_t nodo, vector<size_t>& distintas) const {
+            if (nodosMemoria[nodo] == nodosBaseDatos[nodo]) return;
+            if (nodo >= numHojas) {
+                distintas.push_back(nodo - numHojas);
+                return;
+            }
+            descender(2 * nodo, distintas);
+            descender(2 * nodo + 1, distintas);
+        }
+
+    public:
+        static const size_t HOJAS_POR_DEFECTO = 1024;
+
+        // Constructor - el arbol queda sin construir hasta recibir sus limites
+        ArbolReconciliacion() : numHojas(1), hojasSucias(0), construido(false) {}
+
+        // Hash de un registro: combina la clave con el valor tal como se guarda en LevelDB
+        static uint64_t hashRegistro(const string& id, const string& valor) {
+            string datos;
+            datos.reserve(id.size() + 1 + valor.size());
+            datos += id;
+            datos += '\x1f';
+            datos += valor;
+            return hash64(datos);
+        }
+
+        // Define los limites de las hojas y deja ambos lados en cero,
+        // con todas las hojas de LevelDB pendientes de calcular
+        void construir(const vector<string>& nuevosLimites) {
+            limites = nuevosLimites;
+            numHojas = 1;
+            while (numHojas < limites.size() + 1) numHojas *= 2;
+            nodosMemoria.assign(2 * numHojas, 0);
+            for (size_t nodo = numHojas - 1; nodo >= 1; --nodo) {
+                nodosMemoria[nodo] = combinar(nodosMemoria[2 * nodo], nodosMemoria[2 * nodo + 1]);
+            }
+            nodosBaseDatos = nodosMemoria;
+            hojaSucia.assign(numHojas, false);
+            for (size_t hoja = 0; hoja < getHojasUsadas(); ++hoja) hojaSucia[hoja] = true;
+            hojasSucias = getHojasUsadas();
+            construido = true;
+        }
+
+        // Deja ambos lados vacios y sincronizados (por ejemplo tras borrar todo)
+        void vaciar() {
+            if (!construido) return;
+            construir(limites);
+            hojaSucia.assign(numHojas, false);
+            hojasSucias = 0;
+        }
+
+        bool estaConstruido() const { return construido; }
+        size_t getHojasUsadas() const { return limites.size() + 1; }
+        size_t getHojasSucias() const { return hojasSucias; }
+
+        // Hoja a la que pertenece un ID
+        size_t hojaDe(const string& id) const {
+            return upper_bound(limites.begin(), limites.end(), id) - limites.begin();
+        }
+
+        // Limites de una hoja; la primera no tiene inicio y la ultima no tiene fin
+        bool tieneInicio(size_t hoja) const { return hoja > 0; }
+        bool tieneFin(size_t hoja) const { return hoja < limites.size(); }
+        const string& inicioDe(size_t hoja) const { return limites[hoja - 1]; }
+        const string& finDe(size_t hoja) const { return limites[hoja]; }
+
+        // Suma o resta el hash de un registro en el lado de memoria
+        void agregarMemoria(const string& id, uint64_t hashValor) {
+            if (!construido) return;
+            size_t hoja = hojaDe(id);
+            nodosMemoria[numHojas + hoja] += hashValor;
+            actualizarCamino(nodosMemoria, hoja);
+        }
+
+        void quitarMemoria(const string& id, uint64_t hashValor) {
+            if (!construido) return;
+            size_t hoja = hojaDe(id);
+            nodosMemoria[numHojas + hoja] -= hashValor;
+            actualizarCamino(nodosMemoria, hoja);
+        }
+
+        // Marca como pendiente la hoja de LevelDB que contiene el ID
+        void marcarSucia(const string& id) {
+            if (!construido) return;
+            size_t hoja = hojaDe(id);
+            if (!hojaSucia[hoja]) {
+                hojaSucia[hoja] = true;
+                hojasSucias++;
+            }
+        }
+
+        // Hojas de LevelDB pendientes de recalcular
+        vector<size_t> hojasPendientes() const {
+            vector<size_t> pendientes;
+            for (size_t hoja = 0; hoja < getHojasUsadas(); ++hoja) {
+                if (hojaSucia[hoja]) pendientes.push_back(hoja);
+            }
+            return pendientes;
+        }
+
+        // Fija la suma calculada de una hoja (lado memoria o LevelDB)
+        void fijarHojaMemoria(size_t hoja, uint64_t suma) {
+            nodosMemoria[numHojas + hoja] = suma;
+            actualizarCamino(nodosMemoria, hoja);
+        }
+
+        void fijarHojaBaseDatos(size_t hoja, uint64_t suma) {
+            nodosBaseDatos[numHojas + hoja] = suma;
+            actualizarCamino(nodosBaseDatos, hoja);
+            if (hojaSucia[hoja]) {
+                hojaSucia[hoja] = false;
+                hojasSucias--;
+            }
+        }
+
+        // Hojas cuyo contenido difiere entre memoria y LevelDB
+        // Solo desciende por los subarboles con hashes distintos
+        vector<size_t> hojasDistintas() const {
+            vector<size_t> distintas;
+            if (construido) descender(1, distintas);
+            return distintas;
+        }
+};
+
+// Funcion para convertir el codigo de sexo a texto legible
+// M -> Masculino, F -> Femenino, O -> Otro; cualquier otro valor se conserva
+string convertirCodigoSexo(const string& codigo) {
+    if (codigo == "M") return "Masculino";
+    if (codigo == "F") return "Femenino";
+    if (codigo == "O") return "Otro";
+    return codigo;
+}
+
 // Funcion para convertir fecha simulada
 // Convierte fecha en formato AAAAMMDD a formato DD/MM/AAAA
 string convertirFechaSimulada(const string& fecha) {
@@ -136,59 +755,54 @@ class DataPaciente {
         // Carga datos desde un formato de texto compacto separado por |
         // Formato esperado: ID|Nombre|Fecha|Modalidad|Sexo|Tamano
         bool cargarDesdeFormatoCompacto(const string& linea) {
-            vector<string> campos;
-            string campo;
-            size_t inicio = 0;
-            size_t fin = linea.find('|');
-            
-            // Divide la linea usando | como separador
-            while (fin != string::npos) {
-                campo = linea.substr(inicio, fin - inicio);
-                campos.push_back(campo);
-                inicio = fin + 1;
-                fin = linea.find('|', inicio);
-            }
-            campo = linea.substr(inicio);
-            campos.push_back(campo);
-            
+            // El ID va antes del primer | y el resto sigue el esquema del valor en LevelDB
+            size_t separador = linea.find('|');
+            if (separador == string::npos) return false;
+
             // Verifica que tenga todos los campos necesarios
-            if (campos.size() < 6) {
-                cerr << "Error: Formato invalido. Se esperaban 6 campos, se encontraron " << campos.size() << endl;
+            // (quien lee el archivo registra la linea invalida con limite por segundo)
+            PacienteData campos;
+            int fallidos = EsquemaPaciente::parsear(string_view(linea).substr(separador + 1), campos);
+            if (fallidos < 0) {
+                return false;
+            }
+
+            // El prefijo '#' queda reservado para las claves de metadatos en LevelDB
+            if (separador == 0 || linea[0] == '#') {
                 return false;
             }
             
             // Asigna los valores a los atributos
-            patientID = campos[0];
-            patientName = campos[1];
-            studyDate = campos[2];
+            patientID = linea.substr(0, separador);
+            patientName = move(campos.patientName);
+            studyDate = move(campos.studyDate);
             studyDateFormateada = convertirFechaSimulada(studyDate);
-            modality = campos[3];
+            modality = move(campos.modality);
             
             // Convierte codigo de sexo a texto legible
-            string sexoCode = campos[4];
-            if (sexoCode == "M") sex = "Masculino";
-            else if (sexoCode == "F") sex = "Femenino";
-            else if (sexoCode == "O") sex = "Otro";
-            else sex = sexoCode;
+            sex = convertirCodigoSexo(campos.sex);
             
-            // Convierte tamano del archivo, genera valor por defecto si falla
-            try {
-                tamanoArchivo = stoll(campos[5]);
-            } catch (...) {
-                tamanoArchivo = generarTamanoPorModalidad(modality);
+            // Sin tamano valido se genera uno a partir del ID: la misma linea da siempre el mismo valor
+            if (fallidos & EsquemaPaciente::bit<CampoPaciente::TAMANO>()) {
+                mt19937_64 generador(hash64(patientID));
+                tamanoArchivo = generarTamanoPorModalidad(modality, generador);
+            } else {
+                tamanoArchivo = campos.tamanoArchivo;
             }
             
             return true;
         }
         
         // Genera un tamano de archivo realistico basado en la modalidad del estudio
-        long long generarTamanoPorModalidad(const string& modalidad) {
-            if (modalidad == "CT") return 50000000LL + (rand() % 100000000LL);      // 50-150 MB
-            if (modalidad == "MRI") return 100000000LL + (rand() % 200000000LL);    // 100-300 MB
-            if (modalidad == "XRAY") return 10000000LL + (rand() % 40000000LL);     // 10-50 MB
-            if (modalidad == "US") return 20000000LL + (rand() % 30000000LL);       // 20-50 MB
-            if (modalidad == "PET") return 80000000LL + (rand() % 120000000LL);     // 80-200 MB
-            return 50000000LL + (rand() % 50000000LL);                              // 50-100 MB por defecto
+        // Usa el generador recibido (cada hilo el suyo), asi es reproducible y seguro entre hilos
+        static long long generarTamanoPorModalidad(const string& modalidad, mt19937_64& generador) {
+            auto aleatorio = [&generador](long long rango) { return (long long) (generador() % rango); };
+            if (modalidad == "CT") return 50000000LL + aleatorio(100000000LL);      // 50-150 MB
+            if (modalidad == "MRI") return 100000000LL + aleatorio(200000000LL);    // 100-300 MB
+            if (modalidad == "XRAY") return 10000000LL + aleatorio(40000000LL);     // 10-50 MB
+            if (modalidad == "US") return 20000000LL + aleatorio(30000000LL);       // 20-50 MB
+            if (modalidad == "PET") return 80000000LL + aleatorio(120000000LL);     // 80-200 MB
+            return 50000000LL + aleatorio(50000000LL);                              // 50-100 MB por defecto
         }
         
         // Metodos getter para acceso a los atributos privados
@@ -213,14 +827,15 @@ class DataPaciente {
         
         // Muestra la informacion del paciente en formato legible
         void mostrarInfo() const {
-            cout << "Paciente: " << patientName << endl;
-            cout << "ID: " << patientID << endl;
-            cout << "Fecha del estudio: " << studyDateFormateada << endl;
-            cout << "Modalidad: " << modality << endl;
-            cout << "Sexo: " << sex << endl;
+            // '\n' en lugar de endl: el stream se vacia una vez, no en cada linea
+            cout << "Paciente: " << patientName << '\n'
+                 << "ID: " << patientID << '\n'
+                 << "Fecha del estudio: " << studyDateFormateada << '\n'
+                 << "Modalidad: " << modality << '\n'
+                 << "Sexo: " << sex << '\n';
             long long size = getSize();
-            cout << "Tamano archivo: " << size << " bytes (" << (size / 1024.0 / 1024.0) << " MB)" << endl;
-            cout << "------------------------------------------------------ " << endl;
+            cout << "Tamano archivo: " << size << " bytes (" << (size / 1024.0 / 1024.0) << " MB)" << '\n'
+                 << "------------------------------------------------------ " << endl;
         }
         
         // Verifica si un archivo existe en el sistema
@@ -241,6 +856,7 @@ PacienteData::PacienteData(const DataPaciente& dp) {
     modality = dp.getModality();
     sex = dp.getSex();
     tamanoArchivo = dp.getSize();
+    secuencia = 0;
 }
 
 // Metodo de conversion a DataPaciente
@@ -258,975 +874,8035 @@ DataPaciente PacienteData::toDataPaciente() const {
 }
 
 
-// Clase LevelDBManager
-// Gestiona la base de datos LevelDB para almacenamiento persistente de pacientes
-class LevelDBManager {
+// Formatos de salida para listados, busquedas y volcados
+enum class FormatoSalida { TABLA, CSV, JSONL };
+
+// Interpreta el nombre de un formato: tabla, csv o jsonl
+bool parsearFormatoSalida(const string& nombre, FormatoSalida& formato) {
+    string valor = aMinusculas(nombre);
+    if (valor == "tabla") formato = FormatoSalida::TABLA;
+    else if (valor == "csv") formato = FormatoSalida::CSV;
+    else if (valor == "jsonl") formato = FormatoSalida::JSONL;
+    else return false;
+    return true;
+}
+
+
+// Clase SalidaResultados
+// Da formato a los pacientes en un buffer propio y lo escribe al destino en bloques
+// grandes, sin vaciar el stream en cada linea. El buffer conserva su capacidad entre
+// bloques, de modo que despues del primero no vuelve a reservar memoria.
+class SalidaResultados {
     private:
-        leveldb::DB* db;        // Puntero a la base de datos LevelDB
-        bool connected;         // Estado de conexion a la base de datos
-        string dbPath;          // Ruta donde se almacena la base de datos
-        
-    public:
-        // Constructor - inicializa la conexion con LevelDB
-        LevelDBManager(const string& path = "./leveldb_data") : db(nullptr), connected(false), dbPath(path) {
-            leveldb::Options options;
-            options.create_if_missing = true;  // Crea la DB si no existe
-            
-            // Crea el directorio si no existe
-            mkdir(dbPath.c_str(), 0755);
-            
-            // Intenta abrir la base de datos
-            leveldb::Status status = leveldb::DB::Open(options, dbPath, &db);
-            
-            if (!status.ok()) {
-                cerr << "Error abriendo LevelDB: " << status.ToString() << endl;
-                connected = false;
-                return;
+        static const size_t TAMANO_BLOQUE = 256 * 1024;  // Bytes acumulados antes de escribir
+
+        ostream& destino;         // Stream de salida (consola, archivo o tuberia)
+        FormatoSalida formato;    // Formato elegido por el llamador
+        string buffer;            // Texto pendiente de escribir
+        size_t escritos;          // Pacientes formateados
+        size_t primerNumero;      // Numero de la primera fila en formato tabla
+
+        // Agrega una columna de la tabla rellenada hasta 'ancho' caracteres
+        // Cuenta caracteres UTF-8 (no bytes) para que los acentos no desalineen
+        void agregarColumna(const string& texto, size_t ancho) {
+            size_t visibles = 0;
+            for (unsigned char c : texto) {
+                if ((c & 0xC0) != 0x80) visibles++;
             }
-            
-            connected = true;
-            cout << "LevelDB inicializado correctamente. Base de datos en: " << dbPath << endl;
+            buffer += texto;
+            if (visibles < ancho) buffer.append(ancho - visibles, ' ');
+            buffer += ' ';
         }
-        
-        // Destructor - libera los recursos de la base de datos
-        ~LevelDBManager() {
-            if (db) {
-                delete db;
+
+        // Agrega un campo CSV, entre comillas solo si hace falta
+        void agregarCSV(const string& texto) {
+            if (texto.find_first_of(",\"\r\n") == string::npos) {
+                buffer += texto;
+                return;
             }
+            buffer += '"';
+            for (char c : texto) {
+                if (c == '"') buffer += '"';
+                buffer += c;
+            }
+            buffer += '"';
         }
-        
-        // Verifica si la conexion a la base de datos esta activa
-        bool isConnected() const {
-            return connected;
+
+        // Agrega una cadena JSON con los caracteres especiales escapados
+        void agregarJSON(const string& texto) {
+            buffer += '"';
+            for (unsigned char c : texto) {
+                switch (c) {
+                    case '"': buffer += "\\\""; break;
+                    case '\\': buffer += "\\\\"; break;
+                    case '\n': buffer += "\\n"; break;
+                    case '\r': buffer += "\\r"; break;
+                    case '\t': buffer += "\\t"; break;
+                    default:
+                        if (c < 0x20) {
+                            char escape[8];
+                            snprintf(escape, sizeof(escape), "\\u%04x", c);
+                            buffer += escape;
+                        } else {
+                            buffer += (char) c;
+                        }
+                }
+            }
+            buffer += '"';
         }
-        
-        // Cuenta el numero total de pacientes en la base de datos
-        long contarPacientes() const {
-            if (!connected) return 0;
-            
-            long count = 0;
-            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
-            
-            // Recorre todas las entradas contandolas
-            for (it->SeekToFirst(); it->Valid(); it->Next()) {
-                count++;
+
+        // Encabezado del formato (la tabla y el CSV tienen fila de titulos)
+        void agregarEncabezado() {
+            if (formato == FormatoSalida::TABLA) {
+                agregarColumna("#", 7);
+                agregarColumna("ID", 10);
+                agregarColumna("Nombre", 32);
+                agregarColumna("Fecha", 10);
+                agregarColumna("Modalidad", 9);
+                agregarColumna("Sexo", 9);
+                buffer += "Tamano (bytes)\n";
+                buffer.append(100, '-');
+                buffer += '\n';
+            } else if (formato == FormatoSalida::CSV) {
+                buffer += "id,nombre,fecha,modalidad,sexo,tamano\n";
             }
-            
-            delete it;
-            return count;
         }
-        
-        // Guarda un nuevo paciente en la base de datos
-        // Formato: clave=ID, valor=nombre|fecha|modalidad|sexo|tamano
-        bool guardarPaciente(const string& id, const string& nombre, const string& fecha, 
-                            const string& modalidad, const string& sexo, long long tamano) {
-            if (!connected) return false;
-            
-            string pacienteData = nombre + "|" + fecha + "|" + modalidad + "|" + sexo + "|" + to_string(tamano);
-            leveldb::Status status = db->Put(leveldb::WriteOptions(), id, pacienteData);
-            
-            if (!status.ok()) {
-                cerr << "Error guardando dato: " << status.ToString() << endl;
-                return false;
+
+    public:
+        SalidaResultados(ostream& salida, FormatoSalida formatoElegido, size_t numeroInicial = 1)
+            : destino(salida), formato(formatoElegido), escritos(0), primerNumero(numeroInicial) {
+            buffer.reserve(TAMANO_BLOQUE + 1024);
+        }
+
+        ~SalidaResultados() {
+            terminar();
+        }
+
+        SalidaResultados(const SalidaResultados&) = delete;
+        SalidaResultados& operator=(const SalidaResultados&) = delete;
+
+        // Agrega un paciente en el formato elegido
+        void escribir(const PacienteData& paciente) {
+            if (escritos == 0) agregarEncabezado();
+
+            if (formato == FormatoSalida::TABLA) {
+                agregarColumna(to_string(primerNumero + escritos), 7);
+                agregarColumna(paciente.patientID, 10);
+                agregarColumna(paciente.patientName, 32);
+                agregarColumna(convertirFechaSimulada(paciente.studyDate), 10);
+                agregarColumna(paciente.modality, 9);
+                agregarColumna(paciente.sex, 9);
+                buffer += to_string(paciente.tamanoArchivo);
+            } else if (formato == FormatoSalida::CSV) {
+                agregarCSV(paciente.patientID);
+                buffer += ',';
+                agregarCSV(paciente.patientName);
+                buffer += ',';
+                agregarCSV(paciente.studyDate);
+                buffer += ',';
+                agregarCSV(paciente.modality);
+                buffer += ',';
+                agregarCSV(paciente.sex);
+                buffer += ',';
+                buffer += to_string(paciente.tamanoArchivo);
+            } else {
+                buffer += "{\"id\":";
+                agregarJSON(paciente.patientID);
+                buffer += ",\"nombre\":";
+                agregarJSON(paciente.patientName);
+                buffer += ",\"fecha\":";
+                agregarJSON(paciente.studyDate);
+                buffer += ",\"modalidad\":";
+                agregarJSON(paciente.modality);
+                buffer += ",\"sexo\":";
+                agregarJSON(paciente.sex);
+                buffer += ",\"tamano\":";
+                buffer += to_string(paciente.tamanoArchivo);
+                buffer += '}';
             }
-            
-            cout << "Paciente guardado en LevelDB: " << id << endl;
-            return true;
+            buffer += '\n';
+            escritos++;
+
+            if (buffer.size() >= TAMANO_BLOQUE) vaciar();
         }
-        
-        // Busca un paciente por su ID (clave primaria)
-        string buscarPacientePorID(const string& id) {
-            if (!connected) return "";
-            
-            string value;
-            leveldb::Status status = db->Get(leveldb::ReadOptions(), id, &value);
-            
-            if (!status.ok()) {
-                if (!status.IsNotFound()) {
-                    cerr << "Error buscando dato: " << status.ToString() << endl;
+
+        void escribir(const DataPaciente& paciente) {
+            escribir(PacienteData(paciente));
+        }
+
+        // Escribe lo acumulado sin vaciar el stream
+        void vaciar() {
+            if (buffer.empty()) return;
+            destino.write(buffer.data(), buffer.size());
+            buffer.clear();  // clear() conserva la capacidad reservada
+        }
+
+        // Escribe lo acumulado y vacia el stream
+        void terminar() {
+            vaciar();
+            destino.flush();
+        }
+
+        size_t getEscritos() const { return escritos; }
+};
+
+
+// Niveles del registro de eventos, de mas a menos detallado
+enum class NivelLog { DEPURACION = 0, INFO = 1, ADVERTENCIA = 2, ERROR = 3 };
+
+// Interpreta el nombre de un nivel: depuracion, info, advertencia o error
+bool parsearNivelLog(const string& nombre, NivelLog& nivel) {
+    string valor = aMinusculas(nombre);
+    if (valor == "depuracion") nivel = NivelLog::DEPURACION;
+    else if (valor == "info") nivel = NivelLog::INFO;
+    else if (valor == "advertencia") nivel = NivelLog::ADVERTENCIA;
+    else if (valor == "error") nivel = NivelLog::ERROR;
+    else return false;
+    return true;
+}
+
+// Eventos por registro que se cuentan en lugar de imprimirse uno a uno
+enum class Evento { GUARDADO_LEVELDB, ELIMINADO_LEVELDB, DUPLICADO_OMITIDO, LINEA_INVALIDA, ERROR_LEVELDB, TOTAL };
+
+
+// Clase RegistroEventos
+// Registro con niveles, limite de mensajes por segundo para cada clave y escritura
+// asincrona: quien registra solo encola la linea y un hilo propio la escribe en
+// stderr por bloques. Los eventos por registro se acumulan en contadores atomicos
+// que las operaciones masivas resumen al terminar (ver ResumenEventos).
+class RegistroEventos {
+    private:
+        static const size_t CAPACIDAD_COLA = 10000;  // Lineas pendientes antes de descartar
+        static const int LIMITE_POR_SEGUNDO = 20;    // Mensajes por clave en cada segundo
+
+        // Mensajes emitidos y suprimidos de una clave en el segundo actual
+        struct Ventana {
+            time_t segundo = 0;
+            int emitidos = 0;
+            uint64_t suprimidos = 0;
+        };
+
+        atomic<int> nivelMinimo;                                      // Nivel por debajo del cual se ignora
+        array<atomic<uint64_t>, (size_t) Evento::TOTAL> contadores;   // Un contador por evento
+
+        mutex mutexVentanas;              // Protege 'ventanas'
+        map<string, Ventana> ventanas;    // Limite por clave
+
+        mutex mutexCola;                  // Protege la cola y las banderas
+        condition_variable hayLineas;     // Despierta al escritor
+        condition_variable colaVacia;     // Avisa a vaciar() que todo fue escrito
+        deque<string> cola;               // Lineas pendientes
+        uint64_t descartadas;             // Lineas perdidas con la cola llena
+        bool escribiendo;                 // El escritor tiene un bloque fuera de la cola
+        bool detenido;                    // El destructor pidio terminar
+        thread escritor;                  // Hilo que escribe en stderr
+
+        // Bucle del escritor: toma toda la cola de una vez y la escribe en un bloque
+        void escribirPendientes() {
+            unique_lock<mutex> bloqueo(mutexCola);
+            while (true) {
+                hayLineas.wait(bloqueo, [this] { return detenido || !cola.empty(); });
+                if (cola.empty() && detenido) return;
+
+                deque<string> bloque;
+                bloque.swap(cola);
+                uint64_t perdidas = descartadas;
+                descartadas = 0;
+                escribiendo = true;
+                bloqueo.unlock();
+
+                string texto;
+                for (const auto& linea : bloque) texto += linea;
+                if (perdidas > 0) {
+                    texto += "[registro] " + to_string(perdidas) + " lineas descartadas (cola llena)\n";
                 }
-                return "";
+                cerr.write(texto.data(), texto.size());
+                cerr.flush();
+
+                bloqueo.lock();
+                escribiendo = false;
+                if (cola.empty()) colaVacia.notify_all();
             }
-            
-            return value;
         }
-        
-        // Obtiene todos los pacientes de la base de datos
-        vector<string> buscarTodosLosPacientes() {
-            vector<string> resultados;
-            if (!connected) return resultados;
-            
-            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
-            
-            // Recorre todas las entradas y las formatea para mostrar
-            for (it->SeekToFirst(); it->Valid(); it->Next()) {
-                string id = it->key().ToString();
-                string pacienteData = it->value().ToString();
-                
-                // Parsea los campos separados por |
-                vector<string> campos;
-                size_t inicio = 0;
-                size_t fin = pacienteData.find('|');
-                
-                while (fin != string::npos) {
-                    campos.push_back(pacienteData.substr(inicio, fin - inicio));
-                    inicio = fin + 1;
-                    fin = pacienteData.find('|', inicio);
-                }
-                campos.push_back(pacienteData.substr(inicio));
-                
-                // Construye string formateado para mostrar
-                if (campos.size() >= 5) {
-                    string resultado = "ID: " + id +
-                                    " | Nombre: " + campos[0] +
-                                    " | Fecha: " + campos[1] +
-                                    " | Modalidad: " + campos[2] +
-                                    " | Sexo: " + campos[3] +
-                                    " | Tamano: " + campos[4] + " bytes";
-                    resultados.push_back(resultado);
-                }
+
+        static const char* nombreNivel(NivelLog nivel) {
+            switch (nivel) {
+                case NivelLog::DEPURACION: return "DEPURACION";
+                case NivelLog::INFO: return "INFO";
+                case NivelLog::ADVERTENCIA: return "ADVERTENCIA";
+                default: return "ERROR";
             }
-            
-            delete it;
-            return resultados;
         }
-        
-        // Busca pacientes por cualquier campo (busqueda parcial case-insensitive)
-        // campoIndex: 0=nombre, 1=fecha, 2=modalidad, 3=sexo, 4=tamano
-        vector<string> buscarPacientesPorCampo(int campoIndex, const string& valor) {
-            vector<string> resultados;
-            if (!connected) return resultados;
-            
-            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
-            string valorBusqueda = aMinusculas(valor);  // Normaliza para busqueda case-insensitive
-            
-            // Recorre todas las entradas buscando coincidencias
-            for (it->SeekToFirst(); it->Valid(); it->Next()) {
-                string id = it->key().ToString();
-                string pacienteData = it->value().ToString();
-                
-                // Parsea los campos
-                vector<string> campos;
-                size_t inicio = 0;
-                size_t fin = pacienteData.find('|');
-                
-                while (fin != string::npos) {
-                    campos.push_back(pacienteData.substr(inicio, fin - inicio));
-                    inicio = fin + 1;
-                    fin = pacienteData.find('|', inicio);
-                }
-                campos.push_back(pacienteData.substr(inicio));
-                
-                // Verifica si el campo especificado contiene el valor buscado
-                if ( (int)campos.size() > campoIndex) {
-                    string campoValor = campos[campoIndex];
-                    if (aMinusculas(campoValor).find(valorBusqueda) != string::npos) {
-                        string resultado = "ID: " + id +
-                                        " | Nombre: " + campos[0] +
-                                        " | Fecha: " + campos[1] +
-                                        " | Modalidad: " + campos[2] +
-                                        " | Sexo: " + campos[3] +
-                                        " | Tamano: " + campos[4] + " bytes";
-                        resultados.push_back(resultado);
-                    }
-                }
+
+        // Fecha y hora local con milisegundos
+        static string marcaTiempo() {
+            auto ahora = chrono::system_clock::now();
+            time_t segundos = chrono::system_clock::to_time_t(ahora);
+            long milisegundos = chrono::duration_cast<chrono::milliseconds>(ahora.time_since_epoch()).count() % 1000;
+            struct tm local;
+            localtime_r(&segundos, &local);
+            char texto[32];
+            size_t n = strftime(texto, sizeof(texto), "%Y-%m-%d %H:%M:%S", &local);
+            snprintf(texto + n, sizeof(texto) - n, ".%03ld", milisegundos);
+            return texto;
+        }
+
+        RegistroEventos() : nivelMinimo((int) NivelLog::INFO), descartadas(0), escribiendo(false), detenido(false) {
+            for (auto& contador : contadores) contador = 0;
+            escritor = thread(&RegistroEventos::escribirPendientes, this);
+        }
+
+    public:
+        // Escribe lo pendiente y termina el hilo escritor
+        ~RegistroEventos() {
+            {
+                lock_guard<mutex> bloqueo(mutexCola);
+                detenido = true;
             }
-            
-            delete it;
-            return resultados;
+            hayLineas.notify_all();
+            escritor.join();
         }
-        
-        // Elimina un paciente por su ID
-        bool eliminarPaciente(const string& id) {
-            if (!connected) return false;
-            
-            leveldb::Status status = db->Delete(leveldb::WriteOptions(), id);
-            
-            if (!status.ok()) {
-                if (!status.IsNotFound()) {
-                    cerr << "Error eliminando dato: " << status.ToString() << endl;
+
+        RegistroEventos(const RegistroEventos&) = delete;
+        RegistroEventos& operator=(const RegistroEventos&) = delete;
+
+        // Registro unico del programa
+        static RegistroEventos& instancia() {
+            static RegistroEventos registro;
+            return registro;
+        }
+
+        void setNivel(NivelLog nivel) { nivelMinimo = (int) nivel; }
+
+        bool habilitado(NivelLog nivel) const {
+            return (int) nivel >= nivelMinimo.load(memory_order_relaxed);
+        }
+
+        // Registra un mensaje. 'clave' agrupa mensajes similares: de cada clave se
+        // escriben como maximo LIMITE_POR_SEGUNDO por segundo y el resto se cuenta
+        void registrar(NivelLog nivel, const string& clave, const string& mensaje) {
+            if (!habilitado(nivel)) return;
+
+            uint64_t suprimidosAntes = 0;
+            {
+                lock_guard<mutex> bloqueo(mutexVentanas);
+                Ventana& ventana = ventanas[clave];
+                time_t ahora = time(nullptr);
+                if (ventana.segundo != ahora) {
+                    suprimidosAntes = ventana.suprimidos;
+                    ventana.segundo = ahora;
+                    ventana.emitidos = 0;
+                    ventana.suprimidos = 0;
                 }
-                return false;
+                if (ventana.emitidos >= LIMITE_POR_SEGUNDO) {
+                    ventana.suprimidos++;
+                    return;
+                }
+                ventana.emitidos++;
             }
-            
-            cout << "Paciente eliminado de LevelDB: " << id << endl;
-            return true;
-        }
-        
-        // Elimina todos los pacientes de la base de datos
-        void eliminarTodos() {
-            if (!connected) return;
-            
-            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
-            leveldb::WriteOptions write_options;
-            
-            // Recorre y elimina todas las entradas
-            for (it->SeekToFirst(); it->Valid(); it->Next()) {
-                leveldb::Status status = db->Delete(write_options, it->key());
-                if (!status.ok()) {
-                    cerr << "Error eliminando clave: " << status.ToString() << endl;
+
+            string linea = "[" + marcaTiempo() + "] [" + nombreNivel(nivel) + "] " + mensaje;
+            if (suprimidosAntes > 0) {
+                linea += " (" + to_string(suprimidosAntes) + " mensajes '" + clave + "' suprimidos)";
+            }
+            linea += '\n';
+
+            {
+                lock_guard<mutex> bloqueo(mutexCola);
+                if (cola.size() >= CAPACIDAD_COLA) {
+                    descartadas++;
+                    return;
                 }
+                cola.push_back(move(linea));
             }
-            
-            delete it;
-            cout << "Eliminacion completada de LevelDB" << endl;
+            hayLineas.notify_one();
+        }
+
+        void depuracion(const string& clave, const string& mensaje) { registrar(NivelLog::DEPURACION, clave, mensaje); }
+        void info(const string& clave, const string& mensaje) { registrar(NivelLog::INFO, clave, mensaje); }
+        void advertencia(const string& clave, const string& mensaje) { registrar(NivelLog::ADVERTENCIA, clave, mensaje); }
+        void error(const string& clave, const string& mensaje) { registrar(NivelLog::ERROR, clave, mensaje); }
+
+        // Suma 'cantidad' ocurrencias de un evento
+        void contar(Evento evento, uint64_t cantidad = 1) {
+            contadores[(size_t) evento].fetch_add(cantidad, memory_order_relaxed);
+        }
+
+        uint64_t getContador(Evento evento) const {
+            return contadores[(size_t) evento].load(memory_order_relaxed);
+        }
+
+        // Espera a que todas las lineas encoladas esten escritas
+        void vaciar() {
+            unique_lock<mutex> bloqueo(mutexCola);
+            colaVacia.wait(bloqueo, [this] { return cola.empty() && !escribiendo; });
         }
 };
 
+// Acceso corto al registro del programa
+inline RegistroEventos& registro() {
+    return RegistroEventos::instancia();
+}
 
-// Clase SistemaPacientes
-// Clase principal que integra Boost Multi-Index en memoria con LevelDB persistente
-class SistemaPacientes {
+
+// Clase ResumenEventos
+// Toma los contadores al empezar una operacion masiva y, al terminar, registra en
+// nivel INFO cuantos eventos de cada tipo ocurrieron (incluye los de otros hilos
+// que hayan trabajado a la vez)
+class ResumenEventos {
     private:
-        PacienteContainer pacientesContainer;  // Contenedor en memoria con multiples indices
-        LevelDBManager leveldb;                // Gestor de base de datos persistente
-        
-        // Funcion auxiliar para convertir a minusculas (case-insensitive)
-        string aMinusculas(const string& str) const {
-            string result = str;
-            transform(result.begin(), result.end(), result.begin(), ::tolower);
-            return result;
-        }
-            
+        string operacion;
+        array<uint64_t, (size_t) Evento::TOTAL> inicio;
+
     public:
-        // Constructor - inicializa LevelDB y carga datos existentes
-        SistemaPacientes() : leveldb() {
-            if (!leveldb.isConnected()) {
-                cerr << "Advertencia: No se pudo inicializar LevelDB. Los datos no se persistiran." << endl;
-            } else {
-                cargarDesdeBaseDeDatos();
+        explicit ResumenEventos(const string& nombreOperacion) : operacion(nombreOperacion) {
+            for (size_t i = 0; i < inicio.size(); ++i) inicio[i] = registro().getContador((Evento) i);
+        }
+
+        // Registra los eventos ocurridos desde la construccion, si hubo alguno
+        void registrar() const {
+            static const char* nombres[] = {
+                "guardados en LevelDB", "eliminados de LevelDB", "duplicados omitidos",
+                "lineas invalidas", "errores de LevelDB"
+            };
+            string detalle;
+            for (size_t i = 0; i < inicio.size(); ++i) {
+                uint64_t cantidad = registro().getContador((Evento) i) - inicio[i];
+                if (cantidad == 0) continue;
+                if (!detalle.empty()) detalle += ", ";
+                detalle += to_string(cantidad) + " " + nombres[i];
             }
+            if (!detalle.empty()) registro().info("resumen", operacion + ": " + detalle);
         }
-        
-        // Metodos necesarios para el MenuPrincipal
-        
-        // Verifica si la base de datos esta conectada
-        bool isDBConnected() const {
-            return leveldb.isConnected();
+};
+
+
+// Operaciones cuya latencia se mide en el camino caliente
+enum class OperacionMedida {
+    ALTA, ALTA_LOTE, ACTUALIZACION, BAJA, BAJA_MASIVA,
+    BUSQUEDA_ID, BUSQUEDA_NOMBRE, BUSQUEDA_MODALIDAD, BUSQUEDA_SEXO,
+    LEVELDB_LECTURA, LEVELDB_ESCRITURA, LEVELDB_RECORRIDO, TOTAL
+};
+
+// Contadores de volumen que acompanan a las latencias
+enum class ContadorRendimiento {
+    INSERCIONES, ELIMINACIONES, CONSULTAS_INDICE,
+    LEVELDB_GETS, LEVELDB_ESCRITURAS, LEVELDB_RECORRIDOS, BYTES_LEIDOS, BYTES_ESCRITOS,
+    CACHE_ACIERTOS, CACHE_FALLOS, CACHE_DESALOJOS, TOTAL
+};
+
+
+// Histograma de latencias en nanosegundos con cubetas log-lineales (estilo HDR):
+// cada potencia de dos se divide en SUBCUBETAS partes iguales, por lo que el error
+// relativo de cualquier percentil es menor a 1/SUBCUBETAS (6.25%) en todo el rango
+struct HistogramaLatencia {
+    static const int BITS_SUBCUBETA = 4;
+    static const size_t SUBCUBETAS = 1 << BITS_SUBCUBETA;
+    static const size_t CUBETAS = (64 - BITS_SUBCUBETA + 1) * SUBCUBETAS;
+
+    array<uint64_t, CUBETAS> cubetas{};
+    uint64_t sumaNanos = 0;
+
+    // Cubeta que corresponde a una duracion
+    static size_t indice(uint64_t nanos) {
+        if (nanos < SUBCUBETAS) return nanos;
+        int exponente = 63 - __builtin_clzll(nanos);
+        int desplazamiento = exponente - BITS_SUBCUBETA;
+        return (desplazamiento + 1) * SUBCUBETAS + ((nanos >> desplazamiento) - SUBCUBETAS);
+    }
+
+    // Mayor duracion que cae en la cubeta (el valor que se informa para ella)
+    static uint64_t limiteSuperior(size_t cubeta) {
+        if (cubeta < SUBCUBETAS) return cubeta;
+        int desplazamiento = cubeta / SUBCUBETAS - 1;
+        uint64_t mantisa = cubeta % SUBCUBETAS + SUBCUBETAS;
+        return ((mantisa + 1) << desplazamiento) - 1;
+    }
+
+    uint64_t cantidad() const {
+        uint64_t total = 0;
+        for (uint64_t c : cubetas) total += c;
+        return total;
+    }
+
+    double promedio() const {
+        uint64_t total = cantidad();
+        return total ? (double) sumaNanos / total : 0;
+    }
+
+    // Duracion bajo la cual queda el porcentaje pedido (0-100) de las mediciones
+    uint64_t percentil(double porcentaje) const {
+        uint64_t total = cantidad();
+        if (total == 0) return 0;
+        uint64_t objetivo = max<uint64_t>(1, (uint64_t) ceil(total * porcentaje / 100.0));
+        uint64_t acumulado = 0;
+        for (size_t i = 0; i < CUBETAS; ++i) {
+            acumulado += cubetas[i];
+            if (acumulado >= objetivo) return limiteSuperior(i);
         }
-        
-        // Obtiene la cantidad de pacientes en LevelDB
-        long getCantidadLevelDB() const {
-            return leveldb.isConnected() ? leveldb.contarPacientes() : 0;
+        return maximo();
+    }
+
+    uint64_t maximo() const {
+        for (size_t i = CUBETAS; i-- > 0;) {
+            if (cubetas[i]) return limiteSuperior(i);
         }
-        
-        // Carga pacientes desde un archivo de texto con formato compacto
-        bool cargarDesdeArchivoCompacto(const string& nombreArchivo) {
-            if (!DataPaciente::archivoExiste(nombreArchivo)) {
-                cerr << "Error: El archivo '" << nombreArchivo << "' no existe" << endl;
-                return false;
-            }
-            
-            ifstream archivo(nombreArchivo);
-            if (!archivo.is_open()) {
-                cerr << "Error al abrir archivo: " << nombreArchivo << endl;
-                return false;
+        return 0;
+    }
+
+    void combinar(const HistogramaLatencia& otro) {
+        for (size_t i = 0; i < CUBETAS; ++i) cubetas[i] += otro.cubetas[i];
+        sumaNanos += otro.sumaNanos;
+    }
+
+    // Quita las mediciones de una instantanea anterior (ver EstadisticasRendimiento::reiniciar)
+    void restar(const HistogramaLatencia& anterior) {
+        for (size_t i = 0; i < CUBETAS; ++i) cubetas[i] -= anterior.cubetas[i];
+        sumaNanos -= anterior.sumaNanos;
+    }
+};
+
+// Estado de las estadisticas en un momento dado
+struct InstantaneaRendimiento {
+    array<HistogramaLatencia, (size_t) OperacionMedida::TOTAL> operaciones;
+    array<uint64_t, (size_t) ContadorRendimiento::TOTAL> contadores{};
+    double segundos = 0;  // Tiempo cubierto desde el inicio o el ultimo reinicio
+
+    void restar(const InstantaneaRendimiento& anterior) {
+        for (size_t i = 0; i < operaciones.size(); ++i) operaciones[i].restar(anterior.operaciones[i]);
+        for (size_t i = 0; i < contadores.size(); ++i) contadores[i] -= anterior.contadores[i];
+    }
+};
+
+
+// Clase EstadisticasRendimiento
+// Cada hilo registra en sus propios histogramas y contadores, por lo que medir no
+// comparte lineas de cache entre hilos ni usa instrucciones atomicas con bloqueo
+// (solo cargas y escrituras relajadas que el dueno no ve disputadas). Leer las
+// estadisticas suma los datos de todos los hilos vivos y de los que ya terminaron.
+class EstadisticasRendimiento {
+    private:
+        // Mediciones de un hilo; solo el hilo dueno escribe, los lectores solo cargan
+        struct MedicionesHilo {
+            array<array<atomic<uint64_t>, HistogramaLatencia::CUBETAS>, (size_t) OperacionMedida::TOTAL> cubetas{};
+            array<atomic<uint64_t>, (size_t) OperacionMedida::TOTAL> sumas{};
+            array<atomic<uint64_t>, (size_t) ContadorRendimiento::TOTAL> contadores{};
+
+            // Suma exclusiva del hilo dueno: sin fetch_add, que bloquearia el bus
+            static void sumar(atomic<uint64_t>& valor, uint64_t cantidad) {
+                valor.store(valor.load(memory_order_relaxed) + cantidad, memory_order_relaxed);
             }
-            
-            string linea;
-            int pacientesCargados = 0;
-            int lineasProcesadas = 0;
-            
-            // Procesa cada linea del archivo
-            while (getline(archivo, linea)) {
-                lineasProcesadas++;
-                if (linea.empty() || linea[0] == '#') continue;  // Salta lineas vacias o comentarios
-                
-                DataPaciente paciente;
-                if (paciente.cargarDesdeFormatoCompacto(linea)) {
-                    // Verifica que no exista duplicado antes de agregar
-                    if (!existePaciente(paciente.getPatientID())) {
-                        agregarPaciente(paciente);
-                        pacientesCargados++;
-                    } else {
-                        cout << "Paciente con ID " << paciente.getPatientID() << " ya existe, omitiendo." << endl;
+
+            void volcarEn(InstantaneaRendimiento& destino) const {
+                for (size_t op = 0; op < cubetas.size(); ++op) {
+                    for (size_t i = 0; i < HistogramaLatencia::CUBETAS; ++i) {
+                        destino.operaciones[op].cubetas[i] += cubetas[op][i].load(memory_order_relaxed);
                     }
-                } else {
-                    cerr << "Error procesando linea " << lineasProcesadas << ": " << linea << endl;
+                    destino.operaciones[op].sumaNanos += sumas[op].load(memory_order_relaxed);
+                }
+                for (size_t i = 0; i < contadores.size(); ++i) {
+                    destino.contadores[i] += contadores[i].load(memory_order_relaxed);
                 }
             }
-            
-            archivo.close();
-            cout << "Cargados " << pacientesCargados << " pacientes desde archivo compacto: " << nombreArchivo << endl;
-            return pacientesCargados > 0;
-        }
-        
-        // Verifica si un paciente existe por su ID
-        bool existePaciente(const string& id) const {
-            auto& index = pacientesContainer.get<0>();  // Indice por ID
-            return index.find(id) != index.end();
-        }
-        
-        // Agrega un nuevo paciente al sistema (memoria y persistencia)
-        void agregarPaciente(const DataPaciente& paciente) {
-            if (existePaciente(paciente.getPatientID())) {
-                cout << "El paciente con ID " << paciente.getPatientID() << " ya existe." << endl;
-                return;
+        };
+
+        // Alta del hilo en el primer uso y traspaso de sus datos a 'terminados' al salir
+        struct RegistroHilo {
+            EstadisticasRendimiento& estadisticas;
+            unique_ptr<MedicionesHilo> mediciones;
+
+            explicit RegistroHilo(EstadisticasRendimiento& e) : estadisticas(e), mediciones(new MedicionesHilo()) {
+                lock_guard<mutex> bloqueo(estadisticas.mutexHilos);
+                estadisticas.hilos.push_back(mediciones.get());
             }
-            
-            // Inserta en el contenedor en memoria
-            pacientesContainer.insert(PacienteData(paciente));
-            
-            // Persiste en LevelDB si esta conectado
-            if (leveldb.isConnected()) {
-                leveldb.guardarPaciente(
-                    paciente.getPatientID(),
-                    paciente.getPatientName(),
-                    paciente.getStudyDate(),
-                    paciente.getModality(),
-                    paciente.getSex(),
-                    paciente.getSize()
-                );
+
+            ~RegistroHilo() {
+                lock_guard<mutex> bloqueo(estadisticas.mutexHilos);
+                mediciones->volcarEn(estadisticas.terminados);
+                auto& hilos = estadisticas.hilos;
+                hilos.erase(find(hilos.begin(), hilos.end(), mediciones.get()));
             }
+        };
+
+        mutex mutexHilos;                       // Protege 'hilos', 'terminados' y 'base'
+        vector<MedicionesHilo*> hilos;          // Hilos vivos que ya midieron algo
+        InstantaneaRendimiento terminados;      // Datos de hilos que ya terminaron
+        InstantaneaRendimiento base;            // Instantanea del ultimo reinicio
+        chrono::steady_clock::time_point inicio = chrono::steady_clock::now();
+
+        EstadisticasRendimiento() = default;
+
+        MedicionesHilo& delHilo() {
+            thread_local RegistroHilo registroHilo(*this);
+            return *registroHilo.mediciones;
         }
-        
-        // Busca pacientes por nombre (busqueda parcial case-insensitive)
-        vector<DataPaciente> buscarPorNombre(const string& nombre) const {
-            vector<DataPaciente> resultados;
-            if (pacientesContainer.empty()) return resultados;
-            
-            string nombreBusqueda = aMinusculas(nombre);
-            auto& index = pacientesContainer.get<1>();  // Indice por nombre
-            
-            // Recorre todos los pacientes buscando coincidencias parciales
-            for (auto it = index.begin(); it != index.end(); ++it) {
-                string nombrePaciente = aMinusculas(it->patientName);
-                if (nombrePaciente.find(nombreBusqueda) != string::npos) {
-                    resultados.push_back(it->toDataPaciente());
-                }
-            }
-            return resultados;
+
+    public:
+        EstadisticasRendimiento(const EstadisticasRendimiento&) = delete;
+        EstadisticasRendimiento& operator=(const EstadisticasRendimiento&) = delete;
+
+        // Estadisticas unicas del programa
+        static EstadisticasRendimiento& instancia() {
+            static EstadisticasRendimiento estadisticas;
+            return estadisticas;
         }
-        
-        // Busca pacientes por ID (busqueda exacta)
-        vector<DataPaciente> buscarPorID(const string& id) const {
-            vector<DataPaciente> resultados;
-            if (pacientesContainer.empty()) return resultados;
-            
-            string idBusqueda = aMinusculas(id);
-            auto& index = pacientesContainer.get<0>();  // Indice por ID
-            
-            auto it = index.find(id);
-            if (it != index.end()) {
-                string idPaciente = aMinusculas(it->patientID);
-                if (idPaciente.find(idBusqueda) != string::npos) {
-                    resultados.push_back(it->toDataPaciente());
-                }
+
+        // Registra una duracion de la operacion indicada
+        void registrar(OperacionMedida operacion, uint64_t nanos) {
+            MedicionesHilo& propias = delHilo();
+            MedicionesHilo::sumar(propias.cubetas[(size_t) operacion][HistogramaLatencia::indice(nanos)], 1);
+            MedicionesHilo::sumar(propias.sumas[(size_t) operacion], nanos);
+        }
+
+        // Suma 'cantidad' al contador indicado
+        void contar(ContadorRendimiento contador, uint64_t cantidad = 1) {
+            MedicionesHilo::sumar(delHilo().contadores[(size_t) contador], cantidad);
+        }
+
+        // Mediciones acumuladas desde el inicio o el ultimo reinicio
+        InstantaneaRendimiento instantanea() {
+            lock_guard<mutex> bloqueo(mutexHilos);
+            InstantaneaRendimiento resultado = terminados;
+            for (const MedicionesHilo* mediciones : hilos) mediciones->volcarEn(resultado);
+            resultado.restar(base);
+            resultado.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            return resultado;
+        }
+
+        // Pone las estadisticas en cero sin tocar los datos de los hilos: guarda el
+        // total actual como base y las instantaneas siguientes lo descuentan
+        void reiniciar() {
+            lock_guard<mutex> bloqueo(mutexHilos);
+            base = terminados;
+            for (const MedicionesHilo* mediciones : hilos) mediciones->volcarEn(base);
+            inicio = chrono::steady_clock::now();
+        }
+};
+
+// Acceso corto a las estadisticas del programa
+inline EstadisticasRendimiento& estadisticas() {
+    return EstadisticasRendimiento::instancia();
+}
+
+
+// Clase TemporizadorOperacion
+// Mide el tiempo de vida del objeto y lo registra como una operacion al destruirse
+class TemporizadorOperacion {
+    private:
+        OperacionMedida operacion;
+        chrono::steady_clock::time_point inicio;
+
+    public:
+        explicit TemporizadorOperacion(OperacionMedida op)
+            : operacion(op), inicio(chrono::steady_clock::now()) {}
+
+        ~TemporizadorOperacion() {
+            estadisticas().registrar(operacion, chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - inicio).count());
+        }
+};
+
+
+// Clase RecorridoMedido
+// Mide un recorrido de LevelDB: su duracion, un recorrido mas y los bytes leidos
+class RecorridoMedido {
+    private:
+        TemporizadorOperacion temporizador{OperacionMedida::LEVELDB_RECORRIDO};
+        uint64_t bytes = 0;
+
+    public:
+        RecorridoMedido() { estadisticas().contar(ContadorRendimiento::LEVELDB_RECORRIDOS); }
+        ~RecorridoMedido() { estadisticas().contar(ContadorRendimiento::BYTES_LEIDOS, bytes); }
+
+        // Suma la entrada actual del iterador
+        void leer(const leveldb::Iterator* it) { bytes += it->key().size() + it->value().size(); }
+};
+
+
+// Muestra latencias por operacion (microsegundos) y contadores de una instantanea
+void mostrarEstadisticasRendimiento(const InstantaneaRendimiento& instantanea, ostream& destino) {
+    static const char* operaciones[] = {
+        "Alta", "Alta por lote", "Actualizacion", "Baja", "Baja masiva",
+        "Busqueda por ID", "Busqueda por nombre", "Busqueda por modalidad", "Busqueda por sexo",
+        "LevelDB lectura", "LevelDB escritura", "LevelDB recorrido"
+    };
+    static const char* contadores[] = {
+        "Pacientes insertados", "Pacientes eliminados", "Consultas a indices",
+        "LevelDB gets", "LevelDB escrituras (put, delete, lote)", "LevelDB recorridos",
+        "Bytes leidos de LevelDB", "Bytes escritos en LevelDB",
+        "Cache de registros: aciertos", "Cache de registros: fallos", "Cache de registros: desalojos"
+    };
+
+    char linea[160];
+    snprintf(linea, sizeof(linea), "Estadisticas de rendimiento (%.1f s)\n", instantanea.segundos);
+    destino << linea;
+    snprintf(linea, sizeof(linea), "%-24s %12s %10s %10s %10s %10s %10s %10s\n",
+             "Operacion (us)", "Cantidad", "Promedio", "p50", "p90", "p99", "p99.9", "Max");
+    destino << linea;
+    for (size_t i = 0; i < instantanea.operaciones.size(); ++i) {
+        const HistogramaLatencia& histograma = instantanea.operaciones[i];
+        uint64_t cantidad = histograma.cantidad();
+        if (cantidad == 0) continue;
+        snprintf(linea, sizeof(linea), "%-24s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                 operaciones[i], (unsigned long long) cantidad, histograma.promedio() / 1e3,
+                 histograma.percentil(50) / 1e3, histograma.percentil(90) / 1e3,
+                 histograma.percentil(99) / 1e3, histograma.percentil(99.9) / 1e3,
+                 histograma.maximo() / 1e3);
+        destino << linea;
+    }
+    for (size_t i = 0; i < instantanea.contadores.size(); ++i) {
+        snprintf(linea, sizeof(linea), "%-40s %14llu\n", contadores[i],
+                 (unsigned long long) instantanea.contadores[i]);
+        destino << linea;
+    }
+
+    // Solo el modo acotado consulta la cache de registros
+    uint64_t aciertos = instantanea.contadores[(size_t) ContadorRendimiento::CACHE_ACIERTOS];
+    uint64_t fallos = instantanea.contadores[(size_t) ContadorRendimiento::CACHE_FALLOS];
+    if (aciertos + fallos > 0) {
+        snprintf(linea, sizeof(linea), "%-40s %13.1f%%\n", "Cache de registros: tasa de aciertos",
+                 100.0 * aciertos / (aciertos + fallos));
+        destino << linea;
+    }
+}
+
+// Escribe las estadisticas actuales en un archivo, con fecha, para comparar corridas
+bool volcarEstadisticasRendimiento(const string& ruta) {
+    ofstream archivo(ruta, ios::app);
+    if (!archivo.is_open()) {
+        cerr << "Error al abrir archivo de estadisticas: " << ruta << endl;
+        return false;
+    }
+    time_t ahora = time(nullptr);
+    char fecha[32];
+    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", localtime(&ahora));
+    archivo << "== " << fecha << " ==" << endl;
+    mostrarEstadisticasRendimiento(estadisticas().instantanea(), archivo);
+    archivo << endl;
+    return true;
+}
+
+
+// Clase LevelDBManager
+// Gestiona la base de datos LevelDB para almacenamiento persistente de pacientes
+class LevelDBManager {
+    private:
+        leveldb::DB* db;        // Puntero a la base de datos LevelDB
+        bool connected;         // Estado de conexion a la base de datos
+        string dbPath;          // Ruta donde se almacena la base de datos
+        const leveldb::FilterPolicy* filtro;  // Evita leer bloques al buscar IDs inexistentes
+        leveldb::Cache* cacheBloques;         // Cache de bloques; propia para poder medir su uso
+
+        static const size_t CAPACIDAD_CACHE = 8 << 20;  // La misma que LevelDB usa por defecto
+
+        // Registro de cambios: con una instantanea configurada, cada lote que toca pacientes
+        // agrega la entrada "#cambio:<secuencia en hex>" con los IDs tocados separados por
+        // '\n' (vacia si se borro toda la base). Permite aplicar a una instantanea solo lo
+        // posterior a ella; cada instantanea nueva recorta lo anterior
+        static const string PREFIJO_CAMBIOS;
+        static const string CLAVE_BASE_CAMBIOS;   // Secuencia hasta la que se recorto el registro
+        static const string CLAVE_ULTIMO_CAMBIO;  // Ultima secuencia escrita (sin recorrer el registro)
+        atomic<uint64_t> secuenciaCambios;        // Ultima secuencia asignada
+        bool registroCambios;                     // Sin instantanea no se registran cambios
+
+        // Junta las claves de pacientes (escritas o borradas) de un lote
+        struct ClavesDelLote : leveldb::WriteBatch::Handler {
+            string claves;
+
+            void Put(const leveldb::Slice& clave, const leveldb::Slice&) override { agregar(clave); }
+            void Delete(const leveldb::Slice& clave) override { agregar(clave); }
+
+            void agregar(const leveldb::Slice& clave) {
+                if (esClaveMeta(clave)) return;
+                if (!claves.empty()) claves += '\n';
+                claves.append(clave.data(), clave.size());
             }
-            return resultados;
+        };
+
+        static string claveCambio(uint64_t secuencia) {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) secuencia);
+            return PREFIJO_CAMBIOS + hex;
         }
-        
-        // Busca pacientes por modalidad de estudio
-        vector<DataPaciente> buscarPorModalidad(const string& modalidad) const {
-            vector<DataPaciente> resultados;
-            if (pacientesContainer.empty()) return resultados;
-            
-            string modalidadBusqueda = aMinusculas(modalidad);
-            auto& index = pacientesContainer.get<2>();  // Indice por modalidad
-            
-            // Usa equal_range para obtener todos los pacientes con esa modalidad
-            auto range = index.equal_range(modalidad);
-            
-            for (auto it = range.first; it != range.second; ++it) {
-                string modalidadPaciente = aMinusculas(it->modality);
-                if (modalidadPaciente.find(modalidadBusqueda) != string::npos) {
-                    resultados.push_back(it->toDataPaciente());
-                }
+
+        // Agrega al lote la entrada del registro de cambios con la siguiente secuencia
+        void registrarCambios(leveldb::WriteBatch& lote) {
+            if (!registroCambios) return;
+            ClavesDelLote claves;
+            lote.Iterate(&claves);
+            if (claves.claves.empty()) return;  // Solo metadatos (agregados, recortes del registro)
+            uint64_t secuencia = ++secuenciaCambios;
+            lote.Put(claveCambio(secuencia), claves.claves);
+            lote.Put(CLAVE_ULTIMO_CAMBIO, to_string(secuencia));
+        }
+
+        // Valor numerico de una clave de metadatos (0 si no esta)
+        uint64_t leerNumeroMeta(const string& clave) const {
+            string valor;
+            if (!connected || !db->Get(leveldb::ReadOptions(), clave, &valor).ok()) return 0;
+            return strtoull(valor.c_str(), nullptr, 10);
+        }
+
+        // Ultima secuencia usada. Los lotes concurrentes pueden escribir la clave de la
+        // ultima secuencia fuera de orden: solo se recorren las entradas posteriores a ella
+        uint64_t leerSecuenciaCambios() const {
+            uint64_t secuencia = max(getBaseCambios(), leerNumeroMeta(CLAVE_ULTIMO_CAMBIO));
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            for (it->Seek(claveCambio(secuencia + 1)); it->Valid() && it->key().starts_with(PREFIJO_CAMBIOS); it->Next()) {
+                secuencia = max<uint64_t>(secuencia, strtoull(it->key().ToString().c_str() + PREFIJO_CAMBIOS.size(), nullptr, 16));
             }
-            return resultados;
+            delete it;
+            return secuencia;
+        }
+
+        // Texto para mostrar: ID: x | Nombre: ... | Tamano: n bytes
+        static string describirPaciente(const PacienteData& paciente) {
+            string resultado = "ID: " + paciente.patientID;
+            EsquemaPaciente::paraCadaCampo([&](auto campo) {
+                typedef DescriptorCampo<decltype(campo)::value> Descriptor;
+                resultado += string(" | ") + Descriptor::etiqueta + ": " +
+                             EsquemaPaciente::comoTexto(EsquemaPaciente::valor<decltype(campo)::value>(paciente)) +
+                             Descriptor::sufijo;
+            });
+            return resultado;
+        }
+
+        // Escribe un lote registrando su latencia, su tamano y sus cambios
+        leveldb::Status escribirLote(leveldb::WriteBatch& lote) {
+            registrarCambios(lote);
+            TemporizadorOperacion medicion(OperacionMedida::LEVELDB_ESCRITURA);
+            estadisticas().contar(ContadorRendimiento::LEVELDB_ESCRITURAS);
+            estadisticas().contar(ContadorRendimiento::BYTES_ESCRITOS, lote.ApproximateSize());
+            return db->Write(leveldb::WriteOptions(), &lote);
         }
         
-        // Busca pacientes por sexo
-        vector<DataPaciente> buscarPorSexo(const string& sexo) const {
-            vector<DataPaciente> resultados;
-            if (pacientesContainer.empty()) return resultados;
+    public:
+        // Constructor - inicializa la conexion con LevelDB
+        LevelDBManager(const string& path = "./leveldb_data")
+            : db(nullptr), connected(false), dbPath(path), filtro(leveldb::NewBloomFilterPolicy(10)),
+              cacheBloques(leveldb::NewLRUCache(CAPACIDAD_CACHE)), secuenciaCambios(0), registroCambios(false) {
+            leveldb::Options options;
+            options.create_if_missing = true;  // Crea la DB si no existe
+            options.filter_policy = filtro;     // Las altas consultan si el ID ya estaba guardado
+            options.block_cache = cacheBloques;
             
-            string sexoBusqueda = aMinusculas(sexo);
-            auto& index = pacientesContainer.get<3>();  // Indice por sexo
+            // Crea el directorio si no existe
+            mkdir(dbPath.c_str(), 0755);
             
-            auto range = index.equal_range(sexo);
+            // Intenta abrir la base de datos
+            leveldb::Status status = leveldb::DB::Open(options, dbPath, &db);
             
-            for (auto it = range.first; it != range.second; ++it) {
-                string sexoPaciente = aMinusculas(it->sex);
-                if (sexoPaciente.find(sexoBusqueda) != string::npos) {
-                    resultados.push_back(it->toDataPaciente());
-                }
+            if (!status.ok()) {
+                registro().error("leveldb", "Error abriendo LevelDB: " + status.ToString());
+                connected = false;
+                return;
             }
-            return resultados;
+            
+            connected = true;
+            secuenciaCambios = leerSecuenciaCambios();
+            registro().info("leveldb", "LevelDB inicializado correctamente. Base de datos en: " + dbPath);
         }
         
-        // Busqueda exacta por ID (devuelve puntero para modificaciones)
-        DataPaciente* buscarExactoPorID(const string& id) {
-            auto& index = pacientesContainer.get<0>();
-            auto it = index.find(id);
-            if (it != index.end()) {
-                DataPaciente* resultado = new DataPaciente(it->toDataPaciente());
-                return resultado;
+        // Destructor - libera los recursos de la base de datos
+        ~LevelDBManager() {
+            if (db) {
+                delete db;
             }
-            return nullptr;
+            delete filtro;  // Despues de cerrar la base, que lo usa hasta el final
+            delete cacheBloques;
         }
         
-        // Busqueda directa en LevelDB (para verificacion de persistencia)
-        void buscarEnLevelDB(const string& campo, const string& valor) {
-            if (!leveldb.isConnected()) {
-                cout << "Error: No hay conexion con LevelDB" << endl;
-                return;
-            }
-            
-            int campoIndex = -1;
-            if (campo == "nombre") campoIndex = 0;
-            else if (campo == "_id") {
-                // Busqueda directa por ID (clave primaria)
-                string resultado = leveldb.buscarPacientePorID(valor);
-                cout << "\n=== RESULTADO DE BUSQUEDA EN LEVELDB ===" << endl;
-                if (!resultado.empty()) {
-                    vector<string> campos;
-                    size_t inicio = 0;
-                    size_t fin = resultado.find('|');
-                    
-                    while (fin != string::npos) {
-                        campos.push_back(resultado.substr(inicio, fin - inicio));
-                        inicio = fin + 1;
-                        fin = resultado.find('|', inicio);
-                    }
-                    campos.push_back(resultado.substr(inicio));
-                    
-                    if (campos.size() >= 5) {
-                        cout << "ID: " << valor << endl;
-                        cout << "Nombre: " << campos[0] << endl;
-                        cout << "Fecha: " << campos[1] << endl;
-                        cout << "Modalidad: " << campos[2] << endl;
-                        cout << "Sexo: " << campos[3] << endl;
-                        cout << "Tamano: " << campos[4] << " bytes" << endl;
-                    }
-                } else {
-                    cout << "No se encontro el paciente con ID: " << valor << endl;
+        // Verifica si la conexion a la base de datos esta activa
+        bool isConnected() const {
+            return connected;
+        }
+
+        // Memoria que LevelDB usa ahora: bytes en la cache de bloques y en las memtables
+        // (activa e inmutable). approximate-memory-usage suma ambas, la diferencia son las memtables
+        void usoMemoria(uint64_t& enCache, uint64_t& capacidadCache, uint64_t& enMemtables) const {
+            enCache = cacheBloques->TotalCharge();
+            capacidadCache = CAPACIDAD_CACHE;
+            uint64_t total = 0;
+            string valor;
+            if (connected && db->GetProperty("leveldb.approximate-memory-usage", &valor)) {
+                try {
+                    total = stoull(valor);
+                } catch (...) {
+                    total = 0;
                 }
-                return;
-            }
-            else if (campo == "modalidad") campoIndex = 2;
-            else if (campo == "sexo") campoIndex = 3;
-            
-            if (campoIndex == -1) {
-                cout << "Campo de busqueda no valido" << endl;
-                return;
-            }
-            
-            // Busqueda por campos secundarios (requiere escaneo completo)
-            auto resultados = leveldb.buscarPacientesPorCampo(campoIndex, valor);
-            cout << "\n=== RESULTADOS DE BUSQUEDA EN LEVELDB ===" << endl;
-            for (const auto& resultado : resultados) {
-                cout << resultado << endl;
-                cout << "-------------------" << endl;
-            }
-            if (resultados.empty()) {
-                cout << "No se encontraron resultados en LevelDB" << endl;
             }
+            enMemtables = total > enCache ? total - enCache : 0;
+        }
+
+        // Las claves que empiezan con '#' guardan metadatos (por ejemplo agregados), no pacientes
+        static bool esClaveMeta(const leveldb::Slice& clave) {
+            return !clave.empty() && clave[0] == '#';
         }
         
-        // Muestra todos los pacientes en memoria
-        void mostrarTodos() const {
-            if (pacientesContainer.empty()) {
-                cout << "No hay pacientes registrados." << endl;
-                return;
-            }
+        // Cuenta el numero total de pacientes en la base de datos
+        long contarPacientes() const {
+            if (!connected) return 0;
             
-            auto& index = pacientesContainer.get<4>();  // Indice secuencial (orden de insercion)
-            int contador = 1;
+            RecorridoMedido medicion;
+            long count = 0;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
             
-            for (const auto& paciente : index) {
-                cout << "------------------------------------------------------" << endl;
-                cout << "           Paciente " << contador++ << endl;
-                cout << "------------------------------------------------------" << endl;
-                paciente.toDataPaciente().mostrarInfo();
+            // Recorre todas las entradas contandolas
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                medicion.leer(it);
+                if (!esClaveMeta(it->key())) count++;
             }
+            
+            delete it;
+            return count;
         }
         
-        // Verifica sincronizacion entre memoria y base de datos
-        void sincronizarConBaseDeDatos() {
-            if (!leveldb.isConnected()) {
-                cout << "No hay conexion a la base de datos para sincronizar." << endl;
-                return;
-            }
+        // Guarda un nuevo paciente en la base de datos
+        // Formato: clave=ID, valor segun EsquemaPaciente (nombre|fecha|modalidad|sexo|tamano)
+        bool guardarPaciente(const PacienteData& paciente) {
+            if (!connected) return false;
             
-            long pacientesEnBD = leveldb.contarPacientes();
-            size_t pacientesEnMemoria = pacientesContainer.size();
+            // Como lote de una escritura, para que quede en el registro de cambios
+            leveldb::WriteBatch lote;
+            agregarAlLote(lote, paciente);
+            leveldb::Status status = escribirLote(lote);
             
-            cout << "Sincronizacion:" << endl;
-            cout << "- Pacientes en memoria (Boost Multi-Index): " << pacientesEnMemoria << endl;
-            cout << "- Pacientes en LevelDB: " << pacientesEnBD << endl;
+            if (!status.ok()) {
+                registro().contar(Evento::ERROR_LEVELDB);
+                registro().error("leveldb", "Error guardando dato: " + status.ToString());
+                return false;
+            }
             
-            if (pacientesEnBD > (long) pacientesEnMemoria ) {
-                cout << "Nota: LevelDB tiene mas pacientes. Los datos estan persistidos correctamente." << endl;
-            } else if (pacientesEnBD < (long) pacientesEnMemoria) {
-                cout << "Advertencia: Hay pacientes en memoria que no estan en LevelDB." << endl;
-            } else {
-                cout << "Los datos estan sincronizados." << endl;
+            // Evento por registro: se cuenta y el mensaje solo se arma en nivel de depuracion
+            registro().contar(Evento::GUARDADO_LEVELDB);
+            if (registro().habilitado(NivelLog::DEPURACION)) {
+                registro().depuracion("guardado", "Paciente guardado en LevelDB: " + paciente.patientID);
             }
+            return true;
         }
-        
-        // Obtiene cantidad de pacientes en memoria
-        size_t getCantidadPacientes() const {
-            return pacientesContainer.size();
+
+        // Agrega la escritura de un paciente a un lote (no escribe hasta aplicarLote)
+        static void agregarAlLote(leveldb::WriteBatch& lote, const PacienteData& paciente) {
+            lote.Put(paciente.patientID, EsquemaPaciente::serializar(paciente));
         }
-        
-        // Calcula el peso total de archivos en memoria
-        long long pesoEnMemoria() const {
-            long long peso = 0;
-            for (const auto& paciente : pacientesContainer) {
-                peso += paciente.tamanoArchivo;
+
+        // Aplica un lote de escrituras de forma atomica
+        bool aplicarLote(leveldb::WriteBatch& lote) {
+            if (!connected) return false;
+
+            leveldb::Status status = escribirLote(lote);
+            if (!status.ok()) {
+                registro().contar(Evento::ERROR_LEVELDB);
+                registro().error("leveldb", "Error aplicando lote: " + status.ToString());
+                return false;
             }
-            return peso;
+            return true;
         }
-        
-        // Elimina un paciente por ID
-        bool borrarPaciente(const string& id) {
-            auto& index = pacientesContainer.get<0>();
-            auto it = index.find(id);
-            if (it != index.end()) {
-                index.erase(it);
-                
-                if (leveldb.isConnected()) {
-                    leveldb.eliminarPaciente(id);
-                }
-                return true;
-            }
-            return false;
+
+        // Reconstruye un PacienteData a partir de la clave y el valor almacenados
+        static bool pacienteDesdeValor(const string& id, string_view valor, PacienteData& paciente) {
+            if (EsquemaPaciente::parsear(valor, paciente) != 0) return false;
+            paciente.patientID = id;
+            return true;
         }
-        
-        // Metodo de compatibilidad para borrado por indice secuencial
-        bool borrarPaciente(size_t indice) {
-            auto& index = pacientesContainer.get<4>();
-            if (indice < index.size()) {
-                auto it = index.begin();
-                advance(it, indice);
-                string id = it->patientID;
-                index.erase(it);
-                
-                if (leveldb.isConnected()) {
-                    leveldb.eliminarPaciente(id);
-                }
-                return true;
+
+        // Recorre en orden las entradas con clave en [desde, hasta)
+        // Sin 'desde' empieza al principio y sin 'hasta' llega hasta el final.
+        // Con 'vista' lee la base tal como estaba al abrir esa vista
+        void recorrerRango(const string* desde, const string* hasta,
+                           const function<void(const leveldb::Slice&, const leveldb::Slice&)>& visitar,
+                           const leveldb::Snapshot* vista = nullptr) const {
+            if (!connected) return;
+
+            RecorridoMedido medicion;
+            leveldb::ReadOptions opciones;
+            opciones.fill_cache = false;  // Un escaneo no debe desplazar los bloques calientes
+            opciones.snapshot = vista;
+            leveldb::Iterator* it = db->NewIterator(opciones);
+            if (desde) it->Seek(*desde);
+            else it->SeekToFirst();
+
+            for (; it->Valid(); it->Next()) {
+                if (hasta && it->key().compare(*hasta) >= 0) break;
+                if (esClaveMeta(it->key())) continue;
+                medicion.leer(it);
+                visitar(it->key(), it->value());
             }
-            return false;
+            delete it;
         }
-        
-        // Elimina todos los pacientes del sistema
-        void borrarTodos() {
-            pacientesContainer.clear();
-            if (leveldb.isConnected()) {
-                leveldb.eliminarTodos();
-            }
-            cout << "Todos los registros han sido eliminados." << endl;
+
+        // Vista fija de la base (leveldb::Snapshot): las lecturas hechas con ella no ven
+        // las escrituras posteriores. Se libera con cerrarVista
+        const leveldb::Snapshot* abrirVista() const {
+            return connected ? db->GetSnapshot() : nullptr;
         }
-        
-    private:
-        // Carga inicial desde base de datos 
-        void cargarDesdeBaseDeDatos() {
-            if (!leveldb.isConnected()) return;
-            cout << "LevelDB conectado. " << leveldb.contarPacientes() << " pacientes en la base de datos." << endl;
+
+        void cerrarVista(const leveldb::Snapshot* vista) const {
+            if (vista) db->ReleaseSnapshot(vista);
         }
-};
 
+        // Recorre las entradas de metadatos cuya clave empieza con 'prefijo'
+        void recorrerPrefijo(const string& prefijo,
+                             const function<void(const leveldb::Slice&, const leveldb::Slice&)>& visitar) const {
+            if (!connected) return;
 
-// Clase MenuPrincipal 
-// Gestiona la interfaz de usuario y coordina las operaciones del sistema
-class MenuPrincipal {
-    private:
-        SistemaPacientes sistema;  // Instancia del sistema de pacientes
-        
-        // Muestra resultados de busqueda de forma formateada
-        void mostrarResultadosBusqueda(const vector<DataPaciente>& resultados) const {
-            if (resultados.empty()) {
-                cout << "No se encontraron resultados." << endl;
-            } else {
-                cout << "-----------------------------------------------------------------------" << endl;
-                cout << "   RESULTADOS DE BUSQUEDA (" << resultados.size() << " encontrados)  " << endl;
-                for (size_t i = 0; i < resultados.size(); ++i) {
-                    cout << "-----------------------------------------------------------------------" << endl;
-                    cout << "        Resultado " << i + 1 << endl;
-                    resultados[i].mostrarInfo();
-                }
-                cout << "-----------------------------------------------------------------------" << endl;
+            RecorridoMedido medicion;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            for (it->Seek(prefijo); it->Valid() && it->key().starts_with(prefijo); it->Next()) {
+                medicion.leer(it);
+                visitar(it->key(), it->value());
             }
+            delete it;
+        }
+
+        // Ultima secuencia del registro de cambios
+        uint64_t getSecuenciaCambios() const {
+            return secuenciaCambios.load();
+        }
+
+        // Secuencia hasta la que se recorto el registro; las entradas anteriores ya no estan
+        uint64_t getBaseCambios() const {
+            return leerNumeroMeta(CLAVE_BASE_CAMBIOS);
+        }
+
+        // Activa el registro de cambios (solo hace falta con una instantanea). Sin el, se
+        // borra lo que quedara y se salta una secuencia: los cambios que siguen no se
+        // registran, asi que una instantanea anterior ya no sirve y se descarta al cargarla
+        void configurarRegistroCambios(bool activo) {
+            registroCambios = activo;
+            if (activo || !connected) return;
+            uint64_t secuencia = ++secuenciaCambios;
+            recortarCambios(secuencia);
+            leveldb::WriteBatch lote;
+            lote.Put(CLAVE_ULTIMO_CAMBIO, to_string(secuencia));
+            aplicarLote(lote);
+        }
+
+        // Recorre en orden las entradas del registro posteriores a 'desde'
+        // visitar(secuencia, ids) recibe los IDs separados por '\n' (vacio = se borro todo)
+        void recorrerCambios(uint64_t desde, const function<void(uint64_t, string_view)>& visitar) const {
+            if (!connected) return;
+
+            RecorridoMedido medicion;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            for (it->Seek(claveCambio(desde + 1)); it->Valid() && it->key().starts_with(PREFIJO_CAMBIOS); it->Next()) {
+                medicion.leer(it);
+                uint64_t secuencia = strtoull(it->key().ToString().c_str() + PREFIJO_CAMBIOS.size(), nullptr, 16);
+                visitar(secuencia, string_view(it->value().data(), it->value().size()));
+            }
+            delete it;
+        }
+
+        // Borra las entradas del registro hasta 'hasta' (inclusive) y guarda el recorte
+        void recortarCambios(uint64_t hasta) {
+            if (!connected) return;
+            leveldb::WriteBatch lote;
+            recorrerPrefijo(PREFIJO_CAMBIOS, [&lote, hasta](const leveldb::Slice& clave, const leveldb::Slice&) {
+                if (strtoull(clave.ToString().c_str() + PREFIJO_CAMBIOS.size(), nullptr, 16) <= hasta) lote.Delete(clave);
+            });
+            if (hasta > getBaseCambios()) lote.Put(CLAVE_BASE_CAMBIOS, to_string(hasta));
+            aplicarLote(lote);
+        }
+
+        // Busca un paciente por su ID (clave primaria)
+        string buscarPacientePorID(const string& id) {
+            if (!connected) return "";
+            
+            string value;
+            leveldb::Status status;
+            {
+                TemporizadorOperacion medicion(OperacionMedida::LEVELDB_LECTURA);
+                status = db->Get(leveldb::ReadOptions(), id, &value);
+            }
+            estadisticas().contar(ContadorRendimiento::LEVELDB_GETS);
+            estadisticas().contar(ContadorRendimiento::BYTES_LEIDOS, value.size());
+            
+            if (!status.ok()) {
+                if (!status.IsNotFound()) {
+                    registro().contar(Evento::ERROR_LEVELDB);
+                    registro().error("leveldb", "Error buscando dato: " + status.ToString());
+                }
+                return "";
+            }
+            
+            return value;
+        }
+
+        // Lee varios pacientes por ID con un solo iterador. 'ids' debe venir ordenado
+        // para que cada Seek avance sobre bloques vecinos; visitar(clave, valor) recibe,
+        // en ese orden, solo los que existen
+        void leerPacientes(const vector<string>& ids,
+                           const function<void(const leveldb::Slice&, const leveldb::Slice&)>& visitar) const {
+            if (!connected || ids.empty()) return;
+
+            TemporizadorOperacion medicion(OperacionMedida::LEVELDB_LECTURA);
+            estadisticas().contar(ContadorRendimiento::LEVELDB_GETS, ids.size());
+            uint64_t bytes = 0;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            for (const auto& id : ids) {
+                it->Seek(id);
+                if (!it->Valid() || it->key().compare(id) != 0) continue;
+                bytes += it->value().size();
+                visitar(it->key(), it->value());
+            }
+            delete it;
+            estadisticas().contar(ContadorRendimiento::BYTES_LEIDOS, bytes);
+        }
+
+        // Obtiene todos los pacientes de la base de datos
+        vector<string> buscarTodosLosPacientes() {
+            vector<string> resultados;
+            recorrerRango(nullptr, nullptr, [&resultados](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                PacienteData paciente;
+                if (pacienteDesdeValor(clave.ToString(), string_view(valor.data(), valor.size()), paciente)) {
+                    resultados.push_back(describirPaciente(paciente));
+                }
+            });
+            return resultados;
+        }
+
+        // Recorre los pacientes cuyo campo C contiene 'patron' (ya en minusculas)
+        // De cada entrada solo se extrae el campo buscado; el registro completo se
+        // valida unicamente cuando coincide. visitar(clave, valor) recibe cada uno
+        template <CampoPaciente C, typename Visitar>
+        void recorrerPorCampo(const string& patron, Visitar&& visitar) const {
+            if (!connected) return;
+
+            RecorridoMedido medicion;
+            leveldb::ReadOptions opciones;
+            opciones.fill_cache = false;  // Un escaneo no debe desplazar los bloques calientes
+            leveldb::Iterator* it = db->NewIterator(opciones);
+            PacienteData validacion;
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                if (esClaveMeta(it->key())) continue;
+                medicion.leer(it);
+                string_view valor(it->value().data(), it->value().size());
+                string_view campo;
+                if (!EsquemaPaciente::extraer<C>(valor, campo) || !contieneSinMayusculas(campo, patron)) continue;
+                if (EsquemaPaciente::parsear(valor, validacion) != 0) continue;
+                visitar(it->key(), it->value());
+            }
+            delete it;
         }
-    
-public:
-    // Metodo principal que ejecuta el menu en bucle
-    void ejecutar() {
-        int opcion;
-        srand(time(nullptr));  // Inicializa semilla para numeros aleatorios
         
-        // Muestra advertencia si LevelDB no esta conectado
-        if (!sistema.isDBConnected()) {
-            cout << "-----------------------------------------------------------------------" << endl;
-            cout << "                             ADVERTENCIA" << endl;
-            cout << " No se pudo inicializar LevelDB." << endl;
-            cout << " Asegurate de tener permisos de escritura en el directorio actual." << endl;
-            cout << " Los datos no se guardaran persistentemente." << endl;
-            cout << "-----------------------------------------------------------------------" << endl;
-            cout << "Presione Enter para continuar..." << endl;
-            cin.get();
+        // Busca pacientes por un campo (busqueda parcial case-insensitive)
+        template <CampoPaciente C>
+        vector<string> buscarPacientesPorCampo(const string& valor) {
+            vector<string> resultados;
+            recorrerPorCampo<C>(aMinusculas(valor), [&resultados](const leveldb::Slice& clave, const leveldb::Slice& datos) {
+                PacienteData paciente;
+                pacienteDesdeValor(clave.ToString(), string_view(datos.data(), datos.size()), paciente);
+                resultados.push_back(describirPaciente(paciente));
+            });
+            return resultados;
         }
         
-        // Bucle principal del menu
-        do {
-            mostrarMenu();
-            cout << "Seleccione una opcion: ";
+        // Elimina un paciente por su ID
+        bool eliminarPaciente(const string& id) {
+            if (!connected) return false;
             
-            // Manejo robusto de entrada incorrecta
-            if (!(cin >> opcion)) {
-                cin.clear();
-                cin.ignore(10000, '\n');
-                cout << "Entrada no valida. Por favor ingrese un numero." << endl;
-                continue;
-            }
+            leveldb::WriteBatch lote;
+            lote.Delete(id);
+            leveldb::Status status = escribirLote(lote);
             
-            cin.ignore();  // Limpia el buffer de entrada
+            if (!status.ok()) {
+                if (!status.IsNotFound()) {
+                    registro().contar(Evento::ERROR_LEVELDB);
+                    registro().error("leveldb", "Error eliminando dato: " + status.ToString());
+                }
+                return false;
+            }
             
-            // Ejecuta la opcion seleccionada
-            switch(opcion) {
-                case 1: cargarArchivoCompacto(); break;
-                case 2: sistema.mostrarTodos(); break;
-                case 3: subMenuBusqueda(); break;
-                case 4: subMenuBorrado(); break;
-                case 5: 
-                    if (sistema.isDBConnected()) {
-                        subMenuLevelDB();
-                    } else {
-                        cout << "Error: No hay conexion con Base de datos" << endl;
-                        cout << "\nPresione Enter para continuar...";
-                        cin.get();
+            registro().contar(Evento::ELIMINADO_LEVELDB);
+            if (registro().habilitado(NivelLog::DEPURACION)) {
+                registro().depuracion("eliminado", "Paciente eliminado de LevelDB: " + id);
+            }
+            return true;
+        }
+
+        // Elimina varios pacientes en una sola escritura agrupada (WriteBatch)
+        bool eliminarPacientes(const vector<string>& ids) {
+            leveldb::WriteBatch lote;
+            return eliminarPacientes(ids, lote);
+        }
+
+        // Igual que el anterior, pero los borrados se suman a 'lote', que puede traer
+        // otras escrituras que deben aplicarse en la misma operacion atomica
+        bool eliminarPacientes(const vector<string>& ids, leveldb::WriteBatch& lote) {
+            if (!connected || ids.empty()) return false;
+
+            for (const auto& id : ids) {
+                lote.Delete(id);
+            }
+
+            leveldb::Status status = escribirLote(lote);
+            if (!status.ok()) {
+                registro().contar(Evento::ERROR_LEVELDB);
+                registro().error("leveldb", "Error eliminando lote: " + status.ToString());
+                return false;
+            }
+
+            registro().contar(Evento::ELIMINADO_LEVELDB, ids.size());
+            return true;
+        }
+
+        // Elimina los pacientes que cumplen un criterio recorriendo la base una sola vez
+        // Los borrados se envian en lotes de LOTE_BORRADO claves, por lo que nunca se
+        // mantiene en memoria el conjunto completo de victimas. Al terminar compacta
+        // solo el rango de claves afectado. Devuelve la cantidad de pacientes eliminados
+        // alEliminar, si se indica, recibe cada paciente borrado una vez escrito su lote;
+        // los IDs de los lotes que no se pudieron escribir se agregan a 'fallidos'
+        long eliminarPorCriterio(const CriterioBorrado& criterio,
+                                 const function<void(const PacienteData&)>& alEliminar = nullptr,
+                                 vector<string>* fallidos = nullptr) {
+            if (!connected || criterio.vacio()) return 0;
+
+            const size_t LOTE_BORRADO = 10000;
+            RecorridoMedido medicion;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            leveldb::WriteBatch lote;
+            vector<PacienteData> victimas;   // Pacientes del lote en curso
+            long eliminados = 0;
+            string primeraClave, ultimaClave;
+
+            // Escribe el lote y solo entonces da por borrados a sus pacientes
+            auto escribir = [&]() {
+                leveldb::Status status = escribirLote(lote);
+                if (status.ok()) {
+                    eliminados += victimas.size();
+                    if (alEliminar) {
+                        for (const auto& paciente : victimas) alEliminar(paciente);
                     }
-                    break;
-                case 6: 
-                    if (sistema.isDBConnected()) {
-                        sistema.sincronizarConBaseDeDatos();
-                    } else {
-                        cout << "Error: No hay conexion con Base de datos" << endl;
+                } else {
+                    registro().contar(Evento::ERROR_LEVELDB);
+                    registro().error("leveldb", "Error eliminando lote: " + status.ToString());
+                    if (fallidos) {
+                        for (const auto& paciente : victimas) fallidos->push_back(paciente.patientID);
                     }
-                    break;
-                case 7: cout << "Saliendo del programa..." << endl; break;
-                default: cout << "Opcion no valida. Intente nuevamente." << endl; break;
+                }
+                lote.Clear();
+                victimas.clear();
+            };
+
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                if (esClaveMeta(it->key())) continue;
+                medicion.leer(it);
+                PacienteData paciente;
+                string_view valor(it->value().data(), it->value().size());
+                if (!pacienteDesdeValor(it->key().ToString(), valor, paciente)) continue;
+                if (!criterio.cumple(paciente.modality, paciente.studyDate, paciente.tamanoArchivo)) continue;
+
+                // Las claves se recorren en orden, la primera y la ultima delimitan el rango
+                const string& clave = paciente.patientID;
+                if (primeraClave.empty()) primeraClave = clave;
+                ultimaClave = clave;
+
+                lote.Delete(clave);
+                victimas.push_back(move(paciente));
+                if (victimas.size() >= LOTE_BORRADO) escribir();
+            }
+            delete it;
+            if (!victimas.empty()) escribir();
+
+            // Compacta solo el rango que contiene las claves borradas
+            if (eliminados > 0) {
+                leveldb::Slice inicio(primeraClave);
+                leveldb::Slice fin(ultimaClave);
+                db->CompactRange(&inicio, &fin);
             }
+
+            registro().contar(Evento::ELIMINADO_LEVELDB, eliminados);
+            return eliminados;
+        }
+
+        // Elimina todos los pacientes de la base de datos (y con ellos los metadatos)
+        // Devuelve false si algo no se pudo borrar; los IDs de pacientes que siguen
+        // guardados se agregan a 'fallidos'
+        bool eliminarTodos(vector<string>* fallidos = nullptr) {
+            if (!connected) return false;
+            bool correcto = true;
             
-            // Pausa antes de continuar (excepto al salir)
-            if (opcion != 7) {
-                cout << "\nPresione Enter para continuar...";
-                cin.get();
+            RecorridoMedido medicion;
+            leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+            leveldb::WriteOptions write_options;
+            
+            // Recorre y elimina todas las entradas
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                medicion.leer(it);
+                leveldb::Status status = db->Delete(write_options, it->key());
+                estadisticas().contar(ContadorRendimiento::LEVELDB_ESCRITURAS);
+                estadisticas().contar(ContadorRendimiento::BYTES_ESCRITOS, it->key().size());
+                if (!status.ok()) {
+                    registro().contar(Evento::ERROR_LEVELDB);
+                    registro().error("leveldb", "Error eliminando clave: " + status.ToString());
+                    correcto = false;
+                    if (fallidos && !esClaveMeta(it->key())) fallidos->push_back(it->key().ToString());
+                } else if (!esClaveMeta(it->key())) {
+                    registro().contar(Evento::ELIMINADO_LEVELDB);
+                }
             }
             
-        } while (opcion != 7);
+            delete it;
+
+            // Marca en el registro que se borro todo: una instantanea anterior queda vacia.
+            // Sin registro se conserva la secuencia (y el recorte) para seguir descartando
+            // las instantaneas anteriores
+            uint64_t secuencia = registroCambios ? ++secuenciaCambios : secuenciaCambios.load();
+            leveldb::WriteBatch lote;
+            if (registroCambios) lote.Put(claveCambio(secuencia), "");
+            else lote.Put(CLAVE_BASE_CAMBIOS, to_string(secuencia));
+            lote.Put(CLAVE_ULTIMO_CAMBIO, to_string(secuencia));
+            leveldb::Status status = db->Write(write_options, &lote);
+            estadisticas().contar(ContadorRendimiento::LEVELDB_ESCRITURAS);
+            if (!status.ok()) {
+                registro().contar(Evento::ERROR_LEVELDB);
+                registro().error("leveldb", "Error registrando el borrado: " + status.ToString());
+                correcto = false;
+            }
+            registro().info("leveldb", "Eliminacion completada de LevelDB");
+            return correcto;
+        }
+};
+
+const string LevelDBManager::PREFIJO_CAMBIOS = "#cambio:";
+const string LevelDBManager::CLAVE_BASE_CAMBIOS = "#cambio-base";
+const string LevelDBManager::CLAVE_ULTIMO_CAMBIO = "#cambio-ultimo";
+
+
+// Acumulado de tamanoArchivo de un grupo de pacientes
+// Borrar el minimo o el maximo no se puede corregir en O(1): los extremos quedan
+// marcados como aproximados hasta el proximo recalculo desde LevelDB
+struct CeldaAgregado {
+    uint64_t cantidad = 0;
+    long long suma = 0;
+    long long minimo = LLONG_MAX;
+    long long maximo = LLONG_MIN;
+    bool extremosExactos = true;
+
+    void sumar(long long tamano) {
+        cantidad++;
+        suma += tamano;
+        minimo = min(minimo, tamano);
+        maximo = max(maximo, tamano);
     }
-    
-private:
-    // Muestra el menu principal con estadisticas del sistema
-    void mostrarMenu() const {
-        // Limpia la pantalla (compatible Windows/Linux)
-        #ifdef _WIN32
-            system("cls");
-        #else
-            system("clear");
-        #endif
-        
-        cout << "\n---------------------------------------------------------------------------------" << endl;
-        cout << "                   SISTEMA DE PACIENTES" << endl;
-        cout << "---------------------------------------------------------------------------------" << endl;
-        cout << " 1. Cargar archivo de pacientes" << endl;
-        cout << " 2. Mostrar todos los pacientes registrados" << endl;
-        cout << " 3. Buscar pacientes (Boost Multi-Index)" << endl;
-        cout << " 4. Borrar registro" << endl;
-        cout << " 5. Buscar en LevelDB" << endl;
-        cout << " 6. Sincronizar con LevelDB" << endl;
-        cout << " 7. Salir" << endl;
-        cout << "---------------------------------------------------------------------------------" << endl;
-        // Muestra estadisticas en tiempo real
-        cout << " Pacientes en memoria: " << sistema.getCantidadPacientes() << endl;
-        cout << " Pacientes en Base de datos: " << sistema.getCantidadLevelDB() << endl;
-        cout << " Espacio en memoria utilizado: " << (sistema.pesoEnMemoria() / 1024.0 / 1024.0) << " MB" << endl;
-        if (!sistema.isDBConnected()) {
-            cout << " Estado BD: DESCONECTADO" << endl;
-        } else {
-            cout << " Estado BD: CONECTADO" << endl;
+
+    void restar(long long tamano) {
+        if (cantidad <= 1) {
+            *this = CeldaAgregado();  // Sin pacientes los extremos vuelven a ser exactos
+            return;
         }
-        cout << "---------------------------------------------------------------------------------" << endl;
+        cantidad--;
+        suma -= tamano;
+        if (tamano <= minimo || tamano >= maximo) extremosExactos = false;
     }
-    
-    // Permite al usuario cargar un archivo personalizado
-    void cargarArchivoCompacto() {
-        string nombreArchivo;
-        cout << "Ingrese el nombre del archivo(ej: pacientes.txt): ";
-        getline(cin, nombreArchivo);
-        
-        // Limpia espacios en blanco
-        if (!nombreArchivo.empty()) {
-            nombreArchivo.erase(nombreArchivo.find_last_not_of(" \n\r\t") + 1);
+
+    // Acumula otra celda (al agrupar varias celdas en una fila del reporte)
+    void combinar(const CeldaAgregado& otra) {
+        if (otra.cantidad == 0) return;
+        cantidad += otra.cantidad;
+        suma += otra.suma;
+        minimo = min(minimo, otra.minimo);
+        maximo = max(maximo, otra.maximo);
+        extremosExactos = extremosExactos && otra.extremosExactos;
+    }
+
+    double promedio() const {
+        return cantidad ? (double) suma / cantidad : 0.0;
+    }
+};
+
+// Dimensiones por las que se agrupa un reporte de agregados
+struct AgrupacionAgregados {
+    bool modalidad = false;
+    bool sexo = false;
+    bool mes = false;
+};
+
+// Interpreta una lista de dimensiones separadas por coma: modalidad,sexo,mes
+// Una lista vacia (o "total") agrupa todo en una sola fila
+bool parsearAgrupacion(const string& texto, AgrupacionAgregados& agrupacion) {
+    agrupacion = AgrupacionAgregados();
+    size_t inicio = 0;
+    while (inicio <= texto.size()) {
+        size_t fin = texto.find(',', inicio);
+        if (fin == string::npos) fin = texto.size();
+        string dimension = aMinusculas(texto.substr(inicio, fin - inicio));
+        if (dimension == "modalidad") agrupacion.modalidad = true;
+        else if (dimension == "sexo") agrupacion.sexo = true;
+        else if (dimension == "mes") agrupacion.mes = true;
+        else if (!dimension.empty() && dimension != "total") return false;
+        inicio = fin + 1;
+    }
+    return true;
+}
+
+// Fila de un reporte; las dimensiones que no se agrupan valen "*"
+struct FilaAgregado {
+    string modalidad;
+    string sexo;
+    string mes;  // AAAAMM
+    CeldaAgregado total;
+};
+
+
+// Clase TablaAgregados
+// Cantidad, suma, minimo y maximo de tamanoArchivo por (modalidad, sexo, mes del estudio)
+// para los pacientes guardados en LevelDB. Cada alta o baja toca una sola celda y un
+// reporte agrupado combina celdas, sin recorrer pacientes. Las celdas modificadas se
+// persisten como claves "#agg:modalidad|sexo|AAAAMM" para sobrevivir a un reinicio.
+class TablaAgregados {
+    private:
+        typedef tuple<string, string, string> ClaveCelda;  // Modalidad, sexo y mes
+
+        map<ClaveCelda, CeldaAgregado> celdas;
+        set<ClaveCelda> pendientes;   // Celdas modificadas que aun no se escribieron
+        mutable mutex mutexCeldas;    // Las altas llegan desde varios hilos
+
+        static ClaveCelda claveDe(const PacienteData& paciente) {
+            return ClaveCelda(paciente.modality, paciente.sex, paciente.studyDate.substr(0, 6));
         }
-        
-        if (nombreArchivo.empty()) {
-            cout << "Nombre de archivo no valido." << endl;
-            return;
+
+        static string claveBaseDatos(const ClaveCelda& clave) {
+            return PREFIJO + get<0>(clave) + "|" + get<1>(clave) + "|" + get<2>(clave);
+        }
+
+        // Valor persistido: cantidad|suma|minimo|maximo|extremosExactos
+        static string serializarCelda(const CeldaAgregado& celda) {
+            return to_string(celda.cantidad) + "|" + to_string(celda.suma) + "|" +
+                   to_string(celda.minimo) + "|" + to_string(celda.maximo) + "|" +
+                   (celda.extremosExactos ? "1" : "0");
+        }
+
+        // Suma o resta un paciente; el llamador tiene mutexCeldas
+        void aplicarSinBloqueo(const PacienteData& paciente, bool alta) {
+            ClaveCelda clave = claveDe(paciente);
+            if (alta) {
+                celdas[clave].sumar(paciente.tamanoArchivo);
+            } else {
+                auto it = celdas.find(clave);
+                if (it == celdas.end()) return;
+                it->second.restar(paciente.tamanoArchivo);
+            }
+            pendientes.insert(clave);
+        }
+
+    public:
+        static const string PREFIJO;
+        static const string CLAVE_CIERRE;   // Solo existe si la ultima sesion cerro en orden
+
+        // Alta de un paciente en LevelDB
+        void sumar(const PacienteData& paciente) {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            aplicarSinBloqueo(paciente, true);
+        }
+
+        // Baja de un paciente de LevelDB
+        void restar(const PacienteData& paciente) {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            aplicarSinBloqueo(paciente, false);
+        }
+
+        // Un paciente modificado solo mueve su tamano si cambio de celda o de tamano
+        void reemplazar(const PacienteData& anterior, const PacienteData& nuevo) {
+            if (claveDe(anterior) == claveDe(nuevo) && anterior.tamanoArchivo == nuevo.tamanoArchivo) return;
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            aplicarSinBloqueo(anterior, false);
+            aplicarSinBloqueo(nuevo, true);
+        }
+
+        // Agrega al lote las celdas modificadas; las que quedaron vacias se borran
+        void volcarPendientes(leveldb::WriteBatch& lote) {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            volcarSinBloqueo(lote);
+        }
+
+        // Agrega las celdas modificadas al lote y lo escribe con 'escribir' sin soltar el
+        // mutex: los lotes con celdas llegan a LevelDB en el orden en que se tomaron sus
+        // valores, asi un valor anterior nunca pisa a uno posterior
+        bool escribirConPendientes(leveldb::WriteBatch& lote, const function<bool(leveldb::WriteBatch&)>& escribir) {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            volcarSinBloqueo(lote);
+            return escribir(lote);
+        }
+
+    private:
+        // Vuelca las celdas pendientes; el llamador tiene mutexCeldas
+        void volcarSinBloqueo(leveldb::WriteBatch& lote) {
+            for (const auto& clave : pendientes) {
+                auto it = celdas.find(clave);
+                if (it == celdas.end()) continue;
+                if (it->second.cantidad == 0) {
+                    lote.Delete(claveBaseDatos(clave));
+                    celdas.erase(it);
+                } else {
+                    lote.Put(claveBaseDatos(clave), serializarCelda(it->second));
+                }
+            }
+            pendientes.clear();
+        }
+
+    public:
+
+        bool hayPendientes() const {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            return !pendientes.empty();
+        }
+
+        // Carga una celda persistida; devuelve false si la clave o el valor no son validos
+        bool cargarCelda(const string& clave, const string& valor) {
+            if (clave.compare(0, PREFIJO.size(), PREFIJO) != 0) return false;
+            size_t primero = clave.find('|', PREFIJO.size());
+            size_t segundo = primero == string::npos ? string::npos : clave.find('|', primero + 1);
+            if (segundo == string::npos) return false;
+
+            vector<string> campos;
+            size_t inicio = 0;
+            size_t fin = valor.find('|');
+            while (fin != string::npos) {
+                campos.push_back(valor.substr(inicio, fin - inicio));
+                inicio = fin + 1;
+                fin = valor.find('|', inicio);
+            }
+            campos.push_back(valor.substr(inicio));
+            if (campos.size() < 5) return false;
+
+            CeldaAgregado celda;
+            try {
+                celda.cantidad = stoull(campos[0]);
+                celda.suma = stoll(campos[1]);
+                celda.minimo = stoll(campos[2]);
+                celda.maximo = stoll(campos[3]);
+            } catch (...) {
+                return false;
+            }
+            celda.extremosExactos = campos[4] == "1";
+
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            celdas[ClaveCelda(clave.substr(PREFIJO.size(), primero - PREFIJO.size()),
+                              clave.substr(primero + 1, segundo - primero - 1),
+                              clave.substr(segundo + 1))] = celda;
+            return true;
+        }
+
+        // Descarta todas las celdas (la base quedo vacia o se va a recalcular)
+        void limpiar() {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            celdas.clear();
+            pendientes.clear();
+        }
+
+        // Pacientes contados en todas las celdas
+        uint64_t totalPacientes() const {
+            lock_guard<mutex> bloqueo(mutexCeldas);
+            uint64_t total = 0;
+            for (const auto& entrada : celdas) total += entrada.second.cantidad;
+            return total;
+        }
+
+        // Combina las celdas segun las dimensiones pedidas; el costo depende de la
+        // cantidad de celdas (modalidades x sexos x meses), no de la de pacientes
+        vector<FilaAgregado> agrupar(const AgrupacionAgregados& agrupacion) const {
+            map<ClaveCelda, CeldaAgregado> grupos;
+            {
+                lock_guard<mutex> bloqueo(mutexCeldas);
+                for (const auto& entrada : celdas) {
+                    if (entrada.second.cantidad == 0) continue;
+                    ClaveCelda grupo(agrupacion.modalidad ? get<0>(entrada.first) : "*",
+                                     agrupacion.sexo ? get<1>(entrada.first) : "*",
+                                     agrupacion.mes ? get<2>(entrada.first) : "*");
+                    grupos[grupo].combinar(entrada.second);
+                }
+            }
+
+            vector<FilaAgregado> filas;
+            filas.reserve(grupos.size());
+            for (const auto& grupo : grupos) {
+                filas.push_back({get<0>(grupo.first), get<1>(grupo.first), get<2>(grupo.first), grupo.second});
+            }
+            return filas;
+        }
+};
+
+const string TablaAgregados::PREFIJO = "#agg:";
+const string TablaAgregados::CLAVE_CIERRE = "#agg-cierre";
+
+// Escribe un reporte de agregados como tabla; '~' marca extremos aproximados
+void mostrarReporteAgregados(const vector<FilaAgregado>& filas, ostream& destino) {
+    if (filas.empty()) {
+        destino << "No hay pacientes en las tablas de agregados." << endl;
+        return;
+    }
+
+    char linea[256];
+    string salida;
+    auto agregarFila = [&](const string& modalidad, const string& sexo, const string& mes,
+                           const CeldaAgregado& celda) {
+        string marca = celda.extremosExactos ? "" : "~";
+        snprintf(linea, sizeof(linea), "%-10s %-10s %-7s %10llu %18lld %14.0f %14s %14s\n",
+                 modalidad.c_str(), sexo.c_str(), mes.c_str(), (unsigned long long) celda.cantidad,
+                 celda.suma, celda.promedio(), (marca + to_string(celda.minimo)).c_str(),
+                 (marca + to_string(celda.maximo)).c_str());
+        salida += linea;
+    };
+
+    snprintf(linea, sizeof(linea), "%-10s %-10s %-7s %10s %18s %14s %14s %14s\n", "Modalidad", "Sexo", "Mes",
+             "Cantidad", "Suma (bytes)", "Promedio", "Minimo", "Maximo");
+    salida += linea;
+    CeldaAgregado total;
+    for (const auto& fila : filas) {
+        agregarFila(fila.modalidad, fila.sexo, fila.mes, fila.total);
+        total.combinar(fila.total);
+    }
+    if (filas.size() > 1) agregarFila("Total", "", "", total);
+    destino << salida;
+    if (!total.extremosExactos) {
+        destino << "~ Extremos aproximados por borrados; recalcule los agregados para corregirlos." << endl;
+    }
+}
+
+
+// Resultado de comparar la memoria con LevelDB
+struct ResultadoReconciliacion {
+    size_t rangosRecalculados = 0;  // Hojas de LevelDB reescaneadas por estar sucias
+    size_t rangosDistintos = 0;     // Hojas con hashes distintos
+    vector<string> soloMemoria;     // IDs presentes solo en memoria
+    vector<string> soloBaseDatos;   // IDs presentes solo en LevelDB
+    vector<string> distintos;       // IDs con datos diferentes
+
+    bool sincronizado() const {
+        return soloMemoria.empty() && soloBaseDatos.empty() && distintos.empty();
+    }
+};
+
+
+// Clase CerrojoMedido
+// Cerrojo de lectores/escritor que mide la contencion: cuenta cuantas adquisiciones
+// tuvieron que esperar y el tiempo total de espera. Cumple la interfaz SharedMutex,
+// por lo que se usa con shared_lock y unique_lock.
+class CerrojoMedido {
+    private:
+        shared_mutex mutex;                       // Cerrojo real
+        atomic<uint64_t> lecturas{0};             // Adquisiciones compartidas
+        atomic<uint64_t> lecturasConEspera{0};    // Compartidas que encontraron un escritor
+        atomic<uint64_t> escrituras{0};           // Adquisiciones exclusivas
+        atomic<uint64_t> escriturasConEspera{0};  // Exclusivas que encontraron el cerrojo tomado
+        atomic<uint64_t> nanosEspera{0};          // Tiempo total esperando (lectores y escritores)
+
+        // Acumula el tiempo transcurrido desde 'inicio'
+        void sumarEspera(chrono::steady_clock::time_point inicio) {
+            nanosEspera += chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - inicio).count();
+        }
+
+    public:
+        // Primero intenta sin bloquear; solo si falla mide la espera
+        void lock_shared() {
+            lecturas.fetch_add(1, memory_order_relaxed);
+            if (mutex.try_lock_shared()) return;
+            lecturasConEspera.fetch_add(1, memory_order_relaxed);
+            auto inicio = chrono::steady_clock::now();
+            mutex.lock_shared();
+            sumarEspera(inicio);
+        }
+
+        void unlock_shared() { mutex.unlock_shared(); }
+
+        void lock() {
+            escrituras.fetch_add(1, memory_order_relaxed);
+            if (mutex.try_lock()) return;
+            escriturasConEspera.fetch_add(1, memory_order_relaxed);
+            auto inicio = chrono::steady_clock::now();
+            mutex.lock();
+            sumarEspera(inicio);
+        }
+
+        void unlock() { mutex.unlock(); }
+
+        // Muestra las estadisticas de contencion acumuladas
+        void mostrarEstadisticas() const {
+            uint64_t l = lecturas.load(), le = lecturasConEspera.load();
+            uint64_t e = escrituras.load(), ee = escriturasConEspera.load();
+            cout << "Cerrojo de datos:" << endl;
+            cout << "- Lecturas: " << l << " (con espera: " << le << ", "
+                 << (l ? 100.0 * le / l : 0.0) << "%)" << endl;
+            cout << "- Escrituras: " << e << " (con espera: " << ee << ", "
+                 << (e ? 100.0 * ee / e : 0.0) << "%)" << endl;
+            cout << "- Tiempo total de espera: " << nanosEspera.load() / 1e6 << " ms" << endl;
+        }
+
+        // Reinicia los contadores (por ejemplo entre corridas de un benchmark)
+        void reiniciarEstadisticas() {
+            lecturas = 0;
+            lecturasConEspera = 0;
+            escrituras = 0;
+            escriturasConEspera = 0;
+            nanosEspera = 0;
+        }
+};
+
+typedef shared_lock<CerrojoMedido> BloqueoLectura;    // Lectores concurrentes
+typedef unique_lock<CerrojoMedido> BloqueoEscritura;  // Escritor exclusivo
+
+
+// Clase PoolHilos
+// Conjunto fijo de hilos que ejecutan tareas de una cola compartida.
+// encolar() devuelve un future con el resultado de la tarea
+class PoolHilos {
+    private:
+        vector<thread> hilos;               // Hilos trabajadores
+        queue<function<void()>> tareas;     // Tareas pendientes
+        mutex mutexTareas;                  // Protege la cola y la bandera de detencion
+        condition_variable hayTareas;       // Despierta a los hilos cuando llega una tarea
+        bool detenido;                      // El destructor pidio terminar
+
+        // Bucle de cada hilo: toma tareas hasta que el pool se detiene y la cola queda vacia
+        void trabajar() {
+            while (true) {
+                function<void()> tarea;
+                {
+                    unique_lock<mutex> bloqueo(mutexTareas);
+                    hayTareas.wait(bloqueo, [this] { return detenido || !tareas.empty(); });
+                    if (detenido && tareas.empty()) return;
+                    tarea = move(tareas.front());
+                    tareas.pop();
+                }
+                tarea();
+            }
+        }
+
+    public:
+        explicit PoolHilos(size_t numHilos) : detenido(false) {
+            numHilos = max<size_t>(numHilos, 1);
+            for (size_t i = 0; i < numHilos; ++i) {
+                hilos.emplace_back(&PoolHilos::trabajar, this);
+            }
+        }
+
+        // Termina las tareas pendientes y espera a todos los hilos
+        ~PoolHilos() {
+            {
+                lock_guard<mutex> bloqueo(mutexTareas);
+                detenido = true;
+            }
+            hayTareas.notify_all();
+            for (auto& hilo : hilos) hilo.join();
+        }
+
+        PoolHilos(const PoolHilos&) = delete;
+        PoolHilos& operator=(const PoolHilos&) = delete;
+
+        // Agrega una tarea a la cola; el future entrega su resultado (o su excepcion)
+        template <typename Tarea>
+        auto encolar(Tarea tarea) -> future<decltype(tarea())> {
+            typedef decltype(tarea()) Resultado;
+            auto paquete = make_shared<packaged_task<Resultado()>>(move(tarea));
+            future<Resultado> resultado = paquete->get_future();
+            {
+                lock_guard<mutex> bloqueo(mutexTareas);
+                tareas.push([paquete]() { (*paquete)(); });
+            }
+            hayTareas.notify_one();
+            return resultado;
+        }
+
+        size_t getNumHilos() const { return hilos.size(); }
+};
+
+
+// Clase SketchKLL
+// Resumen de cuantiles KLL en espacio O(k log n). Los valores se guardan en niveles:
+// cada valor del nivel h representa 2^h valores originales. Cuando un nivel se llena
+// se ordena y pasa al siguiente uno de cada dos elementos, empezando por el primero
+// o el segundo segun un bit pseudoaleatorio. El error de rango es del orden de 1/k.
+// Dos sketches se combinan uniendo nivel a nivel y volviendo a compactar, asi que
+// los fragmentos o hilos pueden resumir por separado y mezclar al consultar.
+class SketchKLL {
+    private:
+        size_t k;                          // Capacidad del nivel superior
+        vector<vector<long long>> niveles; // niveles[h]: valores con peso 2^h
+        size_t guardados;                  // Valores guardados entre todos los niveles
+        size_t capacidadTotal;             // Al alcanzarla se compacta
+        uint64_t cantidad;                 // Valores originales vistos
+        long long minimo;                  // Extremos exactos
+        long long maximo;
+        uint64_t estado;                   // Generador xorshift de los bits de compactacion
+
+        // Los niveles bajos tienen menos capacidad: k * (2/3)^(distancia al nivel superior)
+        size_t capacidad(size_t nivel) const {
+            double c = (double) k;
+            for (size_t h = nivel + 1; h < niveles.size(); ++h) c *= 2.0 / 3.0;
+            return (size_t) c + 2;
+        }
+
+        void agregarNivel() {
+            niveles.emplace_back();
+            capacidadTotal = 0;
+            for (size_t h = 0; h < niveles.size(); ++h) capacidadTotal += capacidad(h);
+        }
+
+        bool bitAleatorio() {
+            estado ^= estado << 13;
+            estado ^= estado >> 7;
+            estado ^= estado << 17;
+            return estado & 1;
+        }
+
+        // Compacta el primer nivel lleno hasta volver por debajo de la capacidad total
+        void compactar() {
+            for (size_t h = 0; h < niveles.size() && guardados >= capacidadTotal; ++h) {
+                if (niveles[h].size() < capacidad(h)) continue;
+                if (h + 1 == niveles.size()) agregarNivel();
+
+                vector<long long>& nivel = niveles[h];
+                sort(nivel.begin(), nivel.end());
+                // Con cantidad impar el ultimo valor se queda en el nivel
+                size_t pares = nivel.size() / 2 * 2;
+                for (size_t i = bitAleatorio() ? 1 : 0; i < pares; i += 2) {
+                    niveles[h + 1].push_back(nivel[i]);
+                }
+                long long resto = nivel.back();
+                bool impar = nivel.size() % 2 == 1;
+                guardados -= pares / 2;
+                nivel.clear();
+                if (impar) nivel.push_back(resto);
+            }
+        }
+
+    public:
+        explicit SketchKLL(size_t capacidadSuperior = 200)
+            : k(max<size_t>(capacidadSuperior, 8)), guardados(0), capacidadTotal(0), cantidad(0),
+              minimo(LLONG_MAX), maximo(LLONG_MIN), estado(0x9E3779B97F4A7C15ULL) {
+            agregarNivel();
+        }
+
+        void agregar(long long valor) {
+            niveles[0].push_back(valor);
+            guardados++;
+            cantidad++;
+            minimo = min(minimo, valor);
+            maximo = max(maximo, valor);
+            while (guardados >= capacidadTotal) compactar();
+        }
+
+        // Suma los valores de otro sketch
+        void combinar(const SketchKLL& otro) {
+            if (otro.cantidad == 0) return;
+            while (niveles.size() < otro.niveles.size()) agregarNivel();
+            for (size_t h = 0; h < otro.niveles.size(); ++h) {
+                niveles[h].insert(niveles[h].end(), otro.niveles[h].begin(), otro.niveles[h].end());
+                guardados += otro.niveles[h].size();
+            }
+            cantidad += otro.cantidad;
+            minimo = min(minimo, otro.minimo);
+            maximo = max(maximo, otro.maximo);
+            estado ^= otro.estado;
+            if (estado == 0) estado = 0x9E3779B97F4A7C15ULL;
+            while (guardados >= capacidadTotal) compactar();
+        }
+
+        uint64_t getCantidad() const { return cantidad; }
+
+        // Valores aproximados para cada cuantil pedido (0.0 a 1.0), en el mismo orden
+        // Los extremos 0 y 1 devuelven el minimo y el maximo exactos
+        vector<long long> cuantiles(const vector<double>& pedidos) const {
+            vector<long long> valores;
+            if (cantidad == 0) return valores;
+
+            vector<pair<long long, uint64_t>> ponderados;  // (valor, peso)
+            ponderados.reserve(guardados);
+            uint64_t pesoTotal = 0;
+            for (size_t h = 0; h < niveles.size(); ++h) {
+                for (long long valor : niveles[h]) ponderados.emplace_back(valor, 1ULL << h);
+                pesoTotal += niveles[h].size() << h;
+            }
+            sort(ponderados.begin(), ponderados.end());
+
+            for (double q : pedidos) {
+                if (q <= 0.0) { valores.push_back(minimo); continue; }
+                if (q >= 1.0) { valores.push_back(maximo); continue; }
+                uint64_t objetivo = (uint64_t) ceil(q * pesoTotal);
+                uint64_t acumulado = 0;
+                long long valor = ponderados.back().first;
+                for (const auto& par : ponderados) {
+                    acumulado += par.second;
+                    if (acumulado >= objetivo) {
+                        valor = par.first;
+                        break;
+                    }
+                }
+                valores.push_back(valor);
+            }
+            return valores;
+        }
+};
+
+
+// Clase DistribucionTamanos
+// Un SketchKLL de tamanoArchivo por modalidad. No tiene cerrojo propio: la protege
+// el cerrojo del contenedor (o del fragmento) al que acompana
+class DistribucionTamanos {
+    private:
+        map<string, SketchKLL> porModalidad;
+
+    public:
+        void agregar(const PacienteData& paciente) {
+            porModalidad[paciente.modality].agregar(paciente.tamanoArchivo);
+        }
+
+        // Suma otra distribucion (por ejemplo la de otro fragmento)
+        void combinar(const DistribucionTamanos& otra) {
+            for (const auto& entrada : otra.porModalidad) {
+                porModalidad[entrada.first].combinar(entrada.second);
+            }
+        }
+
+        // Vuelve a resumir los pacientes de un contenedor (descarta los borrados)
+        void reconstruir(const PacienteContainer& pacientes) {
+            porModalidad.clear();
+            for (const auto& paciente : pacientes) agregar(paciente);
+        }
+
+        void limpiar() { porModalidad.clear(); }
+
+        vector<string> modalidades() const {
+            vector<string> nombres;
+            for (const auto& entrada : porModalidad) nombres.push_back(entrada.first);
+            return nombres;
+        }
+
+        // Cantidad resumida de una modalidad; "" o "*" suma todas
+        uint64_t cantidad(const string& modalidad) const {
+            uint64_t total = 0;
+            for (const auto& entrada : porModalidad) {
+                if (modalidad.empty() || modalidad == "*" || entrada.first == modalidad) {
+                    total += entrada.second.getCantidad();
+                }
+            }
+            return total;
+        }
+
+        // Percentiles (0 a 100) de una modalidad; "" o "*" combina todas
+        // Devuelve un vector vacio si no hay datos
+        vector<long long> percentiles(const string& modalidad, const vector<double>& pedidos) const {
+            vector<double> cuantiles;
+            for (double p : pedidos) cuantiles.push_back(p / 100.0);
+
+            if (!modalidad.empty() && modalidad != "*") {
+                auto it = porModalidad.find(modalidad);
+                if (it == porModalidad.end()) return vector<long long>();
+                return it->second.cuantiles(cuantiles);
+            }
+            SketchKLL todas;
+            for (const auto& entrada : porModalidad) todas.combinar(entrada.second);
+            return todas.cuantiles(cuantiles);
+        }
+};
+
+// Escribe p50/p95/p99 y maximo de tamanoArchivo por modalidad como tabla
+void mostrarPercentilesTamano(const DistribucionTamanos& distribucion, ostream& destino) {
+    vector<string> modalidades = distribucion.modalidades();
+    if (modalidades.empty()) {
+        destino << "No hay pacientes en memoria." << endl;
+        return;
+    }
+
+    const vector<double> pedidos = {50, 95, 99, 100};
+    char linea[192];
+    string salida;
+    snprintf(linea, sizeof(linea), "%-10s %10s %14s %14s %14s %14s\n",
+             "Modalidad", "Cantidad", "p50", "p95", "p99", "Maximo");
+    salida += linea;
+    modalidades.push_back("*");
+    for (const auto& modalidad : modalidades) {
+        vector<long long> valores = distribucion.percentiles(modalidad, pedidos);
+        if (valores.size() < pedidos.size()) continue;
+        snprintf(linea, sizeof(linea), "%-10s %10llu %14lld %14lld %14lld %14lld\n",
+                 modalidad == "*" ? "Todas" : modalidad.c_str(),
+                 (unsigned long long) distribucion.cantidad(modalidad),
+                 valores[0], valores[1], valores[2], valores[3]);
+        salida += linea;
+    }
+    destino << salida;
+}
+
+
+// Memoria que ocupa una cadena fuera del objeto string
+// Las cortas caben en el propio objeto (SSO) y no piden memoria aparte. En Linux se
+// pregunta a malloc el tamano real del bloque, con su redondeo y su cabecera
+size_t bytesFueraDeLinea(const string& cadena) {
+    static const size_t CAPACIDAD_SSO = string().capacity();
+    if (cadena.capacity() <= CAPACIDAD_SSO) return 0;
+#ifdef LINUX
+    return malloc_usable_size((void*) cadena.data()) + sizeof(size_t);
+#else
+    return cadena.capacity() + 1;
+#endif
+}
+
+// Memoria fuera de linea de un campo de texto
+struct UsoCampo {
+    uint64_t bytes = 0;
+    uint64_t cadenas = 0;  // Cadenas que no entraron en el objeto string
+};
+
+// Memoria real de los pacientes en memoria y de LevelDB
+struct UsoMemoria {
+    static const size_t CAMPOS = 5;  // patientID, patientName, studyDate, modality, sex
+
+    size_t pacientes = 0;
+    array<UsoCampo, CAMPOS> campos;
+    int64_t nodos = 0;          // Ver ContabilidadMemoria
+    int64_t bytesNodos = 0;
+    int64_t bytesArreglos = 0;
+    size_t tamanoNodo = 0;
+    uint64_t cacheBloques = 0;  // LevelDB
+    uint64_t capacidadCache = 0;
+    uint64_t memtables = 0;
+    uint64_t cacheRegistros = 0;      // Modo acotado: registros en la cache LRU
+    uint64_t capacidadRegistros = 0;
+    uint64_t indicesCompactos = 0;    // Modo acotado: tabla de IDs y columnas codificadas
+
+    // Recorre un contenedor sumando la memoria fuera de linea de cada campo
+    void sumarCadenas(const PacienteContainer& contenedor) {
+        for (const auto& paciente : contenedor) {
+            const string* texto[CAMPOS] = {
+                &paciente.patientID, &paciente.patientName, &paciente.studyDate,
+                &paciente.modality, &paciente.sex
+            };
+            for (size_t i = 0; i < CAMPOS; ++i) {
+                size_t bytes = bytesFueraDeLinea(*texto[i]);
+                campos[i].bytes += bytes;
+                campos[i].cadenas += bytes > 0;
+            }
+        }
+        pacientes += contenedor.size();
+    }
+
+    void combinarCadenas(const UsoMemoria& otro) {
+        for (size_t i = 0; i < CAMPOS; ++i) {
+            campos[i].bytes += otro.campos[i].bytes;
+            campos[i].cadenas += otro.campos[i].cadenas;
+        }
+        pacientes += otro.pacientes;
+    }
+
+    // Bytes de los contenedores: nodos, arreglos y cadenas fuera de linea
+    // (en modo acotado, la cache de registros y los indices compactos)
+    uint64_t totalPacientes() const {
+        uint64_t total = bytesNodos + bytesArreglos + cacheRegistros + indicesCompactos;
+        for (const auto& campo : campos) total += campo.bytes;
+        return total;
+    }
+};
+
+// Muestra la memoria por indice y por campo, comparada con la de LevelDB
+// El reparto de cada nodo entre indices sigue la disposicion de Boost.MultiIndex:
+// cada indice ordenado agrega tres punteros (padre con el color, izquierdo y
+// derecho) y el de acceso aleatorio uno; el resto del nodo es el PacienteData
+void mostrarUsoMemoria(const UsoMemoria& uso, ostream& destino) {
+    static const char* campos[UsoMemoria::CAMPOS] = { "patientID", "patientName", "studyDate", "modality", "sex" };
+    static const char* ordenados[] = { "ID", "nombre", "modalidad", "sexo", "fecha" };
+    const int64_t ENLACES_ORDENADO = 3 * sizeof(void*);
+    const int64_t ENLACES_ALEATORIO = sizeof(void*);
+
+    string salida;
+    char linea[160];
+    double porPaciente = uso.pacientes ? 1.0 / uso.pacientes : 0;
+    auto fila = [&](const string& nombre, int64_t bytes) {
+        snprintf(linea, sizeof(linea), "%-40s %16lld %14.1f\n", nombre.c_str(), (long long) bytes, bytes * porPaciente);
+        salida += linea;
+    };
+
+    snprintf(linea, sizeof(linea), "Memoria real de %zu pacientes (nodo de %zu bytes)\n", uso.pacientes, uso.tamanoNodo);
+    salida += linea;
+    snprintf(linea, sizeof(linea), "%-40s %16s %14s\n", "Componente", "Bytes", "Bytes/paciente");
+    salida += linea;
+
+    fila("Nodos del contenedor", uso.bytesNodos);
+    int64_t datos = uso.nodos * (int64_t) sizeof(PacienteData);
+    fila("  PacienteData (campos en linea)", datos);
+    int64_t enlaces = 0;
+    for (const char* indice : ordenados) {
+        fila(string("  Enlaces indice ") + indice, uso.nodos * ENLACES_ORDENADO);
+        enlaces += uso.nodos * ENLACES_ORDENADO;
+    }
+    fila("  Enlaces indice de acceso aleatorio", uso.nodos * ENLACES_ALEATORIO);
+    enlaces += uso.nodos * ENLACES_ALEATORIO;
+    fila("  Relleno", uso.bytesNodos - datos - enlaces);
+    fila("Arreglo del indice de acceso aleatorio", uso.bytesArreglos);
+    for (size_t i = 0; i < UsoMemoria::CAMPOS; ++i) {
+        fila(string("Cadenas fuera de linea ") + campos[i] + " (" + to_string(uso.campos[i].cadenas) + ")",
+             uso.campos[i].bytes);
+    }
+    if (uso.capacidadRegistros > 0) {
+        fila("Cache de registros (de " + to_string(uso.capacidadRegistros >> 20) + " MB)", uso.cacheRegistros);
+        fila("Indices compactos (IDs, modalidad, sexo)", uso.indicesCompactos);
+    }
+    fila("Total pacientes en memoria", uso.totalPacientes());
+    fila("LevelDB cache de bloques (de " + to_string(uso.capacidadCache >> 20) + " MB)", uso.cacheBloques);
+    fila("LevelDB memtables", uso.memtables);
+    destino << salida;
+}
+
+
+// Clase AlmacenFragmentado
+// Reparte los pacientes por hash del ID entre varios contenedores multi-indice
+// independientes, cada uno con su propio cerrojo. Las operaciones por ID tocan un
+// solo fragmento; las busquedas se reparten entre fragmentos en un pool de hilos y
+// sus resultados parciales se mezclan. Cada registro guarda una secuencia global
+// para poder reconstruir el orden de insercion al mezclar.
+class AlmacenFragmentado {
+    private:
+        // Un fragmento: contenedor completo con todos los indices, su cerrojo y el
+        // resumen de tamanos de sus altas (se combinan al consultar)
+        struct Fragmento {
+            PacienteContainer pacientes;
+            DistribucionTamanos distribucion;
+            mutable CerrojoMedido cerrojo;
+        };
+
+        vector<unique_ptr<Fragmento>> fragmentos;  // Fragmentos (el cerrojo no es movible)
+        atomic<uint64_t> proximaSecuencia;         // Siguiente secuencia de insercion
+        mutable PoolHilos pool;                    // Hilos para lotes y busquedas repartidas
+
+    public:
+        AlmacenFragmentado(size_t numFragmentos, size_t numHilos)
+            : proximaSecuencia(0), pool(numHilos) {
+            numFragmentos = max<size_t>(numFragmentos, 1);
+            for (size_t i = 0; i < numFragmentos; ++i) {
+                fragmentos.push_back(make_unique<Fragmento>());
+            }
+        }
+
+        size_t getNumFragmentos() const { return fragmentos.size(); }
+
+        // Fragmento dueno de un ID
+        size_t fragmentoDe(const string& id) const {
+            return hash64(id) % fragmentos.size();
+        }
+
+        // Inserta un paciente en su fragmento; devuelve false si el ID ya existia
+        // 'alInsertar' recibe el paciente insertado con el cerrojo del fragmento tomado
+        template <typename AlInsertar>
+        bool insertar(PacienteData paciente, AlInsertar alInsertar) {
+            Fragmento& fragmento = *fragmentos[fragmentoDe(paciente.patientID)];
+            BloqueoEscritura bloqueo(fragmento.cerrojo);
+            auto& index = fragmento.pacientes.get<0>();
+            if (index.find(paciente.patientID) != index.end()) return false;
+            paciente.secuencia = proximaSecuencia++;
+            fragmento.distribucion.agregar(paciente);
+            alInsertar(*fragmento.pacientes.insert(move(paciente)).first);
+            return true;
+        }
+
+        bool insertar(PacienteData paciente) {
+            return insertar(move(paciente), [](const PacienteData&) {});
+        }
+
+        // Inserta un lote: lo separa por fragmento y cada fragmento inserta su parte
+        // en paralelo tomando su cerrojo una sola vez. Las secuencias siguen el orden
+        // del lote. Devuelve, por posicion del lote, si el paciente fue insertado.
+        // 'alInsertar' recibe las altas de cada fragmento antes de soltar su cerrojo
+        template <typename AlInsertar>
+        vector<char> insertarLote(const vector<PacienteData>& pacientes, AlInsertar alInsertar) {
+            vector<char> insertados(pacientes.size(), 0);
+            if (pacientes.empty()) return insertados;
+
+            vector<vector<size_t>> porFragmento(fragmentos.size());
+            for (size_t i = 0; i < pacientes.size(); ++i) {
+                porFragmento[fragmentoDe(pacientes[i].patientID)].push_back(i);
+            }
+            uint64_t base = proximaSecuencia.fetch_add(pacientes.size());
+
+            vector<future<void>> pendientes;
+            for (size_t n = 0; n < fragmentos.size(); ++n) {
+                if (porFragmento[n].empty()) continue;
+                pendientes.push_back(pool.encolar([&, n]() {
+                    Fragmento& fragmento = *fragmentos[n];
+                    BloqueoEscritura bloqueo(fragmento.cerrojo);
+                    vector<const PacienteData*> altas;
+                    for (size_t i : porFragmento[n]) {
+                        PacienteData paciente = pacientes[i];
+                        paciente.secuencia = base + i;
+                        auto resultado = fragmento.pacientes.insert(move(paciente));
+                        insertados[i] = resultado.second;
+                        if (!resultado.second) continue;
+                        fragmento.distribucion.agregar(*resultado.first);
+                        altas.push_back(&*resultado.first);
+                    }
+                    alInsertar(altas);
+                }));
+            }
+            for (auto& pendiente : pendientes) pendiente.get();
+            return insertados;
+        }
+
+        vector<char> insertarLote(const vector<PacienteData>& pacientes) {
+            return insertarLote(pacientes, [](const vector<const PacienteData*>&) {});
+        }
+
+        // Ejecuta 'operacion' sobre el fragmento dueno de 'id' con su cerrojo de lectura
+        template <typename Operacion>
+        auto consultarFragmento(const string& id, Operacion operacion) const
+            -> decltype(operacion(declval<const PacienteContainer&>())) {
+            const Fragmento& fragmento = *fragmentos[fragmentoDe(id)];
+            BloqueoLectura bloqueo(fragmento.cerrojo);
+            return operacion(fragmento.pacientes);
+        }
+
+        // Ejecuta 'operacion' sobre el fragmento dueno de 'id' con su cerrojo de escritura
+        template <typename Operacion>
+        auto modificarFragmento(const string& id, Operacion operacion)
+            -> decltype(operacion(declval<PacienteContainer&>())) {
+            Fragmento& fragmento = *fragmentos[fragmentoDe(id)];
+            BloqueoEscritura bloqueo(fragmento.cerrojo);
+            return operacion(fragmento.pacientes);
+        }
+
+        // Ejecuta 'tarea' sobre cada fragmento en paralelo (con su cerrojo de lectura)
+        // y devuelve los resultados parciales en orden de fragmento
+        template <typename Tarea>
+        auto repartir(Tarea tarea) const -> vector<decltype(tarea(declval<const PacienteContainer&>()))> {
+            typedef decltype(tarea(declval<const PacienteContainer&>())) Resultado;
+            vector<future<Resultado>> pendientes;
+            for (const auto& fragmento : fragmentos) {
+                const Fragmento* actual = fragmento.get();
+                pendientes.push_back(pool.encolar([actual, &tarea]() {
+                    BloqueoLectura bloqueo(actual->cerrojo);
+                    return tarea(actual->pacientes);
+                }));
+            }
+            vector<Resultado> parciales;
+            parciales.reserve(pendientes.size());
+            for (auto& pendiente : pendientes) parciales.push_back(pendiente.get());
+            return parciales;
+        }
+
+        // Busqueda repartida: 'filtro' devuelve las coincidencias de un fragmento,
+        // cada parte se ordena segun 'menor' en su hilo y luego se mezclan k vias
+        template <typename Filtro, typename Menor>
+        vector<PacienteData> buscar(Filtro filtro, Menor menor) const {
+            auto parciales = repartir([&filtro, &menor](const PacienteContainer& pacientes) {
+                vector<PacienteData> encontrados = filtro(pacientes);
+                sort(encontrados.begin(), encontrados.end(), menor);
+                return encontrados;
+            });
+
+            // Cursor (fragmento, posicion) sobre cada resultado parcial
+            typedef pair<size_t, size_t> Cursor;
+            auto despues = [&parciales, &menor](const Cursor& a, const Cursor& b) {
+                return menor(parciales[b.first][b.second], parciales[a.first][a.second]);
+            };
+            priority_queue<Cursor, vector<Cursor>, decltype(despues)> frente(despues);
+            size_t total = 0;
+            for (size_t i = 0; i < parciales.size(); ++i) {
+                total += parciales[i].size();
+                if (!parciales[i].empty()) frente.push(Cursor(i, 0));
+            }
+
+            vector<PacienteData> resultados;
+            resultados.reserve(total);
+            while (!frente.empty()) {
+                Cursor cursor = frente.top();
+                frente.pop();
+                resultados.push_back(move(parciales[cursor.first][cursor.second]));
+                if (cursor.second + 1 < parciales[cursor.first].size()) {
+                    frente.push(Cursor(cursor.first, cursor.second + 1));
+                }
+            }
+            return resultados;
+        }
+
+        // Cantidad total de pacientes
+        size_t tamano() const {
+            size_t total = 0;
+            for (const auto& fragmento : fragmentos) {
+                BloqueoLectura bloqueo(fragmento->cerrojo);
+                total += fragmento->pacientes.size();
+            }
+            return total;
+        }
+
+        // Vacia todos los fragmentos
+        void limpiar() {
+            for (auto& fragmento : fragmentos) {
+                BloqueoEscritura bloqueo(fragmento->cerrojo);
+                fragmento->pacientes.clear();
+                fragmento->distribucion.limpiar();
+            }
+        }
+
+        // Combina los resumenes de tamanos de todos los fragmentos
+        DistribucionTamanos distribucionCombinada() const {
+            DistribucionTamanos combinada;
+            for (const auto& fragmento : fragmentos) {
+                BloqueoLectura bloqueo(fragmento->cerrojo);
+                combinada.combinar(fragmento->distribucion);
+            }
+            return combinada;
+        }
+
+        // Reconstruye en paralelo el resumen de cada fragmento desde sus pacientes
+        void reconstruirDistribuciones() {
+            vector<future<void>> pendientes;
+            for (auto& fragmento : fragmentos) {
+                Fragmento* actual = fragmento.get();
+                pendientes.push_back(pool.encolar([actual]() {
+                    BloqueoEscritura bloqueo(actual->cerrojo);
+                    actual->distribucion.reconstruir(actual->pacientes);
+                }));
+            }
+            for (auto& pendiente : pendientes) pendiente.get();
+        }
+
+        // Estadisticas de contencion de cada fragmento
+        void mostrarEstadisticas() const {
+            for (size_t i = 0; i < fragmentos.size(); ++i) {
+                cout << "[Fragmento " << i << "] ";
+                fragmentos[i]->cerrojo.mostrarEstadisticas();
+            }
+        }
+
+        void reiniciarEstadisticas() {
+            for (auto& fragmento : fragmentos) fragmento->cerrojo.reiniciarEstadisticas();
+        }
+};
+
+
+// Clase CacheRegistros
+// Cache LRU de pacientes acotada por bytes. Se reparte en segmentos por hash del ID,
+// cada uno con su mutex, su lista de uso y su parte de la capacidad, para que los
+// lectores concurrentes no compitan por una sola lista. Los aciertos, fallos y
+// desalojos se cuentan en las estadisticas de rendimiento
+class CacheRegistros {
+    private:
+        // Un segmento: lista del mas reciente al menos reciente y tabla por ID
+        // Las claves de la tabla apuntan al patientID guardado en el nodo de la lista
+        struct Segmento {
+            list<PacienteData> recientes;
+            unordered_map<string_view, list<PacienteData>::iterator> porID;
+            size_t bytes = 0;
+            mutex cerrojo;
+        };
+
+        static const size_t SEGMENTOS = 16;
+
+        vector<unique_ptr<Segmento>> segmentos;  // El mutex no es movible
+        size_t capacidad;                        // Bytes entre todos los segmentos
+        size_t capacidadSegmento;
+
+        Segmento& segmentoDe(const string& id) const {
+            return *segmentos[hash64(id) % segmentos.size()];
+        }
+
+        // Quita una entrada del segmento (el llamador tiene su mutex)
+        static void quitarSinBloqueo(Segmento& segmento, list<PacienteData>::iterator it) {
+            segmento.bytes -= bytesRegistro(*it);
+            segmento.porID.erase(string_view(it->patientID));
+            segmento.recientes.erase(it);
+        }
+
+    public:
+        explicit CacheRegistros(size_t capacidadBytes)
+            : capacidad(capacidadBytes), capacidadSegmento(max<size_t>(capacidadBytes / SEGMENTOS, 1)) {
+            for (size_t i = 0; i < SEGMENTOS; ++i) {
+                segmentos.push_back(make_unique<Segmento>());
+            }
+        }
+
+        // Bytes de una entrada: el PacienteData con su nodo de lista, el nodo de la
+        // tabla (clave, iterador, siguiente y hash) con su cubeta, y las cadenas fuera de linea
+        static size_t bytesRegistro(const PacienteData& paciente) {
+            size_t bytes = sizeof(PacienteData) + 2 * sizeof(void*) + sizeof(string_view) +
+                           sizeof(list<PacienteData>::iterator) + 3 * sizeof(void*);
+            for (const string* texto : { &paciente.patientID, &paciente.patientName, &paciente.studyDate,
+                                         &paciente.modality, &paciente.sex }) {
+                bytes += bytesFueraDeLinea(*texto);
+            }
+            return bytes;
+        }
+
+        // Copia el paciente si esta en la cache y lo marca como el mas reciente
+        bool obtener(const string& id, PacienteData& paciente) {
+            Segmento& segmento = segmentoDe(id);
+            {
+                lock_guard<mutex> bloqueo(segmento.cerrojo);
+                auto it = segmento.porID.find(string_view(id));
+                if (it != segmento.porID.end()) {
+                    segmento.recientes.splice(segmento.recientes.begin(), segmento.recientes, it->second);
+                    paciente = *it->second;
+                    estadisticas().contar(ContadorRendimiento::CACHE_ACIERTOS);
+                    return true;
+                }
+            }
+            estadisticas().contar(ContadorRendimiento::CACHE_FALLOS);
+            return false;
+        }
+
+        // Guarda (o reemplaza) un paciente como el mas reciente y desaloja los menos
+        // recientes hasta volver a la capacidad del segmento
+        void guardar(const PacienteData& paciente) {
+            Segmento& segmento = segmentoDe(paciente.patientID);
+            size_t desalojados = 0;
+            {
+                lock_guard<mutex> bloqueo(segmento.cerrojo);
+                auto it = segmento.porID.find(string_view(paciente.patientID));
+                if (it != segmento.porID.end()) quitarSinBloqueo(segmento, it->second);
+
+                segmento.recientes.push_front(paciente);
+                const PacienteData& guardado = segmento.recientes.front();
+                segmento.porID.emplace(string_view(guardado.patientID), segmento.recientes.begin());
+                segmento.bytes += bytesRegistro(guardado);
+                while (segmento.bytes > capacidadSegmento && segmento.recientes.size() > 1) {
+                    quitarSinBloqueo(segmento, prev(segmento.recientes.end()));
+                    desalojados++;
+                }
+            }
+            if (desalojados > 0) estadisticas().contar(ContadorRendimiento::CACHE_DESALOJOS, desalojados);
+        }
+
+        // Descarta un paciente de la cache, si estaba
+        void quitar(const string& id) {
+            Segmento& segmento = segmentoDe(id);
+            lock_guard<mutex> bloqueo(segmento.cerrojo);
+            auto it = segmento.porID.find(string_view(id));
+            if (it != segmento.porID.end()) quitarSinBloqueo(segmento, it->second);
+        }
+
+        // Vacia todos los segmentos
+        void limpiar() {
+            for (auto& segmento : segmentos) {
+                lock_guard<mutex> bloqueo(segmento->cerrojo);
+                segmento->porID.clear();
+                segmento->recientes.clear();
+                segmento->bytes = 0;
+            }
+        }
+
+        // Bytes ocupados ahora por las entradas
+        uint64_t bytesUsados() const {
+            uint64_t total = 0;
+            for (const auto& segmento : segmentos) {
+                lock_guard<mutex> bloqueo(segmento->cerrojo);
+                total += segmento->bytes;
+            }
+            return total;
+        }
+
+        size_t getCapacidad() const { return capacidad; }
+};
+
+
+// Clase AlmacenAcotado
+// Modo de memoria acotada: LevelDB es la unica copia de los pacientes y la memoria
+// guarda una cache LRU de registros calientes mas indices compactos:
+//  - los IDs por numero de registro (orden de alta) y una tabla hash de
+//    direccionamiento abierto que solo guarda numeros (4 bytes por ranura)
+//  - modalidad y sexo codificados con un diccionario (un entero por registro)
+// Las busquedas resuelven en memoria que registros coinciden y leen de la cache, o
+// de LevelDB en una sola pasada ordenada, solo los que faltan. No tiene cerrojo
+// propio: SistemaPacientes lo usa bajo su cerrojo (compartido para consultas,
+// exclusivo para cambios). La cache si se protege sola porque las consultas la modifican
+class AlmacenAcotado {
+    private:
+        // Columna de un campo con pocos valores distintos, codificada con un diccionario
+        struct ColumnaCodificada {
+            vector<string> valores;                   // Codigo -> valor
+            unordered_map<string, uint32_t> codigos;  // Valor -> codigo
+            vector<uint32_t> porNumero;               // Numero de registro -> codigo
+
+            uint32_t codificar(const string& valor) {
+                auto it = codigos.find(valor);
+                if (it != codigos.end()) return it->second;
+                uint32_t codigo = (uint32_t) valores.size();
+                codigos.emplace(valor, codigo);
+                valores.push_back(valor);
+                return codigo;
+            }
+
+            void limpiar() {
+                valores.clear();
+                codigos.clear();
+                porNumero.clear();
+            }
+
+            // Bytes aproximados: codigos por registro y diccionario (nodo, clave y cubeta)
+            uint64_t bytes() const {
+                uint64_t total = porNumero.capacity() * sizeof(uint32_t) + valores.capacity() * sizeof(string);
+                total += codigos.size() * (sizeof(string) + sizeof(uint32_t) + 3 * sizeof(void*));
+                for (const auto& valor : valores) total += 2 * bytesFueraDeLinea(valor);
+                return total;
+            }
+        };
+
+        static constexpr uint32_t LIBRE = UINT32_MAX;  // Ranura vacia de la tabla hash
+        static constexpr size_t RANURAS_MINIMAS = 1024;
+
+        // Las busquedas que traen mas registros que esto no pasan por la cache, para no
+        // desplazar a los calientes (como fill_cache = false en los recorridos de LevelDB)
+        static const size_t MAXIMO_LECTURA_CACHEADA = 256;
+
+        // Registros que se leen de LevelDB juntos al recorrer posiciones
+        static const size_t TAMANO_PAGINA = 1024;
+
+        LevelDBManager& leveldb;
+        mutable CacheRegistros cache;
+        vector<string> ids;          // Numero de registro -> ID (vacio si se borro)
+        vector<uint32_t> ranuras;    // Tabla hash de numeros de registro
+        size_t ocupadas;             // Ranuras usadas (incluye las de registros borrados)
+        size_t vivos;                // Registros vigentes
+        uint64_t renumeraciones;     // Veces que cambiaron los numeros (compactar o limpiar)
+        ColumnaCodificada modalidades;
+        ColumnaCodificada sexos;
+
+        // Numero de registro vigente de un ID, o LIBRE si no esta
+        // Los registros borrados conservan su ranura con el ID vacio, que no coincide
+        uint32_t numeroDe(const string& id) const {
+            if (ranuras.empty() || id.empty()) return LIBRE;
+            size_t mascara = ranuras.size() - 1;
+            for (size_t i = hash64(id) & mascara; ranuras[i] != LIBRE; i = (i + 1) & mascara) {
+                if (ids[ranuras[i]] == id) return ranuras[i];
+            }
+            return LIBRE;
+        }
+
+        // Pone un numero en la primera ranura libre de la secuencia de su ID
+        void ubicar(uint32_t numero) {
+            size_t mascara = ranuras.size() - 1;
+            size_t i = hash64(ids[numero]) & mascara;
+            while (ranuras[i] != LIBRE) i = (i + 1) & mascara;
+            ranuras[i] = numero;
+            ocupadas++;
+        }
+
+        // Renumera los registros vigentes sin cambiar su orden, descarta los borrados
+        // y rehace la tabla hash con al menos el doble de ranuras que registros
+        void compactar() {
+            renumeraciones++;
+            size_t destino = 0;
+            for (size_t n = 0; n < ids.size(); ++n) {
+                if (ids[n].empty()) continue;
+                if (destino != n) {
+                    ids[destino] = move(ids[n]);
+                    modalidades.porNumero[destino] = modalidades.porNumero[n];
+                    sexos.porNumero[destino] = sexos.porNumero[n];
+                }
+                destino++;
+            }
+            ids.resize(destino);
+            modalidades.porNumero.resize(destino);
+            sexos.porNumero.resize(destino);
+
+            size_t tamano = RANURAS_MINIMAS;
+            while (tamano < destino * 2) tamano *= 2;
+            ranuras.assign(tamano, LIBRE);
+            ocupadas = 0;
+            for (size_t n = 0; n < destino; ++n) ubicar((uint32_t) n);
+        }
+
+        // Asigna el siguiente numero de registro a un paciente nuevo
+        void agregarNumero(const PacienteData& paciente) {
+            if ((ocupadas + 1) * 10 > ranuras.size() * 7) compactar();  // Carga maxima del 70%
+            uint32_t numero = (uint32_t) ids.size();
+            ids.push_back(paciente.patientID);
+            modalidades.porNumero.push_back(modalidades.codificar(paciente.modality));
+            sexos.porNumero.push_back(sexos.codificar(paciente.sex));
+            ubicar(numero);
+            vivos++;
+        }
+
+        // Lee los registros de los numeros dados, en ese orden: primero de la cache y
+        // los que faltan de LevelDB con un solo iterador en orden de clave
+        vector<PacienteData> leerNumeros(const vector<uint32_t>& numeros) const {
+            bool guardarEnCache = numeros.size() <= MAXIMO_LECTURA_CACHEADA;
+            vector<PacienteData> pacientes(numeros.size());
+            vector<char> leidos(numeros.size(), 0);
+            vector<pair<string, size_t>> faltantes;  // ID y posicion en el resultado
+            for (size_t i = 0; i < numeros.size(); ++i) {
+                if (cache.obtener(ids[numeros[i]], pacientes[i])) leidos[i] = 1;
+                else faltantes.emplace_back(ids[numeros[i]], i);
+            }
+
+            if (!faltantes.empty()) {
+                sort(faltantes.begin(), faltantes.end());
+                vector<string> claves;
+                claves.reserve(faltantes.size());
+                for (const auto& faltante : faltantes) claves.push_back(faltante.first);
+
+                // leerPacientes omite las claves que no encuentra: se avanza hasta la visitada
+                size_t siguiente = 0;
+                leveldb.leerPacientes(claves, [&](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                    while (siguiente < faltantes.size() && clave.compare(faltantes[siguiente].first) != 0) siguiente++;
+                    if (siguiente == faltantes.size()) return;
+                    size_t posicion = faltantes[siguiente++].second;
+                    PacienteData& paciente = pacientes[posicion];
+                    if (!LevelDBManager::pacienteDesdeValor(ids[numeros[posicion]],
+                                                            string_view(valor.data(), valor.size()), paciente)) return;
+                    leidos[posicion] = 1;
+                    if (guardarEnCache) cache.guardar(paciente);
+                });
+            }
+
+            vector<PacienteData> resultado;
+            resultado.reserve(numeros.size());
+            for (size_t i = 0; i < numeros.size(); ++i) {
+                if (!leidos[i]) continue;
+                pacientes[i].secuencia = numeros[i];
+                resultado.push_back(move(pacientes[i]));
+            }
+            return resultado;
+        }
+
+        // Pacientes vigentes cuyo valor en la columna es exactamente 'valor', en orden de alta
+        vector<PacienteData> buscarEnColumna(const ColumnaCodificada& columna, const string& valor) const {
+            auto codigo = columna.codigos.find(valor);
+            if (codigo == columna.codigos.end()) return {};
+
+            vector<uint32_t> numeros;
+            for (size_t n = 0; n < columna.porNumero.size(); ++n) {
+                if (columna.porNumero[n] == codigo->second && !ids[n].empty()) numeros.push_back((uint32_t) n);
+            }
+            return leerNumeros(numeros);
+        }
+
+    public:
+        AlmacenAcotado(LevelDBManager& baseDatos, size_t capacidadCache)
+            : leveldb(baseDatos), cache(capacidadCache), ocupadas(0), vivos(0), renumeraciones(0) {}
+
+        // Arma los indices recorriendo LevelDB una vez; alCargar recibe cada paciente
+        void cargar(const function<void(const PacienteData&)>& alCargar) {
+            limpiar();
+            leveldb.recorrerRango(nullptr, nullptr, [&](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                PacienteData paciente;
+                if (!LevelDBManager::pacienteDesdeValor(clave.ToString(), string_view(valor.data(), valor.size()),
+                                                        paciente)) return;
+                agregarNumero(paciente);
+                if (alCargar) alCargar(paciente);
+            });
+        }
+
+        // Cantidad de pacientes vigentes (los mismos que hay en LevelDB)
+        size_t tamano() const {
+            return vivos;
+        }
+
+        // Verifica si un ID existe sin tocar LevelDB
+        bool existe(const string& id) const {
+            return numeroDe(id) != LIBRE;
+        }
+
+        // Registra un paciente nuevo; devuelve false si el ID ya existia
+        // Las cargas masivas no lo guardan en la cache para no desplazar a los calientes
+        bool insertar(const PacienteData& paciente, bool guardarEnCache = true) {
+            if (paciente.patientID.empty() || existe(paciente.patientID)) return false;
+            agregarNumero(paciente);
+            if (guardarEnCache) cache.guardar(paciente);
+            return true;
+        }
+
+        // Busca un paciente por ID: en la cache y, si no esta, con una lectura de LevelDB
+        bool obtener(const string& id, PacienteData& paciente) const {
+            uint32_t numero = numeroDe(id);
+            if (numero == LIBRE) return false;
+            if (!cache.obtener(id, paciente)) {
+                string valor = leveldb.buscarPacientePorID(id);
+                if (valor.empty() || !LevelDBManager::pacienteDesdeValor(id, valor, paciente)) return false;
+                cache.guardar(paciente);
+            }
+            paciente.secuencia = numero;
+            return true;
+        }
+
+        // Reemplaza el registro de un paciente existente en los indices y la cache
+        bool reemplazar(const PacienteData& paciente) {
+            uint32_t numero = numeroDe(paciente.patientID);
+            if (numero == LIBRE) return false;
+            modalidades.porNumero[numero] = modalidades.codificar(paciente.modality);
+            sexos.porNumero[numero] = sexos.codificar(paciente.sex);
+            cache.guardar(paciente);
+            return true;
+        }
+
+        // Quita un paciente de los indices y de la cache
+        // Cuando los borrados superan a los vigentes se compactan los indices
+        bool quitar(const string& id) {
+            uint32_t numero = numeroDe(id);
+            if (numero == LIBRE) return false;
+            cache.quitar(id);
+            string().swap(ids[numero]);  // Libera la cadena; la ranura queda marcada como borrada
+            vivos--;
+            if (ids.size() - vivos > max(vivos, RANURAS_MINIMAS)) compactar();
+            return true;
+        }
+
+        // Busquedas exactas sobre las columnas codificadas
+        vector<PacienteData> buscarPorModalidad(const string& modalidad) const {
+            return buscarEnColumna(modalidades, modalidad);
+        }
+
+        vector<PacienteData> buscarPorSexo(const string& sexo) const {
+            return buscarEnColumna(sexos, sexo);
+        }
+
+        // Completa la secuencia (orden de alta) de pacientes leidos fuera del almacen
+        void numerar(vector<PacienteData>& pacientes) const {
+            for (auto& paciente : pacientes) paciente.secuencia = numeroDe(paciente.patientID);
+        }
+
+        // Visita en orden de alta los pacientes de las posiciones [desde, desde + cantidad)
+        // Los lee por paginas para no tener el rango completo en memoria
+        template <typename Visitar>
+        void recorrerPosiciones(size_t desde, size_t cantidad, Visitar visitar) const {
+            recorrerDesdeNumero(numeroDePosicion(desde), cantidad, visitar);
+        }
+
+        // Numero de registro de una posicion del orden de alta (ids.size() si no existe)
+        size_t numeroDePosicion(size_t posicion) const {
+            size_t n = 0;
+            for (; n < ids.size(); ++n) {
+                if (!ids[n].empty() && posicion-- == 0) break;
+            }
+            return n;
+        }
+
+        // Visita en orden de alta hasta 'cantidad' pacientes vigentes desde el numero de
+        // registro 'numero'. Devuelve el numero donde seguir, para recorrer por tramos sin
+        // volver a contar posiciones (valido mientras getRenumeraciones() no cambie)
+        template <typename Visitar>
+        size_t recorrerDesdeNumero(size_t numero, size_t cantidad, Visitar visitar) const {
+            vector<uint32_t> pagina;
+            auto leerPagina = [&]() {
+                for (const auto& paciente : leerNumeros(pagina)) visitar(paciente);
+                pagina.clear();
+            };
+            size_t n = numero;
+            for (; n < ids.size() && cantidad > 0; ++n) {
+                if (ids[n].empty()) continue;
+                pagina.push_back((uint32_t) n);
+                cantidad--;
+                if (pagina.size() == TAMANO_PAGINA) leerPagina();
+            }
+            if (!pagina.empty()) leerPagina();
+            return n;
+        }
+
+        uint64_t getRenumeraciones() const { return renumeraciones; }
+
+        // IDs de las posiciones indicadas (orden de alta); descarta invalidas y repetidas
+        vector<string> idsEnPosiciones(vector<size_t> posiciones) const {
+            sort(posiciones.begin(), posiciones.end());
+            posiciones.erase(unique(posiciones.begin(), posiciones.end()), posiciones.end());
+
+            vector<string> encontrados;
+            size_t posicion = 0;
+            auto pedida = posiciones.begin();
+            for (size_t n = 0; n < ids.size() && pedida != posiciones.end(); ++n) {
+                if (ids[n].empty()) continue;
+                if (posicion++ == *pedida) {
+                    encontrados.push_back(ids[n]);
+                    ++pedida;
+                }
+            }
+            return encontrados;
+        }
+
+        // Vacia indices y cache
+        void limpiar() {
+            renumeraciones++;
+            ids.clear();
+            ranuras.clear();
+            ocupadas = 0;
+            vivos = 0;
+            modalidades.limpiar();
+            sexos.limpiar();
+            cache.limpiar();
+        }
+
+        // Bytes de la tabla de IDs, la tabla hash y las columnas codificadas
+        uint64_t bytesIndices() const {
+            uint64_t total = ids.capacity() * sizeof(string) + ranuras.capacity() * sizeof(uint32_t);
+            for (const auto& id : ids) total += bytesFueraDeLinea(id);
+            return total + modalidades.bytes() + sexos.bytes();
+        }
+
+        const CacheRegistros& getCache() const {
+            return cache;
+        }
+};
+
+
+// Formato de la instantanea de la memoria (enteros en el orden de bytes de la maquina):
+//   cabecera | bloques de registros ordenados por ID | IDs pendientes | indice de bloques
+// Cada bloque tiene unos TAMANO_BLOQUE bytes de registros precedidos por su cantidad,
+// sus bytes y el hash64 de esos bytes. Un registro es su orden de insercion (8 bytes),
+// el ID y los campos del esquema: textos con su longitud (4 bytes) y numeros de 8 bytes.
+// Los IDs pendientes (texto con su longitud) son los de operaciones en curso al copiar
+// la memoria (ver DiarioOperaciones): al cargar se releen de LevelDB.
+// El indice guarda por bloque su desplazamiento, registros y primer ID
+struct CabeceraInstantanea {
+    char magia[8];                  // "PACINST1"
+    uint32_t version;
+    uint32_t tamanoBloque;
+    uint64_t secuenciaCambios;      // Secuencia del registro de cambios de LevelDB incluida
+    uint64_t registros;
+    uint64_t bloques;
+    uint64_t pendientes;            // IDs pendientes, justo antes del indice
+    uint64_t bytesPendientes;
+    uint64_t hashPendientes;
+    uint64_t desplazamientoIndice;
+    uint64_t bytesIndice;
+    uint64_t hashIndice;
+    uint64_t hashCabecera;          // hash64 de los campos anteriores
+};
+
+struct CabeceraBloque {
+    uint32_t registros;
+    uint32_t bytes;
+    uint64_t hash;                  // hash64 de los bytes del bloque
+};
+
+static const char MAGIA_INSTANTANEA[8] = {'P', 'A', 'C', 'I', 'N', 'S', 'T', '1'};
+static const uint32_t VERSION_INSTANTANEA = 2;
+
+// Clase EscritorInstantanea
+// Escribe la instantanea en 'ruta.tmp' y la renombra despues de fsync: una escritura
+// interrumpida nunca deja una instantanea a medias con el nombre final.
+// Los pacientes deben llegar ordenados por ID
+class EscritorInstantanea {
+    private:
+        static const size_t TAMANO_BLOQUE = 64 * 1024;
+
+        string ruta;
+        string rutaTemporal;
+        int descriptor;
+        bool correcto;
+        CabeceraInstantanea cabecera;
+        string bloque;              // Registros del bloque en curso
+        uint32_t registrosBloque;
+        string primerID;            // Primer ID del bloque en curso
+        string indice;              // Entradas de los bloques ya escritos
+        uint64_t desplazamiento;    // Donde empieza el proximo bloque
+
+        template <typename T>
+        static void agregarBinario(string& destino, T valor) {
+            destino.append(reinterpret_cast<const char*>(&valor), sizeof(valor));
+        }
+
+        static void agregarCampo(string& destino, const string& texto) {
+            agregarBinario<uint32_t>(destino, (uint32_t) texto.size());
+            destino += texto;
+        }
+
+        static void agregarCampo(string& destino, long long numero) {
+            agregarBinario<int64_t>(destino, numero);
+        }
+
+        // write() completo, reintentando escrituras parciales
+        bool escribirTodo(const void* datos, size_t bytes) {
+            const char* actual = static_cast<const char*>(datos);
+            while (bytes > 0) {
+                ssize_t escritos = ::write(descriptor, actual, bytes);
+                if (escritos < 0 && errno == EINTR) continue;
+                if (escritos <= 0) return false;
+                actual += escritos;
+                bytes -= escritos;
+            }
+            return true;
+        }
+
+        // Escribe el bloque en curso con su encabezado y lo anota en el indice
+        void cerrarBloque() {
+            if (registrosBloque == 0) return;
+            CabeceraBloque encabezado = {registrosBloque, (uint32_t) bloque.size(), hash64(bloque.data(), bloque.size())};
+            agregarBinario<uint64_t>(indice, desplazamiento);
+            agregarBinario<uint32_t>(indice, registrosBloque);
+            agregarCampo(indice, primerID);
+            correcto = correcto && escribirTodo(&encabezado, sizeof(encabezado)) &&
+                       escribirTodo(bloque.data(), bloque.size());
+            desplazamiento += sizeof(encabezado) + bloque.size();
+            cabecera.bloques++;
+            bloque.clear();
+            registrosBloque = 0;
+        }
+
+    public:
+        EscritorInstantanea(const string& rutaArchivo, uint64_t secuenciaCambios)
+            : ruta(rutaArchivo), rutaTemporal(rutaArchivo + ".tmp"), correcto(true), cabecera(),
+              registrosBloque(0), desplazamiento(sizeof(CabeceraInstantanea)) {
+            memcpy(cabecera.magia, MAGIA_INSTANTANEA, sizeof(cabecera.magia));
+            cabecera.version = VERSION_INSTANTANEA;
+            cabecera.tamanoBloque = TAMANO_BLOQUE;
+            cabecera.secuenciaCambios = secuenciaCambios;
+            bloque.reserve(TAMANO_BLOQUE + 1024);
+
+            descriptor = ::open(rutaTemporal.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            // La cabecera se reescribe al terminar, con los totales y los hashes
+            correcto = descriptor >= 0 && escribirTodo(&cabecera, sizeof(cabecera));
+        }
+
+        // Sin terminar(), el archivo temporal se descarta
+        ~EscritorInstantanea() {
+            if (descriptor >= 0) {
+                ::close(descriptor);
+                unlink(rutaTemporal.c_str());
+            }
+        }
+
+        EscritorInstantanea(const EscritorInstantanea&) = delete;
+        EscritorInstantanea& operator=(const EscritorInstantanea&) = delete;
+
+        // Agrega un paciente con su posicion en el orden de insercion
+        void agregar(const PacienteData& paciente, uint64_t orden) {
+            if (registrosBloque == 0) primerID = paciente.patientID;
+            agregarBinario<uint64_t>(bloque, orden);
+            agregarCampo(bloque, paciente.patientID);
+            EsquemaPaciente::paraCadaCampo([&](auto campo) {
+                agregarCampo(bloque, EsquemaPaciente::valor<decltype(campo)::value>(paciente));
+            });
+            registrosBloque++;
+            cabecera.registros++;
+            if (bloque.size() >= TAMANO_BLOQUE) cerrarBloque();
+        }
+
+        // Escribe el ultimo bloque, los IDs pendientes, el indice y la cabecera y
+        // publica el archivo
+        bool terminar(const set<string>& pendientes = {}) {
+            if (descriptor < 0) return false;
+            cerrarBloque();
+            string seccion;
+            for (const auto& id : pendientes) agregarCampo(seccion, id);
+            cabecera.pendientes = pendientes.size();
+            cabecera.bytesPendientes = seccion.size();
+            cabecera.hashPendientes = hash64(seccion.data(), seccion.size());
+            correcto = correcto && escribirTodo(seccion.data(), seccion.size());
+            desplazamiento += seccion.size();
+            cabecera.desplazamientoIndice = desplazamiento;
+            cabecera.bytesIndice = indice.size();
+            cabecera.hashIndice = hash64(indice.data(), indice.size());
+            cabecera.hashCabecera = hash64(reinterpret_cast<const char*>(&cabecera),
+                                           offsetof(CabeceraInstantanea, hashCabecera));
+            correcto = correcto && escribirTodo(indice.data(), indice.size()) &&
+                       pwrite(descriptor, &cabecera, sizeof(cabecera), 0) == (ssize_t) sizeof(cabecera) &&
+                       fsync(descriptor) == 0;
+            correcto = ::close(descriptor) == 0 && correcto;
+            descriptor = -1;
+            if (correcto && rename(rutaTemporal.c_str(), ruta.c_str()) == 0) return true;
+            unlink(rutaTemporal.c_str());
+            return false;
+        }
+
+        uint64_t getRegistros() const { return cabecera.registros; }
+};
+
+// Clase LectorInstantanea
+// Proyecta la instantanea en memoria (mmap, solo lectura) y valida cabecera e indice al
+// abrirla; el hash de cada bloque se comprueba al decodificarlo. Los bloques son
+// independientes y se decodifican en paralelo
+class LectorInstantanea {
+    private:
+        struct EntradaIndice {
+            uint64_t desplazamiento;
+            uint32_t registros;
+        };
+
+        int descriptor;
+        const char* datos;
+        size_t tamano;
+        CabeceraInstantanea cabecera;
+        vector<EntradaIndice> bloques;
+        vector<string> pendientes;
+        string error;               // Vacio si la instantanea es valida
+
+        template <typename T>
+        static bool leerBinario(const char*& actual, const char* fin, T& valor) {
+            if ((size_t) (fin - actual) < sizeof(T)) return false;
+            memcpy(&valor, actual, sizeof(T));
+            actual += sizeof(T);
+            return true;
+        }
+
+        static bool leerCampo(const char*& actual, const char* fin, string& texto) {
+            uint32_t longitud;
+            if (!leerBinario(actual, fin, longitud) || (size_t) (fin - actual) < longitud) return false;
+            texto.assign(actual, longitud);
+            actual += longitud;
+            return true;
+        }
+
+        static bool leerCampo(const char*& actual, const char* fin, long long& numero) {
+            int64_t valor;
+            if (!leerBinario(actual, fin, valor)) return false;
+            numero = valor;
+            return true;
+        }
+
+        // Valida la cabecera y lee el indice de bloques
+        bool validar() {
+            if (tamano < sizeof(cabecera)) return falla("archivo truncado");
+            memcpy(&cabecera, datos, sizeof(cabecera));
+            if (memcmp(cabecera.magia, MAGIA_INSTANTANEA, sizeof(cabecera.magia)) != 0) return falla("no es una instantanea");
+            if (cabecera.version != VERSION_INSTANTANEA) return falla("version " + to_string(cabecera.version) + " no soportada");
+            if (cabecera.hashCabecera != hash64(datos, offsetof(CabeceraInstantanea, hashCabecera))) {
+                return falla("cabecera danada");
+            }
+            if (cabecera.desplazamientoIndice > tamano || tamano - cabecera.desplazamientoIndice != cabecera.bytesIndice ||
+                cabecera.desplazamientoIndice < sizeof(cabecera) ||
+                cabecera.bytesPendientes > cabecera.desplazamientoIndice - sizeof(cabecera)) {
+                return falla("archivo truncado");
+            }
+            // Los bloques terminan donde empiezan los IDs pendientes
+            uint64_t finBloques = cabecera.desplazamientoIndice - cabecera.bytesPendientes;
+            const char* actual = datos + finBloques;
+            const char* fin = datos + cabecera.desplazamientoIndice;
+            if (cabecera.hashPendientes != hash64(actual, cabecera.bytesPendientes)) return falla("IDs pendientes danados");
+            string id;
+            while (actual < fin) {
+                if (!leerCampo(actual, fin, id)) return falla("IDs pendientes danados");
+                pendientes.push_back(id);
+            }
+            if (pendientes.size() != cabecera.pendientes) return falla("IDs pendientes incompletos");
+
+            actual = datos + cabecera.desplazamientoIndice;
+            fin = datos + tamano;
+            if (cabecera.hashIndice != hash64(actual, cabecera.bytesIndice)) return falla("indice danado");
+
+            uint64_t registros = 0;
+            string primerID;
+            while (actual < fin) {
+                EntradaIndice entrada;
+                if (!leerBinario(actual, fin, entrada.desplazamiento) || !leerBinario(actual, fin, entrada.registros) ||
+                    !leerCampo(actual, fin, primerID) ||
+                    entrada.desplazamiento + sizeof(CabeceraBloque) > finBloques) {
+                    return falla("indice danado");
+                }
+                CabeceraBloque encabezado;
+                memcpy(&encabezado, datos + entrada.desplazamiento, sizeof(encabezado));
+                if (encabezado.registros != entrada.registros ||
+                    encabezado.bytes > finBloques - entrada.desplazamiento - sizeof(encabezado)) {
+                    return falla("bloque " + to_string(bloques.size()) + " danado");
+                }
+                registros += entrada.registros;
+                bloques.push_back(entrada);
+            }
+            if (bloques.size() != cabecera.bloques || registros != cabecera.registros) return falla("indice incompleto");
+            return true;
+        }
+
+        bool falla(const string& motivo) {
+            error = motivo;
+            return false;
+        }
+
+        // Decodifica un bloque al final de 'destino'; false si su hash o su contenido no coinciden
+        bool decodificarBloque(const EntradaIndice& entrada, vector<PacienteData>& destino) const {
+            CabeceraBloque encabezado;
+            memcpy(&encabezado, datos + entrada.desplazamiento, sizeof(encabezado));
+            const char* actual = datos + entrada.desplazamiento + sizeof(encabezado);
+            const char* fin = actual + encabezado.bytes;
+            if (hash64(actual, encabezado.bytes) != encabezado.hash) return false;
+
+            for (uint32_t i = 0; i < encabezado.registros; ++i) {
+                PacienteData paciente;
+                bool completo = leerBinario(actual, fin, paciente.secuencia) &&
+                                leerCampo(actual, fin, paciente.patientID);
+                EsquemaPaciente::paraCadaCampo([&](auto campo) {
+                    completo = completo && leerCampo(actual, fin, EsquemaPaciente::valor<decltype(campo)::value>(paciente));
+                });
+                if (!completo) return false;
+                destino.push_back(move(paciente));
+            }
+            return actual == fin;
+        }
+
+    public:
+        explicit LectorInstantanea(const string& ruta)
+            : descriptor(-1), datos(nullptr), tamano(0), cabecera() {
+            descriptor = ::open(ruta.c_str(), O_RDONLY);
+            struct stat info;
+            if (descriptor < 0 || fstat(descriptor, &info) != 0) {
+                falla("no se pudo abrir " + ruta);
+                return;
+            }
+            tamano = info.st_size;
+            void* proyeccion = tamano > 0 ? mmap(nullptr, tamano, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+            if (proyeccion == MAP_FAILED) {
+                tamano = 0;
+                falla("no se pudo proyectar " + ruta);
+                return;
+            }
+            datos = static_cast<const char*>(proyeccion);
+            madvise(proyeccion, tamano, MADV_SEQUENTIAL);
+            validar();
+        }
+
+        ~LectorInstantanea() {
+            if (datos) munmap(const_cast<char*>(datos), tamano);
+            if (descriptor >= 0) ::close(descriptor);
+        }
+
+        LectorInstantanea(const LectorInstantanea&) = delete;
+        LectorInstantanea& operator=(const LectorInstantanea&) = delete;
+
+        bool valida() const { return error.empty(); }
+        const string& getError() const { return error; }
+        uint64_t getSecuenciaCambios() const { return cabecera.secuenciaCambios; }
+        uint64_t getRegistros() const { return cabecera.registros; }
+        const vector<string>& getPendientes() const { return pendientes; }
+
+        // Decodifica todos los registros, ordenados por ID, en 'pacientes'; la
+        // secuencia de cada uno es su orden de insercion. Los bloques se reparten
+        // en tramos consecutivos entre 'hilos' hilos
+        bool leerTodos(vector<PacienteData>& pacientes, size_t hilos) const {
+            if (!valida()) return false;
+            hilos = max<size_t>(min(hilos, bloques.size()), 1);
+            vector<vector<PacienteData>> tramos(hilos);
+            vector<char> correctos(hilos, 0);
+            vector<thread> trabajadores;
+            for (size_t t = 0; t < hilos; ++t) {
+                trabajadores.emplace_back([this, t, hilos, &tramos, &correctos]() {
+                    size_t desde = bloques.size() * t / hilos;
+                    size_t hasta = bloques.size() * (t + 1) / hilos;
+                    bool correcto = true;
+                    for (size_t n = desde; n < hasta && correcto; ++n) {
+                        correcto = decodificarBloque(bloques[n], tramos[t]);
+                    }
+                    correctos[t] = correcto;
+                });
+            }
+            for (auto& trabajador : trabajadores) trabajador.join();
+            if (find(correctos.begin(), correctos.end(), 0) != correctos.end()) return false;
+
+            pacientes.clear();
+            pacientes.reserve(cabecera.registros);
+            for (auto& tramo : tramos) {
+                move(tramo.begin(), tramo.end(), back_inserter(pacientes));
+            }
+            return true;
+        }
+};
+
+
+// Clase DiarioOperaciones
+// Altas, cambios y bajas en curso. Sus IDs se anotan antes de tocar la memoria y se
+// cierran cuando el lote que los escribe en LevelDB (con su entrada en el registro de
+// cambios) termino. Una instantanea guarda los IDs abiertos y los de lotes fallidos:
+// son los unicos cuya copia puede no coincidir con LevelDB sin que el registro lo diga
+// despues de su secuencia. Las operaciones que escriben con el cerrojo de escritura
+// tomado no corren durante la copia, que toma el de lectura; en ellas el diario solo
+// deja los lotes fallidos
+class DiarioOperaciones {
+    private:
+        mutable mutex mutexDiario;
+        bool activo;                               // Solo con instantanea configurada
+        uint64_t ultimaOperacion;
+        map<uint64_t, vector<string>> abiertas;    // Numero de operacion -> IDs anotados
+        set<string> divergentes;                   // IDs cuyo lote no se pudo escribir
+
+    public:
+        explicit DiarioOperaciones(bool activo) : activo(activo), ultimaOperacion(0) {}
+
+        bool estaActivo() const { return activo; }
+
+        // Abre una operacion; devuelve su numero (0 si el diario no esta activo)
+        uint64_t abrir(vector<string> ids) {
+            if (!activo) return 0;
+            lock_guard<mutex> bloqueo(mutexDiario);
+            abiertas.emplace(++ultimaOperacion, move(ids));
+            return ultimaOperacion;
+        }
+
+        // Anota un ID mas en una operacion abierta, antes de cambiarlo en memoria
+        void anotar(uint64_t operacion, const string& id) {
+            if (operacion == 0) return;
+            lock_guard<mutex> bloqueo(mutexDiario);
+            abiertas[operacion].push_back(id);
+        }
+
+        // Cierra la operacion; si su lote no se escribio sus IDs quedan divergentes
+        void cerrar(uint64_t operacion, bool escrita) {
+            if (operacion == 0) return;
+            lock_guard<mutex> bloqueo(mutexDiario);
+            auto it = abiertas.find(operacion);
+            if (it == abiertas.end()) return;
+            if (!escrita) divergentes.insert(it->second.begin(), it->second.end());
+            abiertas.erase(it);
+        }
+
+        // Memoria y LevelDB volvieron a coincidir (borrado total o reparacion)
+        void olvidarDivergentes() {
+            lock_guard<mutex> bloqueo(mutexDiario);
+            divergentes.clear();
+        }
+
+        // Suma a 'pendientes' los IDs de las operaciones abiertas y los divergentes
+        void juntarPendientes(set<string>& pendientes) const {
+            lock_guard<mutex> bloqueo(mutexDiario);
+            for (const auto& operacion : abiertas) {
+                pendientes.insert(operacion.second.begin(), operacion.second.end());
+            }
+            pendientes.insert(divergentes.begin(), divergentes.end());
+        }
+};
+
+// Operacion del diario con alcance de bloque: se cierra al destruirse
+class OperacionDiario {
+    private:
+        DiarioOperaciones& diario;
+        uint64_t numero;
+
+    public:
+        OperacionDiario(DiarioOperaciones& diario, vector<string> ids = {})
+            : diario(diario), numero(diario.abrir(move(ids))) {}
+
+        ~OperacionDiario() {
+            diario.cerrar(numero, true);
+        }
+
+        OperacionDiario(const OperacionDiario&) = delete;
+        OperacionDiario& operator=(const OperacionDiario&) = delete;
+
+        void anotar(const string& id) {
+            diario.anotar(numero, id);
+        }
+
+        // Cierra los IDs anotados con el resultado del lote que los escribio y sigue
+        // abierta para los proximos. Devuelve 'correcto'
+        bool escrito(bool correcto) {
+            if (numero == 0) return correcto;
+            diario.cerrar(numero, correcto);
+            numero = diario.abrir({});
+            return correcto;
+        }
+};
+
+
+// Clase SistemaPacientes
+// Clase principal que integra Boost Multi-Index en memoria con LevelDB persistente
+// Los lectores (busquedas y listados) toman el cerrojo compartido y pueden correr
+// en varios hilos a la vez; los escritores lo toman en exclusiva por lote, de modo
+// que los lectores siempre ven el estado anterior o posterior a un lote completo.
+class SistemaPacientes {
+    private:
+        PacienteContainer pacientesContainer;  // Contenedor en memoria con multiples indices
+        LevelDBManager leveldb;                // Gestor de base de datos persistente
+        mutable CerrojoMedido cerrojo;         // Protege el contenedor y sus estructuras derivadas
+
+        // Hasta esta cantidad, el borrado por posiciones elimina uno a uno;
+        // por encima compacta el indice de acceso aleatorio en una sola pasada
+        static const size_t UMBRAL_BORRADO_INDIVIDUAL = 8;
+
+        // Tamano aproximado (bytes) a partir del cual se escribe un lote a LevelDB
+        static const size_t TAMANO_MAXIMO_LOTE = 4 * 1024 * 1024;
+
+        // Lineas que se parsean fuera del cerrojo antes de insertarlas juntas
+        static const size_t TAMANO_LOTE_CARGA = 1024;
+
+        // Pacientes que mostrarRango copia bajo el cerrojo antes de escribirlos sin el
+        static const size_t TRAMO_MOSTRAR = 4096;
+
+        // Pacientes por lote (un cerrojo y un WriteBatch) en la carga de un directorio
+        static const size_t TAMANO_LOTE_DIRECTORIO = 65536;
+
+        FiltroBloom filtroIDs;           // Prefiltro de pertenencia sincronizado con el indice por ID
+        size_t borradosSinReconstruir;   // Borrados que siguen marcados en el filtro
+
+        // Punto de control de un archivo compacto ya procesado
+        struct PuntoControlArchivo {
+            dev_t dispositivo;          // Dispositivo que contiene el archivo
+            ino_t inodo;                // Inodo (detecta reemplazos por rotacion)
+            off_t tamano;               // Tamano del archivo en la ultima lectura
+            off_t desplazamiento;       // Bytes procesados (termina en fin de linea)
+            uint64_t hashUltimaLinea;   // Hash de la ultima linea completa procesada
+            size_t longitudUltimaLinea; // Longitud de esa linea sin el salto
+        };
+        map<string, PuntoControlArchivo> puntosControl;  // Un punto de control por archivo
+
+        ArbolReconciliacion arbol;       // Hashes por rango de IDs de memoria y LevelDB
+        size_t registrosAlConstruirArbol; // Tamano de la memoria cuando se fijaron los limites
+
+        // Solo en modo fragmentado: reemplaza a pacientesContainer, que queda vacio
+        unique_ptr<AlmacenFragmentado> fragmentado;
+
+        // Solo en modo acotado: LevelDB guarda los pacientes y este almacen la cache de
+        // registros e indices compactos; pacientesContainer queda vacio
+        unique_ptr<AlmacenAcotado> acotado;
+
+        TablaAgregados tablaAgregados;   // Cantidad y tamanos por modalidad, sexo y mes (LevelDB)
+        string rutaInstantanea;          // Instantanea de la memoria para arrancar rapido (vacia = sin ella)
+        DiarioOperaciones diario;        // Altas, cambios y bajas cuyo lote aun no se escribio
+        bool verificarAltasEnBD;         // LevelDB tenia pacientes al iniciar que no estan en memoria
+
+        // Sketches de tamanos por modalidad de la memoria (en modo fragmentado, uno por fragmento)
+        // Solo reciben altas; los borrados y cambios se cuentan y, cuando superan la
+        // decima parte de los pacientes, los sketches se reconstruyen al consultar
+        DistribucionTamanos distribucion;
+        atomic<uint64_t> cambiosEnDistribucion;
+        static const uint64_t MINIMO_CAMBIOS_RECONSTRUCCION = 1024;
+
+        // Resultado de procesar un archivo o una parte de el
+        struct ResultadoCarga {
+            int cargados = 0;
+            int duplicados = 0;
+            off_t desplazamientoFinal = 0;
+        };
+
+        // Una linea de parche ya interpretada
+        struct Parche {
+            string id;
+            ActualizacionPaciente cambios;
+        };
+
+        // Un archivo de un directorio ya leido y parseado (fuera de cualquier cerrojo)
+        struct ArchivoParseado {
+            vector<DataPaciente> pacientes;
+            size_t invalidas = 0;
+            uint64_t bytes = 0;
+            bool abierto = false;
+            PuntoControlArchivo punto = {};  // Sin dispositivo, inodo ni tamano
+        };
+
+        // Funcion auxiliar para convertir a minusculas (case-insensitive)
+        string aMinusculas(const string& str) const {
+            string result = str;
+            transform(result.begin(), result.end(), result.begin(), ::tolower);
+            return result;
+        }
+            
+    public:
+        // Constructor - inicializa LevelDB y carga datos existentes
+        // Con numFragmentos > 0 los pacientes en memoria se reparten por hash del ID.
+        // Con capacidadCache > 0 (bytes) trabaja en modo acotado: la memoria solo guarda
+        // una cache de registros de ese tamano e indices compactos (requiere LevelDB).
+        // Con 'instantanea' la memoria se carga de ese archivo (mas los cambios de LevelDB
+        // posteriores) y se vuelve a escribir al destruir el sistema
+        SistemaPacientes(const string& rutaBD = "./leveldb_data", size_t numFragmentos = 0,
+                         size_t capacidadCache = 0, const string& instantanea = "")
+            : leveldb(rutaBD), borradosSinReconstruir(0), registrosAlConstruirArbol(0),
+              rutaInstantanea(instantanea),
+              diario(!instantanea.empty() && capacidadCache == 0 && leveldb.isConnected()),
+              verificarAltasEnBD(false), cambiosEnDistribucion(0) {
+            if (capacidadCache > 0 && leveldb.isConnected()) {
+                acotado = make_unique<AlmacenAcotado>(leveldb, capacidadCache);
+                registro().info("sistema", "Modo acotado: cache de registros de " +
+                                           to_string(capacidadCache >> 20) + " MB sobre LevelDB.");
+            } else if (capacidadCache > 0) {
+                registro().advertencia("sistema", "El modo acotado necesita LevelDB; se usa la memoria completa.");
+            } else if (numFragmentos > 0) {
+                fragmentado = make_unique<AlmacenFragmentado>(numFragmentos, thread::hardware_concurrency());
+                registro().info("sistema", "Modo fragmentado: " + to_string(numFragmentos) + " fragmentos en memoria.");
+            }
+            if (!leveldb.isConnected()) {
+                registro().advertencia("sistema", "No se pudo inicializar LevelDB. Los datos no se persistiran.");
+            } else {
+                leveldb.configurarRegistroCambios(!rutaInstantanea.empty() && !acotado);
+                cargarDesdeBaseDeDatos();
+            }
+        }
+
+        // Destructor - guarda la instantanea de la memoria si esta configurada y deja la
+        // marca de cierre ordenado de los agregados
+        ~SistemaPacientes() {
+            if (!rutaInstantanea.empty() && !acotado && leveldb.isConnected()) {
+                guardarInstantanea();
+            }
+            if (leveldb.isConnected()) marcarCierreAgregados();
+        }
+        
+        // Metodos necesarios para el MenuPrincipal
+        
+        // Verifica si la base de datos esta conectada
+        bool isDBConnected() const {
+            return leveldb.isConnected();
+        }
+        
+        // Obtiene la cantidad de pacientes en LevelDB
+        long getCantidadLevelDB() const {
+            return leveldb.isConnected() ? leveldb.contarPacientes() : 0;
+        }
+        
+        // Carga pacientes desde un archivo de texto con formato compacto
+        // Los duplicados se cuentan y se informan en un resumen al final;
+        // con reportarDuplicados se muestra ademas cada ID omitido
+        bool cargarDesdeArchivoCompacto(const string& nombreArchivo, bool reportarDuplicados = false) {
+            if (!DataPaciente::archivoExiste(nombreArchivo)) {
+                cerr << "Error: El archivo '" << nombreArchivo << "' no existe" << endl;
+                return false;
+            }
+
+            ResumenEventos resumen("Carga de " + nombreArchivo);
+            ResultadoCarga resultado;
+            if (!procesarArchivo(nombreArchivo, 0, false, reportarDuplicados, resultado)) {
+                return false;
+            }
+            resumen.registrar();
+
+            cout << "Cargados " << resultado.cargados << " pacientes desde archivo compacto: " << nombreArchivo << endl;
+            if (resultado.duplicados > 0) {
+                cout << "Omitidos " << resultado.duplicados << " pacientes que ya existian." << endl;
+            }
+            return resultado.cargados > 0;
+        }
+
+        // Carga todos los archivos compactos de un directorio (los ocultos se omiten)
+        // Hasta 'hilos' archivos se leen y parsean en paralelo mientras se insertan los
+        // ya parseados, en orden de nombre y en lotes grandes. Regla de duplicados: gana
+        // la primera aparicion de cada ID en orden de nombre de archivo y de linea, igual
+        // que cargando los archivos uno por uno en ese orden; el resultado no depende de
+        // que hilo termine primero. Deja un punto de control por archivo para las
+        // recargas incrementales. Devuelve los pacientes cargados, o -1 si hubo error
+        long cargarDirectorio(const string& directorio, size_t hilos) {
+            vector<string> archivos;
+            error_code error;
+            for (filesystem::directory_iterator it(directorio, error), fin; !error && it != fin; it.increment(error)) {
+                if (it->is_regular_file(error) && it->path().filename().string()[0] != '.') {
+                    archivos.push_back(it->path().string());
+                }
+            }
+            if (error) {
+                cerr << "Error al leer el directorio '" << directorio << "': " << error.message() << endl;
+                return -1;
+            }
+            if (archivos.empty()) {
+                cout << "No hay archivos en el directorio " << directorio << endl;
+                return 0;
+            }
+            sort(archivos.begin(), archivos.end());
+
+            ResumenEventos resumen("Carga de directorio " + directorio);
+            auto inicio = chrono::steady_clock::now();
+            PoolHilos pool(hilos);
+            vector<future<ArchivoParseado>> parseados(archivos.size());
+            size_t encolados = 0;
+            auto encolarSiguiente = [&]() {
+                if (encolados == archivos.size()) return;
+                const string* nombre = &archivos[encolados];
+                parseados[encolados++] = pool.encolar([this, nombre]() { return parsearArchivo(*nombre); });
+            };
+            // Como mucho 'hilos' archivos parseados esperan su turno: acota la memoria
+            for (size_t i = 0; i < pool.getNumHilos(); ++i) encolarSiguiente();
+
+            size_t cargados = 0;
+            size_t duplicados = 0;
+            size_t invalidas = 0;
+            uint64_t bytes = 0;
+            for (size_t i = 0; i < archivos.size(); ++i) {
+                ArchivoParseado archivo = parseados[i].get();
+                encolarSiguiente();
+                if (!archivo.abierto) {
+                    cerr << "Error al abrir archivo: " << archivos[i] << endl;
+                    continue;
+                }
+                auto inicioArchivo = chrono::steady_clock::now();
+                size_t cargadosArchivo = 0;
+                size_t duplicadosArchivo = 0;
+                for (size_t desde = 0; desde < archivo.pacientes.size(); desde += TAMANO_LOTE_DIRECTORIO) {
+                    size_t hasta = min(desde + TAMANO_LOTE_DIRECTORIO, archivo.pacientes.size());
+                    vector<DataPaciente> lote(make_move_iterator(archivo.pacientes.begin() + desde),
+                                              make_move_iterator(archivo.pacientes.begin() + hasta));
+                    cargadosArchivo += agregarPacientes(lote, &duplicadosArchivo);
+                }
+                guardarPuntoControl(archivos[i], archivo.punto);
+
+                cargados += cargadosArchivo;
+                duplicados += duplicadosArchivo;
+                invalidas += archivo.invalidas;
+                bytes += archivo.bytes;
+                double segundosArchivo = chrono::duration<double>(chrono::steady_clock::now() - inicioArchivo).count();
+                cout << "[" << i + 1 << "/" << archivos.size() << "] " << archivos[i] << ": " << cargadosArchivo
+                     << " cargados, " << duplicadosArchivo << " duplicados, " << archivo.invalidas
+                     << " lineas no validas (" << segundosArchivo << " s)" << endl;
+            }
+            resumen.registrar();
+
+            double segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            cout << "Directorio " << directorio << ": " << cargados << " pacientes cargados de " << archivos.size()
+                 << " archivos (" << duplicados << " duplicados, " << invalidas << " lineas no validas) en "
+                 << segundos << " s" << endl;
+            if (segundos > 0) {
+                cout << "Rendimiento: " << (uint64_t) (cargados / segundos) << " pacientes/s, "
+                     << bytes / segundos / (1 << 20) << " MB/s" << endl;
+            }
+            return (long) cargados;
+        }
+
+        // Carga solo las lineas agregadas al final del archivo desde la ultima lectura
+        // Usa el punto de control del archivo (inodo, tamano, desplazamiento y hash de
+        // la ultima linea); si el archivo fue reemplazado o truncado lo lee completo.
+        // Las lineas incompletas al final quedan pendientes para la siguiente recarga.
+        // Devuelve la cantidad de pacientes cargados, o -1 si hubo error
+        long recargarIncremental(const string& nombreArchivo, bool mostrarResumen = true) {
+            struct stat info;
+            if (stat(nombreArchivo.c_str(), &info) != 0) {
+                cerr << "Error: El archivo '" << nombreArchivo << "' no existe" << endl;
+                return -1;
+            }
+
+            off_t desde = 0;
+            optional<PuntoControlArchivo> punto;
+            {
+                BloqueoLectura bloqueo(cerrojo);
+                auto it = puntosControl.find(nombreArchivo);
+                if (it != puntosControl.end()) punto = it->second;
+            }
+            if (punto) {
+                if (puntoControlValido(nombreArchivo, *punto, info)) {
+                    desde = punto->desplazamiento;
+                } else if (mostrarResumen) {
+                    cout << "El archivo cambio desde la ultima carga; se procesara completo." << endl;
+                }
+            }
+
+            // Sin bytes nuevos no hay nada que leer
+            if (desde == info.st_size) {
+                if (mostrarResumen) cout << "No hay lineas nuevas en " << nombreArchivo << endl;
+                return 0;
+            }
+
+            ResumenEventos resumen("Recarga de " + nombreArchivo);
+            ResultadoCarga resultado;
+            if (!procesarArchivo(nombreArchivo, desde, true, false, resultado)) {
+                return -1;
+            }
+            if (mostrarResumen || resultado.cargados > 0) resumen.registrar();
+
+            if (mostrarResumen || resultado.cargados > 0) {
+                cout << "Recarga incremental de " << nombreArchivo << ": " << resultado.cargados
+                     << " pacientes nuevos, " << resultado.duplicados << " duplicados, "
+                     << (resultado.desplazamientoFinal - desde) << " bytes leidos." << endl;
+            }
+            return resultado.cargados;
+        }
+
+        // Sigue un archivo en crecimiento (modo tail) cargando las lineas nuevas
+        // cada intervaloMs milisegundos hasta que 'detener' sea verdadero
+        void seguirArchivo(const string& nombreArchivo, const atomic<bool>& detener, int intervaloMs = 500) {
+            while (!detener.load()) {
+                recargarIncremental(nombreArchivo, false);
+                // Espera en pasos cortos para responder rapido a la senal de detener
+                for (int esperado = 0; esperado < intervaloMs && !detener.load(); esperado += 50) {
+                    this_thread::sleep_for(chrono::milliseconds(50));
+                }
+            }
+        }
+        
+        // Verifica si un paciente existe por su ID
+        bool existePaciente(const string& id) const {
+            if (fragmentado) {
+                return fragmentado->consultarFragmento(id, [&id](const PacienteContainer& pacientes) {
+                    return pacientes.get<0>().count(id) > 0;
+                });
+            }
+            BloqueoLectura bloqueo(cerrojo);
+            if (acotado) return acotado->existe(id);
+            return existeSinBloqueo(id);
+        }
+        
+        // Agrega un nuevo paciente al sistema (memoria y persistencia)
+        // Devuelve false si el ID ya existia o si no se pudo guardar en LevelDB
+        bool agregarPaciente(const DataPaciente& paciente, bool reportarDuplicado = true) {
+            TemporizadorOperacion medicion(OperacionMedida::ALTA);
+            OperacionDiario operacion(diario, {paciente.getPatientID()});
+            bool insertado = false;
+            bool escrito = true;
+            // El paciente y la celda de agregados que cambio se escriben en un mismo lote,
+            // antes de soltar el cerrojo (ver persistirAltas)
+            if (fragmentado) {
+                // Solo se bloquea el fragmento dueno del ID
+                insertado = fragmentado->insertar(PacienteData(paciente), [&](const PacienteData& nuevo) {
+                    escrito = persistirAltas({&nuevo});
+                });
+            } else if (acotado) {
+                // Los indices compactos cubren toda la base: detectan tambien los IDs ya guardados
+                PacienteData datos(paciente);
+                BloqueoEscritura bloqueo(cerrojo);
+                insertado = acotado->insertar(datos);
+                if (insertado) {
+                    distribucion.agregar(datos);
+                    escrito = persistirAltas({&datos});
+                }
+            } else {
+                BloqueoEscritura bloqueo(cerrojo);
+                if (!existeSinBloqueo(paciente.getPatientID())) {
+                    // Inserta en el contenedor en memoria
+                    auto resultado = pacientesContainer.insert(PacienteData(paciente));
+                    alInsertar(*resultado.first);
+                    insertado = true;
+                    escrito = persistirAltas({&*resultado.first});
+                }
+            }
+            if (!insertado) {
+                registro().contar(Evento::DUPLICADO_OMITIDO);
+                if (reportarDuplicado) {
+                    cout << "El paciente con ID " << paciente.getPatientID() << " ya existe." << endl;
+                }
+                return false;
+            }
+            
+            estadisticas().contar(ContadorRendimiento::INSERCIONES);
+            if (!operacion.escrito(escrito)) {
+                registro().error("guardado", "El paciente " + paciente.getPatientID() +
+                                 " quedo en memoria pero no se pudo guardar en LevelDB");
+                return false;
+            }
+            if (leveldb.isConnected() && registro().habilitado(NivelLog::DEPURACION)) {
+                registro().depuracion("guardado", "Paciente guardado en LevelDB: " + paciente.getPatientID());
+            }
+            return true;
+        }
+        
+        // Agrega un lote de pacientes tomando el cerrojo de escritura una sola vez
+        // y persiste todos los nuevos en un unico WriteBatch antes de soltarlo (en modo
+        // fragmentado, un lote por fragmento con el cerrojo de ese fragmento).
+        // Devuelve la cantidad agregada; los duplicados se suman en 'duplicados'
+        size_t agregarPacientes(const vector<DataPaciente>& pacientes, size_t* duplicados = nullptr,
+                                bool reportarDuplicados = false) {
+            TemporizadorOperacion medicion(OperacionMedida::ALTA_LOTE);
+            vector<PacienteData> datos(pacientes.begin(), pacientes.end());
+            vector<string> ids;
+            if (diario.estaActivo()) {
+                ids.reserve(datos.size());
+                for (const auto& paciente : datos) ids.push_back(paciente.patientID);
+            }
+            OperacionDiario operacion(diario, move(ids));
+            vector<char> insertados;
+            atomic<bool> escrito(true);
+            if (fragmentado) {
+                // Cada fragmento inserta su parte del lote en paralelo y la escribe
+                insertados = fragmentado->insertarLote(datos, [&](const vector<const PacienteData*>& altas) {
+                    if (!persistirAltas(altas)) escrito = false;
+                });
+            } else if (acotado) {
+                insertados.assign(datos.size(), 0);
+                vector<const PacienteData*> altas;
+                BloqueoEscritura bloqueo(cerrojo);
+                for (size_t i = 0; i < datos.size(); ++i) {
+                    if (!acotado->insertar(datos[i], false)) continue;
+                    distribucion.agregar(datos[i]);
+                    insertados[i] = 1;
+                    altas.push_back(&datos[i]);
+                }
+                escrito = persistirAltas(altas);
+            } else {
+                insertados.assign(datos.size(), 0);
+                vector<const PacienteData*> altas;
+                BloqueoEscritura bloqueo(cerrojo);
+                for (size_t i = 0; i < datos.size(); ++i) {
+                    if (existeSinBloqueo(datos[i].patientID)) continue;
+                    auto resultado = pacientesContainer.insert(datos[i]);
+                    alInsertar(*resultado.first);
+                    insertados[i] = 1;
+                    altas.push_back(&*resultado.first);
+                }
+                escrito = persistirAltas(altas);
+            }
+
+            // Fuera del cerrojo: duplicados y estadisticas
+            size_t agregados = 0;
+            for (size_t i = 0; i < datos.size(); ++i) {
+                if (insertados[i]) {
+                    agregados++;
+                    continue;
+                }
+                if (duplicados) (*duplicados)++;
+                registrarDuplicado(datos[i].patientID, reportarDuplicados);
+            }
+            estadisticas().contar(ContadorRendimiento::INSERCIONES, agregados);
+            if (!operacion.escrito(escrito)) {
+                registro().error("guardado", "Altas de un lote de " + to_string(agregados) +
+                                 " pacientes quedaron en memoria pero no se pudieron guardar en LevelDB");
+            }
+            return agregados;
+        }
+
+        // Actualiza campos de un paciente existente sin borrarlo ni reinsertarlo
+        // Solo se reubican los indices cuyas claves cambian y LevelDB recibe una
+        // unica escritura agrupada con el registro corregido.
+        // Devuelve false si el paciente no existe, no hay cambios, algun texto trae
+        // '|' o un salto de linea, o no se pudo guardar en LevelDB
+        bool actualizarPaciente(const string& id, const ActualizacionPaciente& cambios) {
+            if (cambios.contieneSeparador()) {
+                cerr << "Error: los datos no pueden contener '|' ni saltos de linea." << endl;
+                return false;
+            }
+            TemporizadorOperacion medicion(OperacionMedida::ACTUALIZACION);
+            OperacionDiario operacion(diario, {id});
+            bool escrito = true;
+            if (aplicarParches({Parche{id, cambios}}, escrito) == 0) return false;
+            if (!operacion.escrito(escrito)) {
+                registro().error("guardado", "La actualizacion de " + id +
+                                 " quedo en memoria pero no se pudo guardar en LevelDB");
+                return false;
+            }
+            return true;
+        }
+
+        // Aplica una linea de parche (ID|campo=valor...) a un solo paciente
+        bool aplicarParche(const string& linea) {
+            string id;
+            ActualizacionPaciente cambios;
+            if (!parsearParche(linea, id, cambios)) return false;
+            return actualizarPaciente(id, cambios);
+        }
+
+        // Aplica un archivo de parches con una linea por paciente
+        // Formato: ID|campo=valor|campo=valor...  (campos: nombre, fecha, modalidad, sexo, tamano)
+        // Las lineas se aplican en grupos de TAMANO_LOTE_CARGA, cada grupo con un cerrojo y un lote
+        bool actualizarDesdeArchivo(const string& nombreArchivo) {
+            if (!DataPaciente::archivoExiste(nombreArchivo)) {
+                cerr << "Error: El archivo '" << nombreArchivo << "' no existe" << endl;
+                return false;
+            }
+
+            ifstream archivo(nombreArchivo);
+            if (!archivo.is_open()) {
+                cerr << "Error al abrir archivo: " << nombreArchivo << endl;
+                return false;
+            }
+
+            ResumenEventos resumen("Parches de " + nombreArchivo);
+            OperacionDiario operacion(diario);
+            vector<Parche> parches;
+            string linea;
+            int lineasProcesadas = 0;
+            int actualizados = 0;
+            int omitidos = 0;
+            int sinGuardar = 0;
+
+            // Aplica el grupo leido; los parches sin efecto cuentan como omitidos
+            auto aplicarGrupo = [&]() {
+                bool escrito = true;
+                size_t aplicados = aplicarParches(parches, escrito);
+                if (!operacion.escrito(escrito)) sinGuardar += aplicados;
+                actualizados += aplicados;
+                omitidos += parches.size() - aplicados;
+                parches.clear();
+            };
+
+            while (getline(archivo, linea)) {
+                lineasProcesadas++;
+                if (!linea.empty() && linea.back() == '\r') linea.pop_back();
+                if (linea.empty() || linea[0] == '#') continue;  // Salta lineas vacias o comentarios
+
+                string id;
+                ActualizacionPaciente cambios;
+                if (!parsearParche(linea, id, cambios)) {
+                    registrarLineaInvalida(nombreArchivo, lineasProcesadas, linea);
+                    omitidos++;
+                    continue;
+                }
+
+                operacion.anotar(id);
+                parches.push_back(Parche{id, cambios});
+                if (parches.size() >= TAMANO_LOTE_CARGA) aplicarGrupo();
+            }
+            archivo.close();
+            aplicarGrupo();
+
+            resumen.registrar();
+            cout << "Actualizados " << actualizados << " pacientes (" << omitidos
+                 << " lineas omitidas) desde: " << nombreArchivo << endl;
+            if (sinGuardar > 0) {
+                cerr << "Error: " << sinGuardar << " correcciones quedaron en memoria pero no se pudieron"
+                     << " guardar en LevelDB." << endl;
+                return false;
+            }
+            return actualizados > 0;
+        }
+
+        // Busca pacientes por nombre (busqueda parcial case-insensitive)
+        vector<DataPaciente> buscarPorNombre(const string& nombre) const {
+            TemporizadorOperacion medicion(OperacionMedida::BUSQUEDA_NOMBRE);
+            estadisticas().contar(ContadorRendimiento::CONSULTAS_INDICE);
+            string nombreBusqueda = aMinusculas(nombre);
+            if (acotado) {
+                // Sin indice por nombre en memoria: se recorre LevelDB leyendo solo ese campo
+                vector<PacienteData> encontrados;
+                leveldb.recorrerPorCampo<CampoPaciente::NOMBRE>(nombreBusqueda,
+                    [&encontrados](const leveldb::Slice& clave, const leveldb::Slice& datos) {
+                        PacienteData paciente;
+                        if (LevelDBManager::pacienteDesdeValor(clave.ToString(), string_view(datos.data(), datos.size()),
+                                                               paciente)) {
+                            encontrados.push_back(move(paciente));
+                        }
+                    });
+                {
+                    BloqueoLectura bloqueo(cerrojo);
+                    acotado->numerar(encontrados);
+                }
+                sort(encontrados.begin(), encontrados.end(), ordenNombre);
+                return convertirResultados(encontrados);
+            }
+            auto filtro = [&nombreBusqueda](const PacienteContainer& pacientes) {
+                vector<PacienteData> encontrados;
+                auto& index = pacientes.get<1>();  // Indice por nombre
+                
+                // Recorre todos los pacientes buscando coincidencias parciales
+                for (auto it = index.begin(); it != index.end(); ++it) {
+                    string nombrePaciente = ::aMinusculas(it->patientName);
+                    if (nombrePaciente.find(nombreBusqueda) != string::npos) {
+                        encontrados.push_back(*it);
+                    }
+                }
+                return encontrados;
+            };
+            return buscarConFiltro(filtro, ordenNombre);
+        }
+        
+        // Busca pacientes por ID (busqueda exacta)
+        vector<DataPaciente> buscarPorID(const string& id) const {
+            TemporizadorOperacion medicion(OperacionMedida::BUSQUEDA_ID);
+            estadisticas().contar(ContadorRendimiento::CONSULTAS_INDICE);
+            vector<DataPaciente> resultados;
+            if (fragmentado) {
+                // Busqueda puntual: solo se consulta el fragmento dueno del ID
+                auto encontrado = fragmentado->consultarFragmento(id, [&id](const PacienteContainer& pacientes) {
+                    auto& index = pacientes.get<0>();
+                    auto it = index.find(id);
+                    return it != index.end() ? optional<DataPaciente>(it->toDataPaciente()) : nullopt;
+                });
+                if (encontrado) resultados.push_back(*encontrado);
+                return resultados;
+            }
+
+            BloqueoLectura bloqueo(cerrojo);
+            if (acotado) {
+                PacienteData paciente;
+                if (acotado->obtener(id, paciente)) resultados.push_back(paciente.toDataPaciente());
+                return resultados;
+            }
+            if (pacientesContainer.empty()) return resultados;
+            
+            string idBusqueda = aMinusculas(id);
+            auto& index = pacientesContainer.get<0>();  // Indice por ID
+            
+            auto it = index.find(id);
+            if (it != index.end()) {
+                string idPaciente = aMinusculas(it->patientID);
+                if (idPaciente.find(idBusqueda) != string::npos) {
+                    resultados.push_back(it->toDataPaciente());
+                }
+            }
+            return resultados;
+        }
+        
+        // Busca pacientes por modalidad de estudio
+        vector<DataPaciente> buscarPorModalidad(const string& modalidad) const {
+            TemporizadorOperacion medicion(OperacionMedida::BUSQUEDA_MODALIDAD);
+            estadisticas().contar(ContadorRendimiento::CONSULTAS_INDICE);
+            if (acotado) {
+                vector<PacienteData> encontrados;
+                {
+                    BloqueoLectura bloqueo(cerrojo);
+                    encontrados = acotado->buscarPorModalidad(modalidad);
+                }
+                return convertirResultados(encontrados);
+            }
+            string modalidadBusqueda = aMinusculas(modalidad);
+            auto filtro = [&modalidad, &modalidadBusqueda](const PacienteContainer& pacientes) {
+                vector<PacienteData> encontrados;
+                auto& index = pacientes.get<2>();  // Indice por modalidad
+                
+                // Usa equal_range para obtener todos los pacientes con esa modalidad
+                auto range = index.equal_range(modalidad);
+                
+                for (auto it = range.first; it != range.second; ++it) {
+                    string modalidadPaciente = ::aMinusculas(it->modality);
+                    if (modalidadPaciente.find(modalidadBusqueda) != string::npos) {
+                        encontrados.push_back(*it);
+                    }
+                }
+                return encontrados;
+            };
+            return buscarConFiltro(filtro, ordenInsercion);
+        }
+        
+        // Busca pacientes por sexo
+        vector<DataPaciente> buscarPorSexo(const string& sexo) const {
+            TemporizadorOperacion medicion(OperacionMedida::BUSQUEDA_SEXO);
+            estadisticas().contar(ContadorRendimiento::CONSULTAS_INDICE);
+            if (acotado) {
+                vector<PacienteData> encontrados;
+                {
+                    BloqueoLectura bloqueo(cerrojo);
+                    encontrados = acotado->buscarPorSexo(sexo);
+                }
+                return convertirResultados(encontrados);
+            }
+            string sexoBusqueda = aMinusculas(sexo);
+            auto filtro = [&sexo, &sexoBusqueda](const PacienteContainer& pacientes) {
+                vector<PacienteData> encontrados;
+                auto& index = pacientes.get<3>();  // Indice por sexo
+                
+                auto range = index.equal_range(sexo);
+                
+                for (auto it = range.first; it != range.second; ++it) {
+                    string sexoPaciente = ::aMinusculas(it->sex);
+                    if (sexoPaciente.find(sexoBusqueda) != string::npos) {
+                        encontrados.push_back(*it);
+                    }
+                }
+                return encontrados;
+            };
+            return buscarConFiltro(filtro, ordenInsercion);
+        }
+        
+        // Busqueda exacta por ID (devuelve puntero para modificaciones)
+        DataPaciente* buscarExactoPorID(const string& id) {
+            vector<DataPaciente> encontrado = buscarPorID(id);
+            if (encontrado.empty()) return nullptr;
+            return new DataPaciente(encontrado.front());
+        }
+        
+        // Busqueda directa en LevelDB (para verificacion de persistencia)
+        void buscarEnLevelDB(const string& campo, const string& valor) {
+            if (!leveldb.isConnected()) {
+                cout << "Error: No hay conexion con LevelDB" << endl;
+                return;
+            }
+            
+            if (campo == "_id") {
+                // Busqueda directa por ID (clave primaria)
+                string resultado = leveldb.buscarPacientePorID(valor);
+                cout << "\n=== RESULTADO DE BUSQUEDA EN LEVELDB ===" << endl;
+                PacienteData paciente;
+                if (!resultado.empty() && EsquemaPaciente::parsear(resultado, paciente) >= 0) {
+                    cout << "ID: " << valor << endl;
+                    EsquemaPaciente::paraCadaCampo([&paciente](auto campo) {
+                        typedef DescriptorCampo<decltype(campo)::value> Descriptor;
+                        cout << Descriptor::etiqueta << ": " << EsquemaPaciente::valor<decltype(campo)::value>(paciente)
+                             << Descriptor::sufijo << endl;
+                    });
+                } else if (resultado.empty()) {
+                    cout << "No se encontro el paciente con ID: " << valor << endl;
+                } else {
+                    cout << "El valor guardado para el ID " << valor << " no se puede leer: " << resultado << endl;
+                }
+                return;
+            }
+            
+            // Busqueda por campos secundarios (requiere escaneo completo)
+            vector<string> resultados;
+            if (!consultarLevelDB(campo, valor, resultados)) {
+                cout << "Campo de busqueda no valido" << endl;
+                return;
+            }
+            cout << "\n=== RESULTADOS DE BUSQUEDA EN LEVELDB ===" << endl;
+            if (resultados.empty()) {
+                cout << "No se encontraron resultados en LevelDB" << endl;
+                return;
+            }
+
+            // Los resultados se formatean en bloque en lugar de escribirse linea a linea
+            SalidaResultados salida(cout, FormatoSalida::TABLA);
+            for (const auto& resultado : resultados) {
+                size_t separador = resultado.find('|');
+                PacienteData paciente;
+                if (LevelDBManager::pacienteDesdeValor(resultado.substr(0, separador),
+                                                       string_view(resultado).substr(separador + 1), paciente)) {
+                    salida.escribir(paciente);
+                }
+            }
+        }
+
+        // Escribe todos los pacientes de LevelDB en el formato indicado
+        // Devuelve la cantidad escrita
+        size_t volcarLevelDB(FormatoSalida formato, ostream& destino) const {
+            SalidaResultados salida(destino, formato);
+            leveldb.recorrerRango(nullptr, nullptr, [&salida](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                PacienteData paciente;
+                if (LevelDBManager::pacienteDesdeValor(clave.ToString(), string_view(valor.data(), valor.size()), paciente)) {
+                    salida.escribir(paciente);
+                }
+            });
+            salida.terminar();
+            return salida.getEscritos();
+        }
+
+        // Busqueda en LevelDB sin salida por consola (modo por lotes)
+        // Cada resultado tiene el formato compacto ID|Nombre|Fecha|Modalidad|Sexo|Tamano.
+        // El campo (nombre, modalidad o sexo) se resuelve una vez y elige el recorrido
+        // especializado para ese campo. Devuelve false si no hay conexion o el campo no es valido
+        bool consultarLevelDB(const string& campo, const string& valor, vector<string>& resultados) {
+            if (!leveldb.isConnected()) return false;
+
+            if (campo == "_id") {
+                string encontrado = leveldb.buscarPacientePorID(valor);
+                if (!encontrado.empty()) resultados.push_back(valor + "|" + encontrado);
+                return true;
+            }
+
+            string valorBusqueda = aMinusculas(valor);
+            return EsquemaPaciente::conCampoBuscable(campo, [&](auto campoBuscado) {
+                leveldb.recorrerPorCampo<decltype(campoBuscado)::value>(valorBusqueda,
+                    [&resultados](const leveldb::Slice& clave, const leveldb::Slice& datos) {
+                        string resultado;
+                        resultado.reserve(clave.size() + 1 + datos.size());
+                        resultado.append(clave.data(), clave.size());
+                        resultado += '|';
+                        resultado.append(datos.data(), datos.size());
+                        resultados.push_back(move(resultado));
+                    });
+            });
+        }
+        
+        // Muestra todos los pacientes en memoria en el formato indicado
+        void mostrarTodos(FormatoSalida formato = FormatoSalida::TABLA, ostream& destino = cout) const {
+            mostrarRango(0, SIZE_MAX, formato, destino);
+        }
+
+        // Muestra 'cantidad' pacientes a partir de la posicion 'desde' (orden de insercion)
+        // El indice de acceso aleatorio permite saltar directamente a la posicion inicial.
+        // Los pacientes se copian bajo el cerrojo por tramos y se escriben sin el, para
+        // que una consola o tuberia lenta no detenga a los escritores. Los avisos (sin
+        // pacientes, posicion fuera de rango) van a cerr para no mezclarse con 'destino'
+        void mostrarRango(size_t desde, size_t cantidad, FormatoSalida formato = FormatoSalida::TABLA,
+                          ostream& destino = cout) const {
+            if (fragmentado) {
+                mostrarRangoFragmentado(desde, cantidad, formato, destino);
+                return;
+            }
+            vector<PacienteData> tramo;
+            CursorTramos cursor{desde};
+            size_t total = copiarTramo(cursor, min(cantidad, TRAMO_MOSTRAR), tramo);
+            if (total == 0) {
+                cerr << "No hay pacientes registrados." << endl;
+                return;
+            }
+            if (desde >= total) {
+                cerr << "Posicion fuera de rango." << endl;
+                return;
+            }
+
+            SalidaResultados salida(destino, formato, desde + 1);
+            size_t restantes = cantidad;
+            while (!tramo.empty()) {
+                for (const auto& paciente : tramo) salida.escribir(paciente);
+                restantes -= tramo.size();
+                if (restantes == 0) break;
+                copiarTramo(cursor, min(restantes, TRAMO_MOSTRAR), tramo);
+            }
+        }
+
+        // Obtiene el paciente en una posicion del orden de insercion (acceso O(1))
+        // Devuelve nullopt si la posicion no existe
+        optional<DataPaciente> obtenerPorPosicion(size_t indice) const {
+            if (fragmentado) {
+                // Sin indice global de posiciones: se mezclan los fragmentos por secuencia
+                vector<PacienteData> todos = todosEnOrdenInsercion();
+                if (indice >= todos.size()) return nullopt;
+                return todos[indice].toDataPaciente();
+            }
+            BloqueoLectura bloqueo(cerrojo);
+            if (acotado) {
+                optional<DataPaciente> encontrado;
+                acotado->recorrerPosiciones(indice, 1, [&encontrado](const PacienteData& paciente) {
+                    encontrado = paciente.toDataPaciente();
+                });
+                return encontrado;
+            }
+            auto& index = pacientesContainer.get<4>();
+            if (indice >= index.size()) return nullopt;
+            return index[indice].toDataPaciente();
+        }
+        
+        // Verifica sincronizacion entre memoria y base de datos
+        // Compara los arboles de hashes por rango de IDs; con reparar=true corrige
+        // las diferencias encontradas. Devuelve el resultado de la reconciliacion
+        ResultadoReconciliacion sincronizarConBaseDeDatos(bool reparar = false) {
+            ResultadoReconciliacion resultado;
+            if (!leveldb.isConnected()) {
+                cout << "No hay conexion a la base de datos para sincronizar." << endl;
+                return resultado;
+            }
+            if (!disponibleSinFragmentos("La sincronizacion")) return resultado;
+            if (acotado) {
+                cout << "La sincronizacion no aplica en modo acotado: LevelDB es la unica copia de los pacientes." << endl;
+                return resultado;
+            }
+
+            BloqueoEscritura bloqueo(cerrojo);
+            resultado = reconciliar(reparar);
+
+            cout << "Sincronizacion:" << endl;
+            cout << "- Pacientes en memoria (Boost Multi-Index): " << pacientesContainer.size() << endl;
+            cout << "- Rangos de IDs: " << arbol.getHojasUsadas()
+                 << " (recalculados en LevelDB: " << resultado.rangosRecalculados
+                 << ", con diferencias: " << resultado.rangosDistintos << ")" << endl;
+
+            if (resultado.sincronizado()) {
+                cout << "Los datos estan sincronizados." << endl;
+                return resultado;
+            }
+
+            // Lista de IDs divergentes (limitada para no inundar la consola)
+            const size_t LIMITE_LISTADO = 20;
+            auto listar = [&](const char* titulo, const vector<string>& ids) {
+                if (ids.empty()) return;
+                cout << "- " << titulo << ": " << ids.size() << endl;
+                for (size_t i = 0; i < ids.size() && i < LIMITE_LISTADO; ++i) {
+                    cout << "    " << ids[i] << endl;
+                }
+                if (ids.size() > LIMITE_LISTADO) cout << "    ..." << endl;
+            };
+            listar("Solo en memoria", resultado.soloMemoria);
+            listar("Solo en LevelDB", resultado.soloBaseDatos);
+            listar("Con datos distintos", resultado.distintos);
+
+            if (reparar) {
+                cout << "Diferencias reparadas: memoria escrita en LevelDB y pacientes de LevelDB cargados en memoria." << endl;
+            }
+            return resultado;
+        }
+        
+        // Muestra y reinicia las estadisticas de contencion del cerrojo de datos
+        void mostrarEstadisticasCerrojo() const {
+            if (fragmentado) fragmentado->mostrarEstadisticas();
+            else cerrojo.mostrarEstadisticas();
+        }
+
+        void reiniciarEstadisticasCerrojo() {
+            if (fragmentado) fragmentado->reiniciarEstadisticas();
+            else cerrojo.reiniciarEstadisticas();
+        }
+
+        // Indica si la memoria esta repartida en fragmentos
+        bool esFragmentado() const {
+            return fragmentado != nullptr;
+        }
+
+        // Indica si la memoria solo guarda una cache sobre LevelDB
+        bool esAcotado() const {
+            return acotado != nullptr;
+        }
+
+        // Obtiene cantidad de pacientes en memoria (en modo acotado, los de LevelDB)
+        size_t getCantidadPacientes() const {
+            if (fragmentado) return fragmentado->tamano();
+            BloqueoLectura bloqueo(cerrojo);
+            if (acotado) return acotado->tamano();
+            return pacientesContainer.size();
+        }
+        
+        // Calcula el peso total de archivos en memoria
+        // En modo acotado lo toma de los agregados de LevelDB, sin leer pacientes
+        long long pesoEnMemoria() const {
+            if (acotado) {
+                vector<FilaAgregado> total = tablaAgregados.agrupar(AgrupacionAgregados());
+                return total.empty() ? 0 : total.front().total.suma;
+            }
+            auto sumarPesos = [](const PacienteContainer& pacientes) {
+                long long peso = 0;
+                for (const auto& paciente : pacientes) {
+                    peso += paciente.tamanoArchivo;
+                }
+                return peso;
+            };
+            if (fragmentado) {
+                long long peso = 0;
+                for (long long parcial : fragmentado->repartir(sumarPesos)) peso += parcial;
+                return peso;
+            }
+            BloqueoLectura bloqueo(cerrojo);
+            return sumarPesos(pacientesContainer);
+        }
+        
+        // Memoria real de los contenedores (por indice y por campo) y de LevelDB
+        UsoMemoria usoMemoria() const {
+            UsoMemoria uso;
+            if (fragmentado) {
+                auto parciales = fragmentado->repartir([](const PacienteContainer& pacientes) {
+                    UsoMemoria parcial;
+                    parcial.sumarCadenas(pacientes);
+                    return parcial;
+                });
+                for (const auto& parcial : parciales) uso.combinarCadenas(parcial);
+            } else if (acotado) {
+                BloqueoLectura bloqueo(cerrojo);
+                uso.pacientes = acotado->tamano();
+                uso.cacheRegistros = acotado->getCache().bytesUsados();
+                uso.capacidadRegistros = acotado->getCache().getCapacidad();
+                uso.indicesCompactos = acotado->bytesIndices();
+            } else {
+                BloqueoLectura bloqueo(cerrojo);
+                uso.sumarCadenas(pacientesContainer);
+            }
+            uso.nodos = ContabilidadMemoria::nodos.load();
+            uso.bytesNodos = ContabilidadMemoria::bytesNodos.load();
+            uso.bytesArreglos = ContabilidadMemoria::bytesArreglos.load();
+            uso.tamanoNodo = ContabilidadMemoria::tamanoNodo.load();
+            leveldb.usoMemoria(uso.cacheBloques, uso.capacidadCache, uso.memtables);
+            return uso;
+        }
+
+        // Cantidad, suma, minimo y maximo de tamanoArchivo de los pacientes en LevelDB,
+        // agrupados por las dimensiones indicadas (sin recorrer pacientes)
+        vector<FilaAgregado> reporteAgregados(const AgrupacionAgregados& agrupacion) const {
+            return tablaAgregados.agrupar(agrupacion);
+        }
+
+        // Distribucion aproximada de tamanos por modalidad de los pacientes en memoria
+        // En modo fragmentado combina los sketches de cada fragmento. Si hubo muchos
+        // borrados o cambios desde la ultima reconstruccion, primero la reconstruye
+        DistribucionTamanos distribucionTamanos() {
+            uint64_t umbral = max<uint64_t>(MINIMO_CAMBIOS_RECONSTRUCCION, getCantidadPacientes() / 10);
+            if (cambiosEnDistribucion.load() > umbral) reconstruirDistribucion();
+
+            if (fragmentado) return fragmentado->distribucionCombinada();
+            BloqueoLectura bloqueo(cerrojo);
+            return distribucion;
+        }
+
+        // Vuelve a resumir los pacientes en memoria, descartando borrados y valores viejos
+        // En modo acotado los resume recorriendo LevelDB
+        void reconstruirDistribucion() {
+            cambiosEnDistribucion = 0;  // Los cambios durante la reconstruccion cuentan para la proxima
+            if (fragmentado) {
+                fragmentado->reconstruirDistribuciones();
+                return;
+            }
+            BloqueoEscritura bloqueo(cerrojo);
+            if (acotado) {
+                distribucion.limpiar();
+                leveldb.recorrerRango(nullptr, nullptr, [this](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                    PacienteData paciente;
+                    if (LevelDBManager::pacienteDesdeValor(clave.ToString(), string_view(valor.data(), valor.size()), paciente)) {
+                        distribucion.agregar(paciente);
+                    }
+                });
+                return;
+            }
+            distribucion.reconstruir(pacientesContainer);
+        }
+
+        // Recalcula los agregados desde LevelDB (corrige los extremos aproximados)
+        void recalcularAgregados() {
+            BloqueoEscritura bloqueo(cerrojo);
+            reconstruirAgregados();
+        }
+
+        // Elimina un paciente por ID
+        bool borrarPaciente(const string& id) {
+            TemporizadorOperacion medicion(OperacionMedida::BAJA);
+            OperacionDiario operacion(diario, {id});
+            if (fragmentado) {
+                // LevelDB se actualiza con el cerrojo del fragmento tomado, en orden con la memoria
+                bool escrito = true;
+                bool borrado = fragmentado->modificarFragmento(id, [this, &id, &escrito](PacienteContainer& pacientes) {
+                    auto& index = pacientes.get<0>();
+                    auto it = index.find(id);
+                    if (it == index.end()) return false;
+                    tablaAgregados.restar(*it);
+                    index.erase(it);
+                    escrito = eliminarDeBaseDatos({id});
+                    return true;
+                });
+                if (borrado) {
+                    cambiosEnDistribucion++;
+                    estadisticas().contar(ContadorRendimiento::ELIMINACIONES);
+                    operacion.escrito(escrito);
+                }
+                return borrado;
+            }
+            BloqueoEscritura bloqueo(cerrojo);
+            if (acotado) {
+                if (!quitarDeAcotado(id)) return false;
+                estadisticas().contar(ContadorRendimiento::ELIMINACIONES);
+                operacion.escrito(eliminarDeBaseDatos({id}));
+                return true;
+            }
+            auto& index = pacientesContainer.get<0>();
+            auto it = index.find(id);
+            if (it != index.end()) {
+                alEliminar(*it);
+                tablaAgregados.restar(*it);
+                index.erase(it);
+                registrarBorradosEnFiltro(1);
+                estadisticas().contar(ContadorRendimiento::ELIMINACIONES);
+                operacion.escrito(eliminarDeBaseDatos({id}));
+                return true;
+            }
+            return false;
+        }
+        
+        // Metodo de compatibilidad para borrado por indice secuencial
+        bool borrarPaciente(size_t indice) {
+            if (acotado) return borrarPacientesPorPosicion({indice}) == 1;
+            if (!disponibleSinFragmentos("El borrado por posicion")) return false;
+            TemporizadorOperacion medicion(OperacionMedida::BAJA);
+            BloqueoEscritura bloqueo(cerrojo);
+            auto& index = pacientesContainer.get<4>();
+            if (indice < index.size()) {
+                auto it = index.begin() + indice;  // Acceso directo, sin recorrer la lista
+                string id = it->patientID;
+                OperacionDiario operacion(diario, {id});
+                alEliminar(*it);
+                tablaAgregados.restar(*it);
+                index.erase(it);
+                registrarBorradosEnFiltro(1);
+                estadisticas().contar(ContadorRendimiento::ELIMINACIONES);
+                operacion.escrito(eliminarDeBaseDatos({id}));
+                return true;
+            }
+            return false;
+        }
+
+        // Elimina varios pacientes por posicion en una sola operacion
+        // Las posiciones se interpretan sobre el orden previo al borrado.
+        // Costo: O(k log k) para ordenar y resolver las k posiciones, mas O(n) para compactar
+        // el indice (una pasada de remove_if; con k <= UMBRAL_BORRADO_INDIVIDUAL, un
+        // desplazamiento por borrado). En total O(n + k log k), no O(k log n).
+        // Devuelve la cantidad de pacientes eliminados
+        size_t borrarPacientesPorPosicion(const vector<size_t>& posiciones) {
+            if (!disponibleSinFragmentos("El borrado por posicion")) return 0;
+            TemporizadorOperacion medicion(OperacionMedida::BAJA_MASIVA);
+            BloqueoEscritura bloqueo(cerrojo);
+            if (acotado) {
+                // Las posiciones se resuelven todas antes de quitar el primero
+                vector<string> ids = acotado->idsEnPosiciones(posiciones);
+                for (const auto& id : ids) quitarDeAcotado(id);
+                estadisticas().contar(ContadorRendimiento::ELIMINACIONES, ids.size());
+                eliminarDeBaseDatos(ids);
+                return ids.size();
+            }
+            auto& index = pacientesContainer.get<4>();
+
+            // Descarta posiciones invalidas y repetidas
+            vector<size_t> validas;
+            for (size_t p : posiciones) {
+                if (p < index.size()) validas.push_back(p);
+            }
+            sort(validas.begin(), validas.end());
+            validas.erase(unique(validas.begin(), validas.end()), validas.end());
+            if (validas.empty()) return 0;
+
+            // Resuelve cada posicion en O(1) antes de modificar el contenedor
+            vector<string> ids;
+            ids.reserve(validas.size());
+            for (size_t p : validas) {
+                ids.push_back(index[p].patientID);
+                alEliminar(index[p]);
+                tablaAgregados.restar(index[p]);
+            }
+            OperacionDiario operacion(diario, diario.estaActivo() ? ids : vector<string>());
+
+            if (validas.size() <= UMBRAL_BORRADO_INDIVIDUAL) {
+                // Pocos elementos: borra de atras hacia adelante para no invalidar posiciones
+                for (auto p = validas.rbegin(); p != validas.rend(); ++p) {
+                    index.erase(index.begin() + *p);
+                }
+            } else {
+                // Muchos elementos: marca los nodos y compacta el indice en una sola pasada,
+                // evitando desplazar el arreglo de punteros una vez por cada borrado
+                unordered_set<const PacienteData*> marcados;
+                marcados.reserve(validas.size());
+                for (size_t p : validas) {
+                    marcados.insert(&index[p]);
+                }
+                index.remove_if([&marcados](const PacienteData& paciente) {
+                    return marcados.count(&paciente) > 0;
+                });
+            }
+            registrarBorradosEnFiltro(ids.size());
+            estadisticas().contar(ContadorRendimiento::ELIMINACIONES, ids.size());
+            operacion.escrito(eliminarDeBaseDatos(ids));
+            return ids.size();
+        }
+        
+        // Elimina de memoria y de LevelDB los pacientes que cumplen un criterio
+        // En memoria recorre el rango del indice mas selectivo (modalidad o fecha)
+        // y borra lo encontrado compactando una sola vez. Devuelve la cantidad borrada de memoria
+        size_t borrarPorCriterio(const CriterioBorrado& criterio) {
+            if (criterio.vacio()) {
+                cout << "Debe indicar al menos una condicion de borrado." << endl;
+                return 0;
+            }
+            if (!disponibleSinFragmentos("El borrado por criterio")) return 0;
+
+            // La purga completa (memoria y LevelDB) corre con el cerrojo de escritura
+            ResumenEventos resumen("Borrado por criterio");
+            TemporizadorOperacion medicion(OperacionMedida::BAJA_MASIVA);
+            OperacionDiario operacion(diario);
+            BloqueoEscritura bloqueo(cerrojo);
+            if (acotado) {
+                // Un solo recorrido de LevelDB; cada borrado sale tambien de los indices y la cache
+                vector<string> fallidos;
+                long borradosBD = leveldb.eliminarPorCriterio(criterio, [this](const PacienteData& paciente) {
+                    acotado->quitar(paciente.patientID);
+                    tablaAgregados.restar(paciente);
+                    cambiosEnDistribucion++;
+                }, &fallidos);
+                persistirAgregados();
+                estadisticas().contar(ContadorRendimiento::ELIMINACIONES, borradosBD);
+                resumen.registrar();
+                cout << "Borrado por criterio: " << borradosBD << " en LevelDB." << endl;
+                informarBorradosFallidos(fallidos);
+                return borradosBD;
+            }
+            size_t borrados = 0;
+            if (criterio.modality) {
+                // Rango del indice por modalidad
+                auto& index = pacientesContainer.get<2>();
+                auto range = index.equal_range(*criterio.modality);
+                borrados = borrarEnRango(index, range.first, range.second, criterio);
+            } else if (criterio.fechaDesde || criterio.fechaHasta) {
+                // Rango del indice por fecha
+                auto& index = pacientesContainer.get<5>();
+                auto desde = criterio.fechaDesde ? index.lower_bound(*criterio.fechaDesde) : index.begin();
+                auto hasta = criterio.fechaHasta ? index.upper_bound(*criterio.fechaHasta) : index.end();
+                borrados = borrarEnRango(index, desde, hasta, criterio);
+            } else {
+                // Solo tamano: no hay indice, se recorre por ID
+                auto& index = pacientesContainer.get<0>();
+                borrados = borrarEnRango(index, index.begin(), index.end(), criterio);
+            }
+            registrarBorradosEnFiltro(borrados);
+            estadisticas().contar(ContadorRendimiento::ELIMINACIONES, borrados);
+
+            // LevelDB puede contener pacientes de sesiones anteriores, por eso se purga por separado
+            long borradosBD = 0;
+            vector<string> fallidos;
+            if (leveldb.isConnected()) {
+                borradosBD = leveldb.eliminarPorCriterio(criterio, [this](const PacienteData& paciente) {
+                    arbol.marcarSucia(paciente.patientID);
+                    tablaAgregados.restar(paciente);
+                }, &fallidos);
+                persistirAgregados();
+            }
+
+            // Los que no se pudieron borrar ya no estan en memoria pero siguen en LevelDB
+            for (const auto& id : fallidos) operacion.anotar(id);
+            operacion.escrito(fallidos.empty());
+
+            resumen.registrar();
+            cout << "Borrado por criterio: " << borrados << " en memoria, "
+                 << borradosBD << " en LevelDB." << endl;
+            informarBorradosFallidos(fallidos);
+            return borrados;
+        }
+
+        // Informa los pacientes que una purga no pudo borrar de LevelDB
+        void informarBorradosFallidos(const vector<string>& fallidos) const {
+            if (fallidos.empty()) return;
+            cerr << "Error: " << fallidos.size() << " pacientes que cumplen el criterio no se pudieron"
+                 << " borrar de LevelDB." << endl;
+        }
+
+        // Elimina todos los pacientes del sistema
+        void borrarTodos() {
+            ResumenEventos resumen("Borrado total");
+            TemporizadorOperacion medicion(OperacionMedida::BAJA_MASIVA);
+            BloqueoEscritura bloqueo(cerrojo);
+            estadisticas().contar(ContadorRendimiento::ELIMINACIONES,
+                                  fragmentado ? fragmentado->tamano() :
+                                  acotado ? acotado->tamano() : pacientesContainer.size());
+            pacientesContainer.clear();
+            if (fragmentado) fragmentado->limpiar();
+            if (acotado) acotado->limpiar();
+            filtroIDs.limpiar();
+            borradosSinReconstruir = 0;
+            arbol.vaciar();  // Memoria y LevelDB quedan vacios y sincronizados
+            puntosControl.clear();  // La memoria quedo vacia, la proxima recarga debe ser completa
+            tablaAgregados.limpiar();  // Las celdas persistidas se borran con el resto de la base
+            verificarAltasEnBD = false;
+            distribucion.limpiar();
+            cambiosEnDistribucion = 0;
+            diario.olvidarDivergentes();  // Memoria y LevelDB quedan vacias
+            if (leveldb.isConnected()) {
+                // Los pacientes que no se pudieron borrar siguen en LevelDB: quedan divergentes
+                OperacionDiario operacion(diario);
+                vector<string> fallidos;
+                bool correcto = leveldb.eliminarTodos(&fallidos);
+                for (const auto& id : fallidos) operacion.anotar(id);
+                if (!operacion.escrito(correcto)) {
+                    resumen.registrar();
+                    cerr << "Error: no se pudieron borrar todos los registros de LevelDB ("
+                         << fallidos.size() << " pacientes siguen guardados)." << endl;
+                    return;
+                }
+            }
+            resumen.registrar();
+            cout << "Todos los registros han sido eliminados." << endl;
+        }
+
+        // Escribe la instantanea de la memoria (al cerrar o a pedido) y recorta el
+        // registro de cambios de LevelDB hasta la secuencia que incluye
+        bool guardarInstantanea() {
+            if (rutaInstantanea.empty()) {
+                cout << "No hay archivo de instantanea configurado." << endl;
+                return false;
+            }
+            if (acotado) {
+                cout << "La instantanea no aplica en modo acotado: la memoria solo tiene una cache." << endl;
+                return false;
+            }
+            if (!leveldb.isConnected()) {
+                cout << "La instantanea necesita LevelDB para saber que cambios aplicar despues." << endl;
+                return false;
+            }
+            auto inicio = chrono::steady_clock::now();
+
+            // La secuencia se lee antes de copiar la memoria: lo registrado despues se vuelve
+            // a aplicar al cargar. Un lote con secuencia anterior que la copia puede no
+            // reflejar es de una operacion del diario abierta al empezar o al terminar la
+            // copia (o fallida): esos IDs se guardan como pendientes y tambien se releen
+            uint64_t secuencia = leveldb.getSecuenciaCambios();
+            set<string> pendientes;
+            diario.juntarPendientes(pendientes);
+            EscritorInstantanea escritor(rutaInstantanea, secuencia);
+            if (fragmentado) {
+                vector<PacienteData> todos;
+                {
+                    // El cerrojo global deja fuera al borrado total, que no pasa por el diario
+                    BloqueoLectura bloqueo(cerrojo);
+                    todos = todosEnOrdenInsercion();
+                }
+                for (size_t i = 0; i < todos.size(); ++i) todos[i].secuencia = i;
+                sort(todos.begin(), todos.end(), [](const PacienteData& a, const PacienteData& b) {
+                    return a.patientID < b.patientID;
+                });
+                for (const auto& paciente : todos) escritor.agregar(paciente, paciente.secuencia);
+            } else {
+                BloqueoLectura bloqueo(cerrojo);
+                const auto& porPosicion = pacientesContainer.get<4>();
+                const auto& porID = pacientesContainer.get<0>();
+                for (auto it = porID.begin(); it != porID.end(); ++it) {
+                    escritor.agregar(*it, pacientesContainer.project<4>(it) - porPosicion.begin());
+                }
+            }
+            diario.juntarPendientes(pendientes);
+            if (!escritor.terminar(pendientes)) {
+                registro().error("instantanea", "No se pudo escribir la instantanea: " + rutaInstantanea);
+                return false;
+            }
+            leveldb.recortarCambios(secuencia);
+
+            double segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            registro().info("instantanea", "Instantanea guardada: " + to_string(escritor.getRegistros()) +
+                                           " pacientes y " + to_string(pendientes.size()) + " IDs pendientes en " +
+                                           rutaInstantanea + " (" + to_string(segundos) + " s).");
+            return true;
+        }
+        
+    private:
+        // Orden de insercion para mezclar resultados de varios fragmentos
+        static bool ordenInsercion(const PacienteData& a, const PacienteData& b) {
+            return a.secuencia < b.secuencia;
+        }
+
+        // Mismo orden que el indice por nombre: nombre y luego orden de insercion
+        static bool ordenNombre(const PacienteData& a, const PacienteData& b) {
+            return a.patientName != b.patientName ? a.patientName < b.patientName : a.secuencia < b.secuencia;
+        }
+
+        // Convierte los resultados de una busqueda al tipo publico
+        static vector<DataPaciente> convertirResultados(const vector<PacienteData>& encontrados) {
+            vector<DataPaciente> resultados;
+            resultados.reserve(encontrados.size());
+            for (const auto& paciente : encontrados) {
+                resultados.push_back(paciente.toDataPaciente());
+            }
+            return resultados;
+        }
+
+        // Ejecuta un filtro sobre el contenedor unico o, en modo fragmentado, sobre todos
+        // los fragmentos en paralelo mezclando los resultados segun 'menor'
+        template <typename Filtro, typename Menor>
+        vector<DataPaciente> buscarConFiltro(Filtro filtro, Menor menor) const {
+            vector<PacienteData> encontrados;
+            if (fragmentado) {
+                encontrados = fragmentado->buscar(filtro, menor);
+            } else {
+                BloqueoLectura bloqueo(cerrojo);
+                encontrados = filtro(pacientesContainer);
+            }
+            return convertirResultados(encontrados);
+        }
+
+        // Todos los pacientes de los fragmentos en orden global de insercion
+        vector<PacienteData> todosEnOrdenInsercion() const {
+            return fragmentado->buscar([](const PacienteContainer& pacientes) {
+                return vector<PacienteData>(pacientes.begin(), pacientes.end());
+            }, ordenInsercion);
+        }
+
+        // Por donde sigue un recorrido por tramos de mostrarRango
+        struct CursorTramos {
+            size_t posicion;                   // Siguiente posicion del orden de insercion
+            size_t numero = SIZE_MAX;          // Modo acotado: su numero de registro, si se conoce
+            uint64_t renumeraciones = 0;       // Modo acotado: validez de 'numero'
+        };
+
+        // Copia bajo el cerrojo hasta 'cantidad' pacientes desde el cursor y lo avanza.
+        // Devuelve la cantidad total de pacientes en ese momento
+        size_t copiarTramo(CursorTramos& cursor, size_t cantidad, vector<PacienteData>& tramo) const {
+            tramo.clear();
+            BloqueoLectura bloqueo(cerrojo);
+            if (acotado) {
+                // Contar posiciones desde el principio en cada tramo seria cuadratico
+                if (cursor.numero == SIZE_MAX || cursor.renumeraciones != acotado->getRenumeraciones()) {
+                    cursor.numero = acotado->numeroDePosicion(cursor.posicion);
+                    cursor.renumeraciones = acotado->getRenumeraciones();
+                }
+                cursor.numero = acotado->recorrerDesdeNumero(cursor.numero, cantidad,
+                    [&tramo](const PacienteData& paciente) { tramo.push_back(paciente); });
+                cursor.posicion += tramo.size();
+                return acotado->tamano();
+            }
+            auto& index = pacientesContainer.get<4>();
+            if (cursor.posicion < index.size()) {
+                size_t desde = cursor.posicion;
+                size_t hasta = (cantidad >= index.size() - desde) ? index.size() : desde + cantidad;
+                tramo.assign(index.begin() + desde, index.begin() + hasta);
+                cursor.posicion = hasta;
+            }
+            return index.size();
+        }
+
+        // Version de mostrarRango para modo fragmentado
+        void mostrarRangoFragmentado(size_t desde, size_t cantidad, FormatoSalida formato,
+                                     ostream& destino) const {
+            vector<PacienteData> todos = todosEnOrdenInsercion();
+            if (todos.empty()) {
+                cerr << "No hay pacientes registrados." << endl;
+                return;
+            }
+            if (desde >= todos.size()) {
+                cerr << "Posicion fuera de rango." << endl;
+                return;
+            }
+
+            size_t hasta = (cantidad >= todos.size() - desde) ? todos.size() : desde + cantidad;
+            SalidaResultados salida(destino, formato, desde + 1);
+            for (size_t i = desde; i < hasta; ++i) {
+                salida.escribir(todos[i]);
+            }
+        }
+
+        // Informa que una operacion necesita el contenedor unico
+        bool disponibleSinFragmentos(const string& operacion) const {
+            if (!fragmentado) return true;
+            cout << operacion << " no esta disponible en modo fragmentado." << endl;
+            return false;
+        }
+
+        // Carga inicial desde base de datos 
+        void cargarDesdeBaseDeDatos() {
+            if (!leveldb.isConnected()) return;
+            long pacientes = 0;
+            if (acotado) {
+                // Un solo recorrido arma los indices compactos y la distribucion de tamanos
+                acotado->cargar([this](const PacienteData& paciente) { distribucion.agregar(paciente); });
+                pacientes = (long) acotado->tamano();
+            } else {
+                pacientes = leveldb.contarPacientes();
+                cargarInstantanea();
+            }
+            registro().info("sistema", "LevelDB conectado. " + to_string(pacientes) +
+                                       " pacientes en la base de datos.");
+
+            // La memoria arranca vacia (o con la instantanea): un alta puede reemplazar a un
+            // paciente ya guardado (en modo acotado los indices cubren toda la base y las
+            // altas repetidas se omiten)
+            size_t enMemoria = fragmentado ? fragmentado->tamano() : pacientesContainer.size();
+            verificarAltasEnBD = pacientes > (long) enMemoria && !acotado;
+            cargarAgregados(pacientes);
+        }
+
+        // Carga la instantanea de la memoria y aplica los cambios de LevelDB posteriores a
+        // ella. Si no sirve (no existe, esta danada o el registro de cambios ya no cubre lo
+        // posterior) la memoria arranca vacia, como sin instantanea. Corre en el constructor,
+        // sin otros hilos
+        void cargarInstantanea() {
+            if (rutaInstantanea.empty() || !DataPaciente::archivoExiste(rutaInstantanea)) return;
+            auto inicio = chrono::steady_clock::now();
+
+            LectorInstantanea lector(rutaInstantanea);
+            if (!lector.valida()) {
+                registro().advertencia("instantanea", "Instantanea descartada (" + lector.getError() + "): " + rutaInstantanea);
+                return;
+            }
+            uint64_t secuencia = lector.getSecuenciaCambios();
+            if (secuencia < leveldb.getBaseCambios() || secuencia > leveldb.getSecuenciaCambios()) {
+                registro().advertencia("instantanea", "La instantanea (secuencia " + to_string(secuencia) +
+                                                      ") no corresponde al registro de cambios de la base; se descarta.");
+                return;
+            }
+            vector<PacienteData> pacientes;
+            if (!lector.leerTodos(pacientes, max(thread::hardware_concurrency(), 1u))) {
+                registro().advertencia("instantanea", "Instantanea descartada (bloque danado): " + rutaInstantanea);
+                return;
+            }
+
+            // Se inserta en el orden de insercion original: asi el indice de acceso
+            // aleatorio y el orden entre claves iguales de los demas indices se conservan
+            sort(pacientes.begin(), pacientes.end(), ordenInsercion);
+            if (fragmentado) {
+                fragmentado->insertarLote(pacientes);
+            } else {
+                for (auto& paciente : pacientes) {
+                    paciente.secuencia = 0;  // Solo se usa en los modos fragmentado y acotado
+                    pacientesContainer.insert(move(paciente));
+                }
+            }
+            size_t cambiados = aplicarCambiosPosteriores(secuencia, lector.getPendientes());
+
+            if (fragmentado) {
+                fragmentado->reconstruirDistribuciones();
+            } else {
+                reconstruirFiltro(max<size_t>(pacientesContainer.size() * 2, 1024));
+                distribucion.reconstruir(pacientesContainer);
+            }
+            double segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            registro().info("instantanea", "Instantanea cargada: " + to_string(pacientes.size()) +
+                                           " pacientes y " + to_string(cambiados) + " IDs releidos de LevelDB en " +
+                                           to_string(segundos) + " s.");
+        }
+
+        // Lleva la memoria al estado de LevelDB para los IDs pendientes de la instantanea
+        // y los cambiados despues de 'secuencia': el costo depende solo de ese atraso.
+        // Cada ID se relee una sola vez aunque haya cambiado varias veces; los nuevos se
+        // agregan en el orden en que aparecieron
+        size_t aplicarCambiosPosteriores(uint64_t secuencia, const vector<string>& pendientes) {
+            vector<string> cambiados;
+            unordered_set<string> vistos;
+            for (const string& id : pendientes) {
+                if (vistos.insert(id).second) cambiados.push_back(id);
+            }
+            leveldb.recorrerCambios(secuencia, [&](uint64_t, string_view ids) {
+                if (ids.empty()) {
+                    // Se borro toda la base: nada de lo anterior sigue vigente
+                    pacientesContainer.clear();
+                    if (fragmentado) fragmentado->limpiar();
+                    cambiados.clear();
+                    vistos.clear();
+                    return;
+                }
+                size_t inicio = 0;
+                while (inicio <= ids.size()) {
+                    size_t fin = min(ids.find('\n', inicio), ids.size());
+                    string id(ids.substr(inicio, fin - inicio));
+                    if (vistos.insert(id).second) cambiados.push_back(move(id));
+                    inicio = fin + 1;
+                }
+            });
+
+            for (const string& id : cambiados) {
+                string valor = leveldb.buscarPacientePorID(id);
+                PacienteData actual;
+                bool existe = !valor.empty() && LevelDBManager::pacienteDesdeValor(id, valor, actual);
+                if (fragmentado) {
+                    bool enMemoria = fragmentado->modificarFragmento(id, [&](PacienteContainer& pacientes) {
+                        auto& index = pacientes.get<0>();
+                        auto it = index.find(id);
+                        if (it == index.end()) return false;
+                        if (existe) {
+                            actual.secuencia = it->secuencia;
+                            index.replace(it, actual);
+                        } else {
+                            index.erase(it);
+                        }
+                        return true;
+                    });
+                    if (!enMemoria && existe) fragmentado->insertar(actual);
+                } else {
+                    auto& index = pacientesContainer.get<0>();
+                    auto it = index.find(id);
+                    if (it != index.end() && existe) index.replace(it, actual);
+                    else if (it != index.end()) index.erase(it);
+                    else if (existe) pacientesContainer.insert(actual);
+                }
+            }
+            return cambiados.size();
+        }
+
+        // Lee las celdas de agregados persistidas. Si no cubren la cantidad de pacientes
+        // de la base (primera ejecucion o una escritura interrumpida) se recalculan. Lo
+        // mismo si la sesion anterior no cerro en orden: una celda puede quedar con la
+        // cantidad correcta y la suma o los extremos de un lote que no llego a escribirse
+        void cargarAgregados(long pacientes) {
+            bool cierreOrdenado = !leveldb.buscarPacientePorID(TablaAgregados::CLAVE_CIERRE).empty();
+            leveldb.recorrerPrefijo(TablaAgregados::PREFIJO, [this](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                tablaAgregados.cargarCelda(clave.ToString(), valor.ToString());
+            });
+            if (tablaAgregados.totalPacientes() != (uint64_t) pacientes) {
+                registro().info("agregados", "Las tablas de agregados no coinciden con la base; se recalculan.");
+                reconstruirAgregados();
+            } else if (!cierreOrdenado && pacientes > 0) {
+                registro().info("agregados", "La sesion anterior no cerro en orden; los agregados se recalculan.");
+                reconstruirAgregados();
+            }
+            // La marca vuelve a escribirse al cerrar (marcarCierreAgregados)
+            leveldb::WriteBatch lote;
+            lote.Delete(TablaAgregados::CLAVE_CIERRE);
+            leveldb.aplicarLote(lote);
+        }
+
+        // Persiste las celdas pendientes y deja la marca de cierre ordenado
+        void marcarCierreAgregados() {
+            persistirAgregados();
+            leveldb::WriteBatch lote;
+            lote.Put(TablaAgregados::CLAVE_CIERRE, "1");
+            leveldb.aplicarLote(lote);
+        }
+
+        // Recalcula las celdas recorriendo LevelDB y reemplaza las persistidas
+        // Pensado para el arranque o el menu, sin altas concurrentes
+        void reconstruirAgregados() {
+            if (!leveldb.isConnected()) return;
+            leveldb::WriteBatch lote;
+            leveldb.recorrerPrefijo(TablaAgregados::PREFIJO, [&lote](const leveldb::Slice& clave, const leveldb::Slice&) {
+                lote.Delete(clave);
+            });
+            tablaAgregados.limpiar();
+            leveldb.recorrerRango(nullptr, nullptr, [this](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                PacienteData paciente;
+                if (LevelDBManager::pacienteDesdeValor(clave.ToString(), string_view(valor.data(), valor.size()), paciente)) {
+                    tablaAgregados.sumar(paciente);
+                }
+            });
+            escribirConAgregados(lote);  // Los Put van despues de los Delete del lote
+        }
+
+        // Cuenta el alta de un paciente en los agregados. Si LevelDB tenia pacientes
+        // previos, el ID nuevo en memoria puede estar ya guardado: se descuenta esa version
+        void registrarAlta(const PacienteData& paciente) {
+            if (verificarAltasEnBD) {
+                string valor = leveldb.buscarPacientePorID(paciente.patientID);
+                PacienteData anterior;
+                if (!valor.empty() && LevelDBManager::pacienteDesdeValor(paciente.patientID, valor, anterior)) {
+                    tablaAgregados.reemplazar(anterior, paciente);
+                    return;
+                }
+            }
+            tablaAgregados.sumar(paciente);
+        }
+
+        // Borra IDs de LevelDB en un lote junto con las celdas de agregados modificadas
+        bool eliminarDeBaseDatos(const vector<string>& ids) {
+            if (!leveldb.isConnected()) return false;
+            leveldb::WriteBatch lote;
+            return tablaAgregados.escribirConPendientes(lote, [this, &ids](leveldb::WriteBatch& conCeldas) {
+                return leveldb.eliminarPacientes(ids, conCeldas);
+            });
+        }
+
+        // Cuenta las altas en los agregados y las escribe en LevelDB en un lote. Se llama
+        // antes de soltar el cerrojo que protegio la insercion, para que LevelDB reciba
+        // los cambios de un mismo ID en el orden en que se hicieron en memoria.
+        // Devuelve false si el lote no se pudo escribir
+        bool persistirAltas(const vector<const PacienteData*>& altas) {
+            if (altas.empty()) return true;
+            leveldb::WriteBatch lote;
+            for (const PacienteData* paciente : altas) {
+                registrarAlta(*paciente);
+                LevelDBManager::agregarAlLote(lote, *paciente);
+            }
+            if (!leveldb.isConnected()) return true;
+            if (!escribirConAgregados(lote)) return false;
+            registro().contar(Evento::GUARDADO_LEVELDB, altas.size());
+            return true;
+        }
+
+        // Escribe las celdas de agregados pendientes en un lote propio
+        void persistirAgregados() {
+            if (!leveldb.isConnected() || !tablaAgregados.hayPendientes()) return;
+            leveldb::WriteBatch lote;
+            escribirConAgregados(lote);
+        }
+
+        // Escribe un lote junto con las celdas de agregados que cambiaron (ver
+        // TablaAgregados::escribirConPendientes)
+        bool escribirConAgregados(leveldb::WriteBatch& lote) {
+            return tablaAgregados.escribirConPendientes(lote, [this](leveldb::WriteBatch& conCeldas) {
+                return leveldb.aplicarLote(conCeldas);
+            });
+        }
+
+        // Procesa el archivo desde el byte 'desde' y actualiza su punto de control
+        // Con soloLineasCompletas no consume una ultima linea sin salto final
+        bool procesarArchivo(const string& nombreArchivo, off_t desde, bool soloLineasCompletas,
+                             bool reportarDuplicados, ResultadoCarga& resultado) {
+            ifstream archivo(nombreArchivo, ios::binary);
+            if (!archivo.is_open()) {
+                cerr << "Error al abrir archivo: " << nombreArchivo << endl;
+                return false;
+            }
+            archivo.seekg(desde);
+
+            string linea;
+            off_t posicion = desde;
+            int lineasProcesadas = 0;
+            PuntoControlArchivo punto = {};
+            bool hayUltimaLinea = false;
+
+            // Las lineas se parsean fuera del cerrojo y se insertan por lotes
+            vector<DataPaciente> pendientes;
+            pendientes.reserve(TAMANO_LOTE_CARGA);
+            auto insertarPendientes = [&]() {
+                size_t duplicados = 0;
+                resultado.cargados += agregarPacientes(pendientes, &duplicados, reportarDuplicados);
+                resultado.duplicados += duplicados;
+                pendientes.clear();
+            };
+
+            // Procesa cada linea del archivo
+            while (getline(archivo, linea)) {
+                bool completa = !archivo.eof();  // getline llego al final sin encontrar '\n'
+                if (!completa && soloLineasCompletas) break;
+
+                lineasProcesadas++;
+                if (completa) {
+                    // El punto de control solo avanza hasta la ultima linea terminada en '\n'
+                    posicion += linea.size() + 1;
+                    punto.hashUltimaLinea = hash64(linea);
+                    punto.longitudUltimaLinea = linea.size();
+                    hayUltimaLinea = true;
+                }
+
+                if (!linea.empty() && linea.back() == '\r') linea.pop_back();
+                if (linea.empty() || linea[0] == '#') continue;  // Salta lineas vacias o comentarios
+
+                DataPaciente paciente;
+                if (paciente.cargarDesdeFormatoCompacto(linea)) {
+                    // agregarPacientes descarta duplicados (filtro + indice primario)
+                    pendientes.push_back(paciente);
+                    if (pendientes.size() >= TAMANO_LOTE_CARGA) insertarPendientes();
+                } else {
+                    registrarLineaInvalida(nombreArchivo, lineasProcesadas, linea);
+                }
+            }
+            if (!pendientes.empty()) insertarPendientes();
+            archivo.close();
+            resultado.desplazamientoFinal = posicion;
+
+            // Guarda el punto de control para la proxima recarga incremental
+            struct stat info;
+            if (stat(nombreArchivo.c_str(), &info) == 0) {
+                BloqueoEscritura bloqueo(cerrojo);
+                auto anterior = puntosControl.find(nombreArchivo);
+                if (!hayUltimaLinea && anterior != puntosControl.end() && desde > 0) {
+                    // No hubo lineas nuevas completas: conserva la ultima linea conocida
+                    punto = anterior->second;
+                }
+                punto.dispositivo = info.st_dev;
+                punto.inodo = info.st_ino;
+                punto.tamano = info.st_size;
+                punto.desplazamiento = posicion;
+                puntosControl[nombreArchivo] = punto;
+            }
+            return true;
+        }
+
+        // Lee y parsea un archivo completo sin insertar nada (corre en cualquier hilo)
+        // El punto de control cubre hasta la ultima linea terminada en '\n'
+        ArchivoParseado parsearArchivo(const string& nombreArchivo) {
+            ArchivoParseado resultado;
+            ifstream archivo(nombreArchivo, ios::binary);
+            if (!archivo.is_open()) return resultado;
+            resultado.abierto = true;
+
+            string linea;
+            int numeroLinea = 0;
+            while (getline(archivo, linea)) {
+                numeroLinea++;
+                bool completa = !archivo.eof();
+                resultado.bytes += linea.size() + (completa ? 1 : 0);
+                if (completa) {
+                    resultado.punto.desplazamiento += linea.size() + 1;
+                    resultado.punto.hashUltimaLinea = hash64(linea);
+                    resultado.punto.longitudUltimaLinea = linea.size();
+                }
+
+                if (!linea.empty() && linea.back() == '\r') linea.pop_back();
+                if (linea.empty() || linea[0] == '#') continue;
+
+                DataPaciente paciente;
+                if (paciente.cargarDesdeFormatoCompacto(linea)) {
+                    resultado.pacientes.push_back(move(paciente));
+                } else {
+                    resultado.invalidas++;
+                    registrarLineaInvalida(nombreArchivo, numeroLinea, linea);
+                }
+            }
+            return resultado;
+        }
+
+        // Guarda el punto de control de un archivo leido completo
+        void guardarPuntoControl(const string& nombreArchivo, PuntoControlArchivo punto) {
+            struct stat info;
+            if (stat(nombreArchivo.c_str(), &info) != 0) return;
+            punto.dispositivo = info.st_dev;
+            punto.inodo = info.st_ino;
+            punto.tamano = info.st_size;
+            BloqueoEscritura bloqueo(cerrojo);
+            puntosControl[nombreArchivo] = punto;
+        }
+
+        // Comprueba que el archivo sigue siendo el mismo y solo crecio por el final
+        bool puntoControlValido(const string& nombreArchivo, const PuntoControlArchivo& punto,
+                                const struct stat& info) const {
+            if (info.st_dev != punto.dispositivo || info.st_ino != punto.inodo) return false;
+            if (info.st_size < punto.desplazamiento) return false;  // Fue truncado
+            if (punto.desplazamiento == 0) return true;
+
+            // Relee la ultima linea procesada y compara su hash
+            off_t inicio = punto.desplazamiento - (off_t) punto.longitudUltimaLinea - 1;
+            if (inicio < 0) return false;
+            ifstream archivo(nombreArchivo, ios::binary);
+            if (!archivo.is_open()) return false;
+            archivo.seekg(inicio);
+            string ultima(punto.longitudUltimaLinea + 1, '\0');
+            if (!archivo.read(&ultima[0], ultima.size())) return false;
+            if (ultima.back() != '\n') return false;
+            ultima.pop_back();
+            return hash64(ultima) == punto.hashUltimaLinea;
+        }
+
+        // Cuenta un duplicado omitido; el mensaje individual solo se arma si el nivel
+        // del registro lo va a escribir (INFO si se pidio reportarlo, si no DEPURACION)
+        void registrarDuplicado(const string& id, bool reportar) {
+            registro().contar(Evento::DUPLICADO_OMITIDO);
+            NivelLog nivel = reportar ? NivelLog::INFO : NivelLog::DEPURACION;
+            if (registro().habilitado(nivel)) {
+                registro().registrar(nivel, "duplicado", "Paciente con ID " + id + " ya existe, omitiendo.");
+            }
+        }
+
+        // Cuenta una linea que no se pudo interpretar y la registra con limite por segundo
+        void registrarLineaInvalida(const string& nombreArchivo, int numeroLinea, const string& linea) {
+            registro().contar(Evento::LINEA_INVALIDA);
+            registro().advertencia("linea_invalida", "Error procesando linea " + to_string(numeroLinea) +
+                                   " de " + nombreArchivo + ": " + linea);
+        }
+
+        // Verifica si un paciente existe (el llamador ya tiene el cerrojo)
+        // El filtro de Bloom responde sin tocar el indice cuando el ID seguro no existe
+        bool existeSinBloqueo(const string& id) const {
+            if (!filtroIDs.puedeContener(id)) return false;
+            auto& index = pacientesContainer.get<0>();  // Indice por ID
+            return index.find(id) != index.end();
+        }
+
+        // Ejecuta la reconciliacion: recalcula las hojas sucias de LevelDB, desciende
+        // por los nodos distintos y compara registro a registro solo esos rangos
+        ResultadoReconciliacion reconciliar(bool reparar) {
+            ResultadoReconciliacion resultado;
+
+            // Los limites se fijan una vez; si la memoria crecio mucho se redistribuyen
+            if (!arbol.estaConstruido() ||
+                pacientesContainer.size() > 4 * registrosAlConstruirArbol + 4 * ArbolReconciliacion::HOJAS_POR_DEFECTO) {
+                construirArbol();
+            }
+
+            for (size_t hoja : arbol.hojasPendientes()) {
+                arbol.fijarHojaBaseDatos(hoja, sumaHojaBaseDatos(hoja));
+                resultado.rangosRecalculados++;
+            }
+
+            vector<size_t> distintas = arbol.hojasDistintas();
+            resultado.rangosDistintos = distintas.size();
+            for (size_t hoja : distintas) {
+                compararHoja(hoja, resultado);
+            }
+
+            if (reparar && !resultado.sincronizado()) {
+                repararDiferencias(resultado);
+                for (size_t hoja : arbol.hojasPendientes()) {
+                    arbol.fijarHojaBaseDatos(hoja, sumaHojaBaseDatos(hoja));
+                }
+            }
+            return resultado;
+        }
+
+        // Elige los limites de las hojas y calcula el lado de memoria
+        // Los limites salen del indice por ID si hay suficientes pacientes en memoria;
+        // si no, de una muestra uniforme de las claves de LevelDB
+        void construirArbol() {
+            const size_t hojas = ArbolReconciliacion::HOJAS_POR_DEFECTO;
+            vector<string> muestra;
+            auto& index = pacientesContainer.get<0>();
+
+            if (index.size() >= hojas) {
+                // El limite k se toma en la posicion k * n / hojas
+                size_t k = 1;
+                size_t i = 0;
+                for (auto it = index.begin(); it != index.end() && k < hojas; ++it, ++i) {
+                    if (i == k * index.size() / hojas) {
+                        muestra.push_back(it->patientID);
+                        k++;
+                    }
+                }
+            } else {
+                // Muestreo en una pasada con memoria acotada: cuando la muestra se llena
+                // se descarta una de cada dos claves y se duplica el paso
+                size_t paso = 1;
+                size_t i = 0;
+                leveldb.recorrerRango(nullptr, nullptr, [&](const leveldb::Slice& clave, const leveldb::Slice&) {
+                    if (i++ % paso != 0) return;
+                    muestra.push_back(clave.ToString());
+                    if (muestra.size() >= 2 * hojas) {
+                        size_t j = 0;
+                        for (size_t k = 0; k < muestra.size(); k += 2) muestra[j++] = muestra[k];
+                        muestra.resize(j);
+                        paso *= 2;
+                    }
+                });
+                if (!muestra.empty()) muestra.erase(muestra.begin());  // La primera hoja ya empieza en el inicio
+            }
+            muestra.erase(unique(muestra.begin(), muestra.end()), muestra.end());
+
+            arbol.construir(muestra);
+            for (const auto& paciente : index) {
+                arbol.agregarMemoria(paciente.patientID, hashPaciente(paciente));
+            }
+            registrosAlConstruirArbol = index.size();
+        }
+
+        // Suma de hashes de las entradas de LevelDB dentro de una hoja
+        uint64_t sumaHojaBaseDatos(size_t hoja) const {
+            uint64_t suma = 0;
+            const string* desde = arbol.tieneInicio(hoja) ? &arbol.inicioDe(hoja) : nullptr;
+            const string* hasta = arbol.tieneFin(hoja) ? &arbol.finDe(hoja) : nullptr;
+            leveldb.recorrerRango(desde, hasta, [&suma](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                suma += ArbolReconciliacion::hashRegistro(clave.ToString(), valor.ToString());
+            });
+            return suma;
+        }
+
+        // Compara registro a registro una hoja recorriendo ambos lados en orden de ID
+        void compararHoja(size_t hoja, ResultadoReconciliacion& resultado) const {
+            vector<pair<string, string>> enBaseDatos;
+            const string* desde = arbol.tieneInicio(hoja) ? &arbol.inicioDe(hoja) : nullptr;
+            const string* hasta = arbol.tieneFin(hoja) ? &arbol.finDe(hoja) : nullptr;
+            leveldb.recorrerRango(desde, hasta, [&enBaseDatos](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                enBaseDatos.emplace_back(clave.ToString(), valor.ToString());
+            });
+
+            auto& index = pacientesContainer.get<0>();
+            auto it = desde ? index.lower_bound(*desde) : index.begin();
+            auto fin = hasta ? index.lower_bound(*hasta) : index.end();
+            size_t j = 0;
+
+            // Union ordenada de ambos lados
+            while (it != fin || j < enBaseDatos.size()) {
+                if (j == enBaseDatos.size() || (it != fin && it->patientID < enBaseDatos[j].first)) {
+                    resultado.soloMemoria.push_back(it->patientID);
+                    ++it;
+                } else if (it == fin || enBaseDatos[j].first < it->patientID) {
+                    resultado.soloBaseDatos.push_back(enBaseDatos[j].first);
+                    ++j;
+                } else {
+                    string valorMemoria = EsquemaPaciente::serializar(*it);
+                    if (valorMemoria != enBaseDatos[j].second) {
+                        resultado.distintos.push_back(it->patientID);
+                    }
+                    ++it;
+                    ++j;
+                }
+            }
+        }
+
+        // Corrige las diferencias: la version en memoria se escribe en LevelDB y los
+        // pacientes que solo estan en LevelDB se cargan en memoria
+        void repararDiferencias(const ResultadoReconciliacion& resultado) {
+            leveldb::WriteBatch lote;
+            auto& index = pacientesContainer.get<0>();
+
+            auto escribir = [&](const string& id) {
+                auto it = index.find(id);
+                if (it == index.end()) return;
+                LevelDBManager::agregarAlLote(lote, *it);
+                arbol.marcarSucia(id);
+            };
+            for (const auto& id : resultado.soloMemoria) escribir(id);
+            for (const auto& id : resultado.distintos) escribir(id);
+            if (leveldb.aplicarLote(lote)) diario.olvidarDivergentes();
+
+            // Se desconoce la version reemplazada de cada ID: los agregados se recalculan
+            if (!resultado.soloMemoria.empty() || !resultado.distintos.empty()) {
+                reconstruirAgregados();
+            }
+
+            for (const auto& id : resultado.soloBaseDatos) {
+                PacienteData paciente;
+                if (LevelDBManager::pacienteDesdeValor(id, leveldb.buscarPacientePorID(id), paciente)) {
+                    auto insercion = pacientesContainer.insert(paciente);
+                    if (insercion.second) alInsertar(*insercion.first);
+                }
+            }
+        }
+
+        // Actualiza las estructuras derivadas despues de insertar en memoria
+        void alInsertar(const PacienteData& paciente) {
+            registrarInsercionEnFiltro(paciente.patientID);
+            distribucion.agregar(paciente);
+            if (arbol.estaConstruido()) {
+                arbol.agregarMemoria(paciente.patientID, hashPaciente(paciente));
+                arbol.marcarSucia(paciente.patientID);  // LevelDB recibe la misma escritura
+            }
+        }
+
+        // Actualiza las estructuras derivadas antes de borrar de memoria
+        void alEliminar(const PacienteData& paciente) {
+            cambiosEnDistribucion++;
+            if (arbol.estaConstruido()) {
+                arbol.quitarMemoria(paciente.patientID, hashPaciente(paciente));
+                arbol.marcarSucia(paciente.patientID);
+            }
+        }
+
+        // Actualiza las estructuras derivadas despues de modificar un registro
+        void alModificar(const PacienteData& anterior, const PacienteData& nuevo) {
+            if (anterior.modality != nuevo.modality || anterior.tamanoArchivo != nuevo.tamanoArchivo) {
+                cambiosEnDistribucion++;  // El sketch conserva el valor viejo hasta reconstruirse
+            }
+            if (arbol.estaConstruido()) {
+                arbol.quitarMemoria(anterior.patientID, hashPaciente(anterior));
+                arbol.agregarMemoria(nuevo.patientID, hashPaciente(nuevo));
+                arbol.marcarSucia(nuevo.patientID);
+            }
+        }
+
+        // Hash de un paciente en memoria, igual al de su entrada en LevelDB
+        static uint64_t hashPaciente(const PacienteData& paciente) {
+            return ArbolReconciliacion::hashRegistro(paciente.patientID, EsquemaPaciente::serializar(paciente));
+        }
+
+        // Registra un ID nuevo en el filtro, ampliandolo antes si esta saturado
+        void registrarInsercionEnFiltro(const string& id) {
+            if (filtroIDs.saturado()) {
+                reconstruirFiltro(pacientesContainer.size() * 2);
+            } else {
+                filtroIDs.agregar(id);
+            }
+        }
+
+        // Cuenta borrados; el filtro no puede quitar claves, asi que cuando los IDs
+        // borrados superan la mitad de los vigentes se reconstruye desde el indice
+        void registrarBorradosEnFiltro(size_t cantidad) {
+            borradosSinReconstruir += cantidad;
+            if (borradosSinReconstruir > 1024 && borradosSinReconstruir > pacientesContainer.size() / 2) {
+                reconstruirFiltro(max(pacientesContainer.size() * 2, filtroIDs.getCapacidad() / 2));
+            }
+        }
+
+        // Vuelve a llenar el filtro con los IDs del indice primario
+        void reconstruirFiltro(size_t capacidad) {
+            filtroIDs.redimensionar(capacidad);
+            for (const auto& paciente : pacientesContainer.get<0>()) {
+                filtroIDs.agregar(paciente.patientID);
+            }
+            borradosSinReconstruir = 0;
+        }
+
+        // Borra de un indice los elementos de [desde, hasta) que cumplen el criterio
+        // Cada erase() tambien quita el nodo del indice de acceso aleatorio y desplaza los
+        // punteros posteriores; con muchos borrados se marcan los nodos y ese indice se
+        // compacta en una sola pasada, como en borrarPacientesPorPosicion
+        template <typename Indice, typename Iterador>
+        size_t borrarEnRango(Indice& index, Iterador desde, Iterador hasta,
+                                    const CriterioBorrado& criterio) {
+            vector<Iterador> victimas;
+            for (; desde != hasta; ++desde) {
+                if (criterio.cumple(desde->modality, desde->studyDate, desde->tamanoArchivo)) {
+                    victimas.push_back(desde);
+                }
+            }
+            for (const auto& it : victimas) alEliminar(*it);
+
+            if (victimas.size() <= UMBRAL_BORRADO_INDIVIDUAL) {
+                for (const auto& it : victimas) index.erase(it);
+            } else {
+                unordered_set<const PacienteData*> marcados;
+                marcados.reserve(victimas.size());
+                for (const auto& it : victimas) marcados.insert(&*it);
+                pacientesContainer.get<4>().remove_if([&marcados](const PacienteData& paciente) {
+                    return marcados.count(&paciente) > 0;
+                });
+            }
+            return victimas.size();
+        }
+
+        // Aplica un grupo de parches tomando el cerrojo que corresponde (global o, en modo
+        // fragmentado, el de cada fragmento una vez) y escribe su lote antes de soltarlo:
+        // LevelDB recibe los cambios de un ID en el orden en que se hicieron en memoria.
+        // Devuelve cuantos parches cambiaron un paciente; 'escrito' queda en false si
+        // algun lote no se pudo escribir
+        size_t aplicarParches(const vector<Parche>& parches, bool& escrito) {
+            size_t aplicados = 0;
+            auto escribir = [&](leveldb::WriteBatch& lote) {
+                if (leveldb.isConnected() && !escribirConAgregados(lote)) escrito = false;
+                lote.Clear();
+            };
+            if (fragmentado) {
+                map<size_t, vector<const Parche*>> porFragmento;
+                for (const auto& parche : parches) {
+                    porFragmento[fragmentado->fragmentoDe(parche.id)].push_back(&parche);
+                }
+                for (const auto& grupo : porFragmento) {
+                    fragmentado->modificarFragmento(grupo.second.front()->id, [&](PacienteContainer& pacientes) {
+                        leveldb::WriteBatch lote;
+                        size_t antes = aplicados;
+                        for (const Parche* parche : grupo.second) {
+                            if (aplicarActualizacion(pacientes, parche->id, parche->cambios, lote)) aplicados++;
+                        }
+                        if (aplicados > antes) escribir(lote);
+                    });
+                }
+                return aplicados;
+            }
+
+            BloqueoEscritura bloqueo(cerrojo);
+            leveldb::WriteBatch lote;
+            for (const auto& parche : parches) {
+                if (acotado) {
+                    // Cada parche se escribe antes del siguiente, que puede leer el mismo paciente
+                    if (!aplicarActualizacionAcotada(parche.id, parche.cambios, lote)) continue;
+                    escribir(lote);
+                } else if (!aplicarActualizacion(pacientesContainer, parche.id, parche.cambios, lote)) {
+                    continue;
+                }
+                aplicados++;
+            }
+            if (aplicados > 0 && !acotado) escribir(lote);
+            return aplicados;
+        }
+
+        // Version de aplicarActualizacion para el modo acotado: lee el registro (cache o
+        // LevelDB), aplica los cambios y actualiza indices, cache y agregados
+        bool aplicarActualizacionAcotada(const string& id, const ActualizacionPaciente& cambios,
+                                         leveldb::WriteBatch& lote) {
+            PacienteData anterior;
+            if (cambios.vacia() || !acotado->obtener(id, anterior)) return false;
+
+            PacienteData nuevo = anterior;
+            if (cambios.patientName) nuevo.patientName = *cambios.patientName;
+            if (cambios.studyDate) nuevo.studyDate = *cambios.studyDate;
+            if (cambios.modality) nuevo.modality = *cambios.modality;
+            if (cambios.sex) nuevo.sex = convertirCodigoSexo(*cambios.sex);
+            if (cambios.tamanoArchivo) nuevo.tamanoArchivo = *cambios.tamanoArchivo;
+            if (EsquemaPaciente::serializar(nuevo) == EsquemaPaciente::serializar(anterior)) return false;
+
+            acotado->reemplazar(nuevo);
+            alModificar(anterior, nuevo);
+            tablaAgregados.reemplazar(anterior, nuevo);
+            LevelDBManager::agregarAlLote(lote, nuevo);
+            return true;
+        }
+
+        // Quita un paciente del modo acotado descontandolo de los agregados
+        // (el llamador tiene el cerrojo de escritura y borra de LevelDB despues)
+        bool quitarDeAcotado(const string& id) {
+            PacienteData paciente;
+            if (!acotado->obtener(id, paciente)) return false;
+            tablaAgregados.restar(paciente);
+            cambiosEnDistribucion++;
+            return acotado->quitar(id);
+        }
+
+        // Aplica los cambios en memoria con modify() y agrega el registro resultante al lote
+        // Devuelve false si el paciente no existe o si no hay cambios efectivos
+        bool aplicarActualizacion(PacienteContainer& pacientes, const string& id,
+                                  const ActualizacionPaciente& cambios, leveldb::WriteBatch& lote) {
+            if (cambios.vacia()) return false;
+
+            auto& index = pacientes.get<0>();
+            auto it = index.find(id);
+            if (it == index.end()) return false;
+
+            // Compara antes de modificar para no reescribir registros sin cambios
+            const PacienteData& actual = *it;
+            bool hayCambios = (cambios.patientName && *cambios.patientName != actual.patientName) ||
+                              (cambios.studyDate && *cambios.studyDate != actual.studyDate) ||
+                              (cambios.modality && *cambios.modality != actual.modality) ||
+                              (cambios.sex && convertirCodigoSexo(*cambios.sex) != actual.sex) ||
+                              (cambios.tamanoArchivo && *cambios.tamanoArchivo != actual.tamanoArchivo);
+            if (!hayCambios) return false;
+
+            // modify() solo reubica el nodo en los indices cuya clave cambio;
+            // el ID no se toca, por lo que el indice unico nunca rechaza el cambio
+            PacienteData anterior = actual;
+            bool modificado = index.modify(it,
+                [&cambios](PacienteData& p) {
+                    if (cambios.patientName) p.patientName = *cambios.patientName;
+                    if (cambios.studyDate) p.studyDate = *cambios.studyDate;
+                    if (cambios.modality) p.modality = *cambios.modality;
+                    if (cambios.sex) p.sex = convertirCodigoSexo(*cambios.sex);
+                    if (cambios.tamanoArchivo) p.tamanoArchivo = *cambios.tamanoArchivo;
+                },
+                [&anterior](PacienteData& p) { p = anterior; });
+            if (!modificado) return false;
+            alModificar(anterior, *it);
+            tablaAgregados.reemplazar(anterior, *it);
+
+            LevelDBManager::agregarAlLote(lote, *it);
+            return true;
+        }
+
+        // Interpreta una linea de parche: ID|campo=valor|campo=valor...
+        static bool parsearParche(const string& linea, string& id, ActualizacionPaciente& cambios) {
+            size_t inicio = 0;
+            size_t fin = linea.find('|');
+            if (fin == string::npos) return false;  // Un parche sin campos no tiene efecto
+
+            id = linea.substr(0, fin);
+            if (id.empty()) return false;
+
+            while (fin != string::npos) {
+                inicio = fin + 1;
+                fin = linea.find('|', inicio);
+                string par = linea.substr(inicio, fin == string::npos ? string::npos : fin - inicio);
+
+                size_t igual = par.find('=');
+                if (igual == string::npos) return false;
+                string campo = ::aMinusculas(par.substr(0, igual));
+                string valor = par.substr(igual + 1);
+
+                if (campo == "nombre") cambios.patientName = valor;
+                else if (campo == "fecha") cambios.studyDate = valor;
+                else if (campo == "modalidad") cambios.modality = valor;
+                else if (campo == "sexo") cambios.sex = valor;
+                else if (campo == "tamano") {
+                    try {
+                        cambios.tamanoArchivo = stoll(valor);
+                    } catch (...) {
+                        return false;
+                    }
+                }
+                else return false;
+            }
+            return !cambios.vacia() && !cambios.contieneSeparador();
+        }
+};
+
+
+// Consulta del modo por lotes: una linea del archivo de consultas y su resultado
+struct ConsultaLote {
+    size_t linea = 0;            // Linea en el archivo de consultas
+    string texto;                // Linea original
+    string tipo;                 // id, nombre, modalidad, sexo o leveldb
+    string campo;                // Campo de LevelDB (solo tipo leveldb)
+    string valor;                // Valor buscado
+    bool valida = false;         // La consulta se pudo interpretar y ejecutar
+    vector<string> resultados;   // Pacientes encontrados en formato compacto
+    double microsegundos = 0;    // Latencia de la consulta
+};
+
+// Interpreta una linea de consulta: tipo|valor, o leveldb|campo|valor
+bool parsearConsultaLote(const string& linea, ConsultaLote& consulta) {
+    size_t separador = linea.find('|');
+    if (separador == string::npos) return false;
+    consulta.tipo = aMinusculas(linea.substr(0, separador));
+    consulta.valor = linea.substr(separador + 1);
+
+    if (consulta.tipo == "leveldb") {
+        size_t segundo = consulta.valor.find('|');
+        if (segundo == string::npos) return false;
+        consulta.campo = aMinusculas(consulta.valor.substr(0, segundo));
+        consulta.valor = consulta.valor.substr(segundo + 1);
+        return true;
+    }
+    return consulta.tipo == "id" || consulta.tipo == "nombre" ||
+           consulta.tipo == "modalidad" || consulta.tipo == "sexo";
+}
+
+// Ejecuta una consulta ya interpretada y mide su latencia
+void ejecutarConsultaLote(SistemaPacientes& sistema, ConsultaLote& consulta) {
+    auto inicio = chrono::steady_clock::now();
+    vector<DataPaciente> encontrados;
+    consulta.valida = true;
+    if (consulta.tipo == "id") encontrados = sistema.buscarPorID(consulta.valor);
+    else if (consulta.tipo == "nombre") encontrados = sistema.buscarPorNombre(consulta.valor);
+    else if (consulta.tipo == "modalidad") encontrados = sistema.buscarPorModalidad(consulta.valor);
+    else if (consulta.tipo == "sexo") encontrados = sistema.buscarPorSexo(consulta.valor);
+    else consulta.valida = sistema.consultarLevelDB(consulta.campo, consulta.valor, consulta.resultados);
+
+    for (const auto& paciente : encontrados) {
+        consulta.resultados.push_back(paciente.getPatientID() + "|" + EsquemaPaciente::serializar(PacienteData(paciente)));
+    }
+    consulta.microsegundos = chrono::duration<double, micro>(chrono::steady_clock::now() - inicio).count();
+}
+
+// Modo por lotes: lee un archivo de consultas, las ejecuta en un pool de hilos y
+// escribe en 'archivoSalida' los resultados y la latencia de cada una, en el orden
+// del archivo de entrada. No usa la consola salvo para el resumen final
+bool ejecutarLoteConsultas(SistemaPacientes& sistema, const string& archivoConsultas,
+                           const string& archivoSalida, size_t hilos) {
+    ifstream entrada(archivoConsultas);
+    if (!entrada.is_open()) {
+        cerr << "Error al abrir archivo de consultas: " << archivoConsultas << endl;
+        return false;
+    }
+
+    vector<ConsultaLote> consultas;
+    string linea;
+    size_t numeroLinea = 0;
+    while (getline(entrada, linea)) {
+        numeroLinea++;
+        if (!linea.empty() && linea.back() == '\r') linea.pop_back();
+        if (linea.empty() || linea[0] == '#') continue;  // Salta lineas vacias o comentarios
+
+        ConsultaLote consulta;
+        consulta.linea = numeroLinea;
+        consulta.texto = linea;
+        if (!parsearConsultaLote(linea, consulta)) {
+            registro().advertencia("consulta_invalida", "Consulta no valida en linea " +
+                                   to_string(numeroLinea) + ": " + linea);
+            consulta.tipo.clear();  // No se ejecuta y queda marcada como no valida
+        }
+        consultas.push_back(move(consulta));
+    }
+    entrada.close();
+
+    // Cada consulta escribe solo en su propia posicion del vector
+    auto inicio = chrono::steady_clock::now();
+    {
+        PoolHilos pool(hilos);
+        vector<future<void>> pendientes;
+        pendientes.reserve(consultas.size());
+        for (auto& consulta : consultas) {
+            if (consulta.tipo.empty()) continue;
+            ConsultaLote* actual = &consulta;
+            pendientes.push_back(pool.encolar([&sistema, actual]() {
+                ejecutarConsultaLote(sistema, *actual);
+            }));
+        }
+        for (auto& pendiente : pendientes) pendiente.get();
+    }
+    double segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+
+    ofstream salida(archivoSalida);
+    if (!salida.is_open()) {
+        cerr << "Error al crear archivo de salida: " << archivoSalida << endl;
+        return false;
+    }
+    vector<double> latencias;
+    size_t invalidas = 0;
+    for (const auto& consulta : consultas) {
+        salida << ">> " << consulta.texto << " | linea=" << consulta.linea;
+        if (!consulta.valida) {
+            salida << " | error=consulta no valida" << '\n';
+            invalidas++;
+            continue;
+        }
+        salida << " | resultados=" << consulta.resultados.size()
+               << " | latencia_us=" << consulta.microsegundos << '\n';
+        for (const auto& resultado : consulta.resultados) {
+            salida << resultado << '\n';
+        }
+        latencias.push_back(consulta.microsegundos);
+    }
+    salida.close();
+
+    cout << "Consultas ejecutadas: " << latencias.size() << " (" << invalidas << " no validas) con "
+         << hilos << " hilos en " << segundos << " s";
+    if (segundos > 0) cout << " (" << (long) (latencias.size() / segundos) << " consultas/s)";
+    cout << endl;
+    if (!latencias.empty()) {
+        sort(latencias.begin(), latencias.end());
+        auto percentil = [&latencias](double p) {
+            return latencias[min(latencias.size() - 1, (size_t) (p * latencias.size()))];
+        };
+        cout << "Latencia (us): p50=" << percentil(0.50) << " p99=" << percentil(0.99)
+             << " max=" << latencias.back() << endl;
+    }
+    cout << "Resultados escritos en: " << archivoSalida << endl;
+    return true;
+}
+
+
+// Protocolo del servidor de consultas
+// Cada mensaje va precedido por su longitud en 4 bytes (big-endian).
+// Solicitud: texto OPERACION|argumentos
+//   id|v  nombre|v  modalidad|v  sexo|v  leveldb|campo|v   (igual que el modo por lotes)
+//   agregar|ID|Nombre|Fecha|Modalidad|Sexo|Tamano
+//   actualizar|ID|campo=valor...   borrar|ID   cantidad
+//   estadisticas   (el informe de rendimiento del menu, una linea por operacion o contador)
+//   reporte|modalidad,sexo,mes   (cualquier subconjunto; vacio = total)
+//   percentil|modalidad|50,95,99   (modalidad * = todas; responde una linea p|valor por percentil)
+// Respuesta: "OK <n>\n" seguido de n lineas, o "ERROR <mensaje>\n"
+const uint32_t LONGITUD_MAXIMA_MENSAJE = 16 * 1024 * 1024;
+
+// Antepone la longitud de 4 bytes a un mensaje
+string enmarcarMensaje(const string& cuerpo) {
+    uint32_t longitud = cuerpo.size();
+    string marco(4, '\0');
+    marco[0] = (char) (longitud >> 24);
+    marco[1] = (char) (longitud >> 16);
+    marco[2] = (char) (longitud >> 8);
+    marco[3] = (char) longitud;
+    return marco + cuerpo;
+}
+
+// Lee la longitud de 4 bytes de una cabecera
+uint32_t leerLongitudMensaje(const unsigned char* cabecera) {
+    return ((uint32_t) cabecera[0] << 24) | ((uint32_t) cabecera[1] << 16) |
+           ((uint32_t) cabecera[2] << 8) | (uint32_t) cabecera[3];
+}
+
+// Ejecuta una solicitud del protocolo y arma la respuesta
+string procesarSolicitud(SistemaPacientes& sistema, const string& solicitud) {
+    size_t separador = solicitud.find('|');
+    string operacion = aMinusculas(solicitud.substr(0, separador));
+    string argumentos = separador == string::npos ? "" : solicitud.substr(separador + 1);
+
+    if (operacion == "cantidad") {
+        return "OK 1\n" + to_string(sistema.getCantidadPacientes()) + "\n";
+    }
+    if (operacion == "agregar") {
+        DataPaciente paciente;
+        if (!paciente.cargarDesdeFormatoCompacto(argumentos)) return "ERROR formato de paciente no valido\n";
+        if (!sistema.agregarPaciente(paciente, false)) return "ERROR el paciente ya existe o no se pudo guardar\n";
+        return "OK 0\n";
+    }
+    if (operacion == "borrar") {
+        if (!sistema.borrarPaciente(argumentos)) return "ERROR paciente no encontrado\n";
+        return "OK 0\n";
+    }
+    if (operacion == "actualizar") {
+        if (!sistema.aplicarParche(argumentos)) return "ERROR parche no valido, sin cambios o no guardado\n";
+        return "OK 0\n";
+    }
+    if (operacion == "estadisticas") {
+        // El mismo informe que el menu, una linea por operacion o contador
+        ostringstream informe;
+        mostrarEstadisticasRendimiento(estadisticas().instantanea(), informe);
+        string texto = informe.str();
+        return "OK " + to_string(count(texto.begin(), texto.end(), '\n')) + "\n" + texto;
+    }
+    if (operacion == "reporte") {
+        // Cada fila: modalidad|sexo|mes|cantidad|suma|minimo|maximo|extremosExactos
+        AgrupacionAgregados agrupacion;
+        if (!parsearAgrupacion(argumentos, agrupacion)) return "ERROR agrupacion no valida\n";
+        vector<FilaAgregado> filas = sistema.reporteAgregados(agrupacion);
+        string respuesta = "OK " + to_string(filas.size()) + "\n";
+        for (const auto& fila : filas) {
+            respuesta += fila.modalidad + "|" + fila.sexo + "|" + fila.mes + "|" +
+                         to_string(fila.total.cantidad) + "|" + to_string(fila.total.suma) + "|" +
+                         to_string(fila.total.minimo) + "|" + to_string(fila.total.maximo) + "|" +
+                         (fila.total.extremosExactos ? "1" : "0") + "\n";
+        }
+        return respuesta;
+    }
+    if (operacion == "percentil") {
+        size_t barra = argumentos.find('|');
+        if (barra == string::npos) return "ERROR se espera percentil|modalidad|p1,p2...\n";
+        vector<double> pedidos;
+        size_t inicio = barra + 1;
+        while (inicio <= argumentos.size()) {
+            size_t coma = argumentos.find(',', inicio);
+            if (coma == string::npos) coma = argumentos.size();
+            try {
+                pedidos.push_back(stod(argumentos.substr(inicio, coma - inicio)));
+            } catch (...) {
+                return "ERROR percentil no valido\n";
+            }
+            if (pedidos.back() < 0 || pedidos.back() > 100) return "ERROR percentil fuera de 0-100\n";
+            inicio = coma + 1;
+        }
+        vector<long long> valores = sistema.distribucionTamanos().percentiles(argumentos.substr(0, barra), pedidos);
+        if (valores.empty()) return "OK 0\n";
+        string respuesta = "OK " + to_string(valores.size()) + "\n";
+        for (size_t i = 0; i < valores.size(); ++i) {
+            char numero[32];
+            snprintf(numero, sizeof(numero), "%g", pedidos[i]);
+            respuesta += string(numero) + "|" + to_string(valores[i]) + "\n";
+        }
+        return respuesta;
+    }
+
+    ConsultaLote consulta;
+    if (!parsearConsultaLote(solicitud, consulta)) return "ERROR operacion no valida\n";
+    ejecutarConsultaLote(sistema, consulta);
+    if (!consulta.valida) return "ERROR consulta no valida\n";
+
+    string respuesta = "OK " + to_string(consulta.resultados.size()) + "\n";
+    for (const auto& resultado : consulta.resultados) {
+        respuesta += resultado;
+        respuesta += '\n';
+    }
+    return respuesta;
+}
+
+
+// Indica si una solicitud recorre muchos pacientes (busqueda por nombre, listados por
+// modalidad o sexo, consultas sobre LevelDB). Esas se ejecutan en el pool de consultas
+// para no ocupar los hilos de E/S que atienden a las demas conexiones
+bool esSolicitudPesada(const string& solicitud) {
+    string operacion = aMinusculas(solicitud.substr(0, solicitud.find('|')));
+    return operacion == "nombre" || operacion == "modalidad" || operacion == "sexo" || operacion == "leveldb";
+}
+
+
+// Clase SesionServidor
+// Conexion de un cliente. Lee la siguiente solicitud sin esperar a que salgan las
+// respuestas anteriores (pipelining); las respuestas se envian en el orden de las
+// solicitudes y las acumuladas se escriben juntas. Todos los manejadores de la
+// sesion corren en su strand, por lo que no necesita cerrojos propios.
+// Las solicitudes pesadas se ejecutan en el pool de consultas; mientras tanto la
+// sesion no lee la siguiente, asi el orden de las respuestas y de los cambios no
+// varia. Si se acumulan MAXIMO_PENDIENTES respuestas sin enviar (un cliente que no
+// lee), la sesion deja de leer el socket hasta que la escritura en curso termine.
+template <typename Protocolo>
+class SesionServidor : public enable_shared_from_this<SesionServidor<Protocolo>> {
+    private:
+        static const size_t MAXIMO_PENDIENTES = 256;
+
+        typename Protocolo::socket socket;
+        SistemaPacientes& sistema;
+        PoolHilos& consultasPesadas;             // Pool compartido por todas las sesiones
+        atomic<uint64_t>& atendidas;             // Contador global del servidor
+        unsigned char cabecera[4];               // Longitud de la solicitud en curso
+        string cuerpo;                           // Solicitud en curso
+        vector<string> pendientes;               // Respuestas esperando ser enviadas
+        vector<string> enEnvio;                  // Respuestas de la escritura en curso
+        bool lecturaPausada = false;             // Se dejo de leer por tener la cola llena
+        bool cerrada = false;                    // Fallo una escritura: no se lee ni se escribe mas
+
+        // Lee la cabecera y luego el cuerpo de la siguiente solicitud
+        void leerSolicitud() {
+            auto self = this->shared_from_this();
+            boost::asio::async_read(socket, boost::asio::buffer(cabecera),
+                [this, self](const boost::system::error_code& error, size_t) {
+                    if (error) return;  // El cliente cerro la conexion
+                    uint32_t longitud = leerLongitudMensaje(cabecera);
+                    if (longitud > LONGITUD_MAXIMA_MENSAJE) return;  // Mensaje invalido: se cierra
+                    cuerpo.resize(longitud);
+                    boost::asio::async_read(socket, boost::asio::buffer(&cuerpo[0], cuerpo.size()),
+                        [this, self](const boost::system::error_code& error, size_t) {
+                            if (error) return;
+                            if (!esSolicitudPesada(cuerpo)) {
+                                responder(procesarSolicitud(sistema, cuerpo));
+                                return;
+                            }
+                            // La respuesta vuelve al strand de la sesion cuando el pool termina
+                            consultasPesadas.encolar([this, self, solicitud = move(cuerpo)]() {
+                                string respuesta;
+                                try {
+                                    respuesta = procesarSolicitud(sistema, solicitud);
+                                } catch (const exception& e) {
+                                    respuesta = string("ERROR ") + e.what() + "\n";
+                                }
+                                boost::asio::post(socket.get_executor(),
+                                    [this, self, respuesta = move(respuesta)]() mutable {
+                                        responder(move(respuesta));
+                                    });
+                            });
+                        });
+                });
+        }
+
+        // Encola la respuesta de la solicitud leida y sigue leyendo si hay lugar
+        void responder(string respuesta) {
+            atendidas.fetch_add(1, memory_order_relaxed);
+            if (cerrada) return;
+            pendientes.push_back(enmarcarMensaje(respuesta));
+            if (enEnvio.empty()) escribirPendientes();
+            if (pendientes.size() + enEnvio.size() >= MAXIMO_PENDIENTES) {
+                lecturaPausada = true;
+                return;
+            }
+            leerSolicitud();
+        }
+
+        // Envia en una sola escritura todas las respuestas acumuladas
+        void escribirPendientes() {
+            enEnvio.swap(pendientes);
+            vector<boost::asio::const_buffer> buffers;
+            buffers.reserve(enEnvio.size());
+            for (const auto& respuesta : enEnvio) buffers.push_back(boost::asio::buffer(respuesta));
+
+            auto self = this->shared_from_this();
+            boost::asio::async_write(socket, buffers,
+                [this, self](const boost::system::error_code& error, size_t) {
+                    enEnvio.clear();
+                    if (error) {
+                        pendientes.clear();
+                        cerrada = true;
+                        return;
+                    }
+                    if (!pendientes.empty()) escribirPendientes();
+                    if (lecturaPausada && pendientes.size() + enEnvio.size() < MAXIMO_PENDIENTES) {
+                        lecturaPausada = false;
+                        leerSolicitud();
+                    }
+                });
+        }
+
+    public:
+        SesionServidor(typename Protocolo::socket s, SistemaPacientes& sis, PoolHilos& pesadas,
+                       atomic<uint64_t>& contador)
+            : socket(move(s)), sistema(sis), consultasPesadas(pesadas), atendidas(contador) {}
+
+        void iniciar() {
+            leerSolicitud();
+        }
+};
+
+
+// Clase ServidorConsultas
+// Acepta clientes en un socket Unix o TCP local y crea una sesion por conexion.
+// El io_context se ejecuta en varios hilos; cada sesion usa su propio strand.
+// Las consultas pesadas de todas las sesiones comparten un pool aparte
+template <typename Protocolo>
+class ServidorConsultas {
+    private:
+        boost::asio::io_context& io;
+        typename Protocolo::acceptor aceptador;
+        SistemaPacientes& sistema;
+        PoolHilos consultasPesadas;
+        atomic<uint64_t> conexiones{0};
+        atomic<uint64_t> atendidas{0};
+
+        // Acepta la siguiente conexion
+        void aceptar() {
+            aceptador.async_accept(boost::asio::make_strand(io),
+                [this](const boost::system::error_code& error, typename Protocolo::socket socket) {
+                    if (!error) {
+                        conexiones++;
+                        make_shared<SesionServidor<Protocolo>>(move(socket), sistema, consultasPesadas,
+                                                               atendidas)->iniciar();
+                    }
+                    if (aceptador.is_open()) aceptar();
+                });
+        }
+
+    public:
+        ServidorConsultas(boost::asio::io_context& contexto, const typename Protocolo::endpoint& extremo,
+                          SistemaPacientes& sis, size_t hilosConsultas)
+            : io(contexto), aceptador(contexto, extremo), sistema(sis), consultasPesadas(hilosConsultas) {
+            aceptar();
+        }
+
+        void detener() {
+            boost::system::error_code ignorado;
+            aceptador.close(ignorado);
+        }
+
+        uint64_t getConexiones() const { return conexiones.load(); }
+        uint64_t getAtendidas() const { return atendidas.load(); }
+};
+
+// Interpreta una direccion del servidor: "tcp:<puerto>" escucha en 127.0.0.1,
+// cualquier otra cosa es la ruta de un socket Unix
+bool esDireccionTcp(const string& direccion, unsigned short& puerto) {
+    if (direccion.compare(0, 4, "tcp:") != 0) return false;
+    try {
+        puerto = (unsigned short) stoi(direccion.substr(4));
+    } catch (...) {
+        puerto = 0;
+    }
+    return true;
+}
+
+// Atiende clientes hasta recibir SIGINT o SIGTERM
+template <typename Protocolo>
+void atenderClientes(SistemaPacientes& sistema, const typename Protocolo::endpoint& extremo, size_t hilos) {
+    ResumenEventos resumen("Sesion del servidor");
+    boost::asio::io_context io;
+    ServidorConsultas<Protocolo> servidor(io, extremo, sistema, hilos);
+
+    boost::asio::signal_set senales(io, SIGINT, SIGTERM);
+    senales.async_wait([&](const boost::system::error_code&, int) {
+        servidor.detener();
+        io.stop();
+    });
+
+    vector<thread> trabajadores;
+    for (size_t i = 1; i < hilos; ++i) {
+        trabajadores.emplace_back([&io]() { io.run(); });
+    }
+    io.run();
+    for (auto& trabajador : trabajadores) trabajador.join();
+
+    cout << "Servidor detenido. Conexiones: " << servidor.getConexiones()
+         << ", solicitudes atendidas: " << servidor.getAtendidas() << endl;
+    resumen.registrar();
+}
+
+// Modo servidor: abre el sistema y atiende solicitudes en 'direccion'
+bool ejecutarServidor(SistemaPacientes& sistema, const string& direccion, size_t hilos) {
+    try {
+        unsigned short puerto = 0;
+        if (esDireccionTcp(direccion, puerto)) {
+            if (puerto == 0) {
+                cerr << "Puerto no valido: " << direccion << endl;
+                return false;
+            }
+            cout << "Servidor escuchando en 127.0.0.1:" << puerto << " con " << hilos << " hilos" << endl;
+            boost::asio::ip::tcp::endpoint extremo(boost::asio::ip::address_v4::loopback(), puerto);
+            atenderClientes<boost::asio::ip::tcp>(sistema, extremo, hilos);
+        } else {
+            ::unlink(direccion.c_str());  // Un socket de una ejecucion anterior impide el bind
+            cout << "Servidor escuchando en " << direccion << " con " << hilos << " hilos" << endl;
+            boost::asio::local::stream_protocol::endpoint extremo(direccion);
+            atenderClientes<boost::asio::local::stream_protocol>(sistema, extremo, hilos);
+            ::unlink(direccion.c_str());
+        }
+    } catch (const boost::system::system_error& e) {
+        cerr << "Error del servidor: " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Cliente generador de carga
+// Abre 'conexiones' conexiones; cada una mantiene 'profundidad' solicitudes en vuelo
+// (pipelining) tomadas en ciclo del archivo de consultas durante 'segundos' segundos
+// y mide la latencia de cada una desde el envio hasta su respuesta.
+template <typename Protocolo>
+void generarCarga(const typename Protocolo::endpoint& extremo, const vector<string>& solicitudes,
+                  size_t conexiones, int segundos, size_t profundidad) {
+    atomic<bool> detener(false);
+    atomic<uint64_t> errores(0);
+    atomic<uint64_t> fallidas(0);
+    vector<vector<double>> latenciasPorConexion(conexiones);
+
+    auto trabajar = [&](size_t numero) {
+        try {
+            boost::asio::io_context io;
+            typename Protocolo::socket socket(io);
+            socket.connect(extremo);
+
+            vector<double>& latencias = latenciasPorConexion[numero];
+            queue<chrono::steady_clock::time_point> enVuelo;
+            size_t siguiente = numero % solicitudes.size();
+            auto enviar = [&]() {
+                string marco = enmarcarMensaje(solicitudes[siguiente]);
+                siguiente = (siguiente + 1) % solicitudes.size();
+                enVuelo.push(chrono::steady_clock::now());
+                boost::asio::write(socket, boost::asio::buffer(marco));
+            };
+
+            for (size_t i = 0; i < profundidad; ++i) enviar();
+            unsigned char cabecera[4];
+            string respuesta;
+            while (!enVuelo.empty()) {
+                boost::asio::read(socket, boost::asio::buffer(cabecera));
+                respuesta.resize(leerLongitudMensaje(cabecera));
+                boost::asio::read(socket, boost::asio::buffer(&respuesta[0], respuesta.size()));
+                latencias.push_back(chrono::duration<double, micro>(
+                    chrono::steady_clock::now() - enVuelo.front()).count());
+                enVuelo.pop();
+                if (respuesta.compare(0, 5, "ERROR") == 0) errores++;
+                if (!detener.load(memory_order_relaxed)) enviar();
+            }
+        } catch (const boost::system::system_error& e) {
+            fallidas++;
+            cerr << "Conexion " << numero << ": " << e.what() << endl;
+        }
+    };
+
+    auto inicio = chrono::steady_clock::now();
+    vector<thread> hilos;
+    for (size_t i = 0; i < conexiones; ++i) hilos.emplace_back(trabajar, i);
+    this_thread::sleep_for(chrono::seconds(segundos));
+    detener = true;
+    for (auto& hilo : hilos) hilo.join();
+    double transcurrido = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+
+    vector<double> latencias;
+    for (const auto& parcial : latenciasPorConexion) latencias.insert(latencias.end(), parcial.begin(), parcial.end());
+    cout << "Solicitudes: " << latencias.size() << " (respuestas ERROR: " << errores.load()
+         << ", conexiones fallidas: " << fallidas.load() << ") en " << transcurrido << " s ("
+         << (long) (latencias.size() / transcurrido) << " solicitudes/s)" << endl;
+    if (!latencias.empty()) {
+        sort(latencias.begin(), latencias.end());
+        auto percentil = [&latencias](double p) {
+            return latencias[min(latencias.size() - 1, (size_t) (p * latencias.size()))];
+        };
+        cout << "Latencia (us): p50=" << percentil(0.50) << " p99=" << percentil(0.99)
+             << " max=" << latencias.back() << endl;
+    }
+}
+
+// Modo cliente de carga: lee las solicitudes (mismo formato que el modo por lotes)
+// y las envia al servidor en 'direccion'
+bool ejecutarClienteCarga(const string& direccion, const string& archivoSolicitudes,
+                          size_t conexiones, int segundos, size_t profundidad) {
+    ifstream entrada(archivoSolicitudes);
+    if (!entrada.is_open()) {
+        cerr << "Error al abrir archivo de solicitudes: " << archivoSolicitudes << endl;
+        return false;
+    }
+    vector<string> solicitudes;
+    string linea;
+    while (getline(entrada, linea)) {
+        if (!linea.empty() && linea.back() == '\r') linea.pop_back();
+        if (linea.empty() || linea[0] == '#') continue;
+        solicitudes.push_back(linea);
+    }
+    if (solicitudes.empty()) {
+        cerr << "El archivo de solicitudes esta vacio" << endl;
+        return false;
+    }
+
+    unsigned short puerto = 0;
+    bool tcp = esDireccionTcp(direccion, puerto);
+    if (tcp && puerto == 0) {
+        cerr << "Puerto no valido: " << direccion << endl;
+        return false;
+    }
+    cout << "Generando carga: " << conexiones << " conexiones, " << profundidad
+         << " solicitudes en vuelo por conexion, " << segundos << " s" << endl;
+    if (tcp) {
+        boost::asio::ip::tcp::endpoint extremo(boost::asio::ip::address_v4::loopback(), puerto);
+        generarCarga<boost::asio::ip::tcp>(extremo, solicitudes, conexiones, segundos, profundidad);
+    } else {
+        boost::asio::local::stream_protocol::endpoint extremo(direccion);
+        generarCarga<boost::asio::local::stream_protocol>(extremo, solicitudes, conexiones, segundos, profundidad);
+    }
+    return true;
+}
+
+
+#ifndef SIN_MENU
+
+// Clase MenuPrincipal 
+// Gestiona la interfaz de usuario y coordina las operaciones del sistema
+class MenuPrincipal {
+    private:
+        SistemaPacientes sistema;  // Instancia del sistema de pacientes
+        
+        // Muestra resultados de busqueda de forma formateada
+        void mostrarResultadosBusqueda(const vector<DataPaciente>& resultados) const {
+            if (resultados.empty()) {
+                cout << "No se encontraron resultados." << endl;
+            } else {
+                cout << "-----------------------------------------------------------------------" << endl;
+                cout << "   RESULTADOS DE BUSQUEDA (" << resultados.size() << " encontrados)  " << endl;
+                SalidaResultados salida(cout, FormatoSalida::TABLA);
+                for (const auto& resultado : resultados) {
+                    salida.escribir(resultado);
+                }
+            }
+        }
+
+        // Pregunta el formato de un listado; Enter elige la tabla
+        FormatoSalida leerFormatoSalida() const {
+            cout << "Formato (1. Tabla, 2. CSV, 3. JSONL) [1]: ";
+            string opcion;
+            getline(cin, opcion);
+            if (opcion == "2") return FormatoSalida::CSV;
+            if (opcion == "3") return FormatoSalida::JSONL;
+            return FormatoSalida::TABLA;
+        }
+    
+public:
+    // Con numFragmentos > 0 el sistema trabaja en modo fragmentado y con
+    // capacidadCache > 0 (bytes) en modo acotado. La memoria se guarda al salir en
+    // una instantanea junto a la base y se recupera de ella al volver a entrar
+    explicit MenuPrincipal(size_t numFragmentos = 0, size_t capacidadCache = 0)
+        : sistema("./leveldb_data", numFragmentos, capacidadCache, "./pacientes.instantanea") {}
+
+    // Metodo principal que ejecuta el menu en bucle
+    void ejecutar() {
+        int opcion;
+        
+        // Muestra advertencia si LevelDB no esta conectado
+        if (!sistema.isDBConnected()) {
+            cout << "-----------------------------------------------------------------------" << endl;
+            cout << "                             ADVERTENCIA" << endl;
+            cout << " No se pudo inicializar LevelDB." << endl;
+            cout << " Asegurate de tener permisos de escritura en el directorio actual." << endl;
+            cout << " Los datos no se guardaran persistentemente." << endl;
+            cout << "-----------------------------------------------------------------------" << endl;
+            cout << "Presione Enter para continuar..." << endl;
+            cin.get();
+        }
+        
+        // Bucle principal del menu
+        do {
+            mostrarMenu();
+            cout << "Seleccione una opcion: ";
+            
+            // Manejo robusto de entrada incorrecta
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida. Por favor ingrese un numero." << endl;
+                continue;
+            }
+            
+            cin.ignore();  // Limpia el buffer de entrada
+            
+            // Ejecuta la opcion seleccionada
+            switch(opcion) {
+                case 1: subMenuCarga(); break;
+                case 2: sistema.mostrarTodos(leerFormatoSalida()); break;
+                case 3: subMenuBusqueda(); break;
+                case 4: subMenuBorrado(); break;
+                case 5: 
+                    if (sistema.isDBConnected()) {
+                        subMenuLevelDB();
+                    } else {
+                        cout << "Error: No hay conexion con Base de datos" << endl;
+                        cout << "\nPresione Enter para continuar...";
+                        cin.get();
+                    }
+                    break;
+                case 6: 
+                    if (sistema.isDBConnected()) {
+                        if (!sistema.sincronizarConBaseDeDatos().sincronizado()) {
+                            cout << "¿Desea reparar las diferencias? (s/n): ";
+                            char confirmacion;
+                            cin >> confirmacion;
+                            cin.ignore();
+                            if (confirmacion == 's' || confirmacion == 'S') {
+                                sistema.sincronizarConBaseDeDatos(true);
+                            }
+                        }
+                        if (!sistema.esAcotado()) {
+                            cout << "¿Guardar ahora la instantanea de la memoria? (s/n): ";
+                            char confirmacion;
+                            cin >> confirmacion;
+                            cin.ignore();
+                            if (confirmacion == 's' || confirmacion == 'S') {
+                                sistema.guardarInstantanea();
+                            }
+                        }
+                    } else {
+                        cout << "Error: No hay conexion con Base de datos" << endl;
+                    }
+                    break;
+                case 7: subMenuActualizacion(); break;
+                case 8: subMenuReportes(); break;
+                case 9: subMenuEstadisticas(); break;
+                case 10: cout << "Saliendo del programa..." << endl; break;
+                default: cout << "Opcion no valida. Intente nuevamente." << endl; break;
+            }
+            
+            // Pausa antes de continuar (excepto al salir)
+            if (opcion != 10) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+            
+        } while (opcion != 10);
+    }
+    
+private:
+    // Muestra el menu principal con estadisticas del sistema
+    void mostrarMenu() const {
+        // Limpia la pantalla (compatible Windows/Linux)
+        #ifdef _WIN32
+            system("cls");
+        #else
+            system("clear");
+        #endif
+        
+        cout << "\n---------------------------------------------------------------------------------" << endl;
+        cout << "                   SISTEMA DE PACIENTES" << endl;
+        cout << "---------------------------------------------------------------------------------" << endl;
+        cout << " 1. Cargar archivo de pacientes" << endl;
+        cout << " 2. Mostrar todos los pacientes registrados" << endl;
+        cout << " 3. Buscar pacientes (Boost Multi-Index)" << endl;
+        cout << " 4. Borrar registro" << endl;
+        cout << " 5. Buscar en LevelDB" << endl;
+        cout << " 6. Sincronizar con LevelDB" << endl;
+        cout << " 7. Actualizar paciente" << endl;
+        cout << " 8. Reportes agregados" << endl;
+        cout << " 9. Estadisticas de rendimiento" << endl;
+        cout << " 10. Salir" << endl;
+        cout << "---------------------------------------------------------------------------------" << endl;
+        // Muestra estadisticas en tiempo real
+        cout << " Pacientes en memoria: " << sistema.getCantidadPacientes() << endl;
+        cout << " Pacientes en Base de datos: " << sistema.getCantidadLevelDB() << endl;
+        cout << " Memoria real de pacientes: " << (sistema.usoMemoria().totalPacientes() / 1024.0 / 1024.0) << " MB" << endl;
+        cout << " Tamano total de archivos: " << (sistema.pesoEnMemoria() / 1024.0 / 1024.0) << " MB" << endl;
+        if (sistema.esAcotado()) {
+            InstantaneaRendimiento instantanea = estadisticas().instantanea();
+            uint64_t aciertos = instantanea.contadores[(size_t) ContadorRendimiento::CACHE_ACIERTOS];
+            uint64_t fallos = instantanea.contadores[(size_t) ContadorRendimiento::CACHE_FALLOS];
+            cout << " Modo acotado, aciertos de la cache de registros: "
+                 << (aciertos + fallos > 0 ? 100.0 * aciertos / (aciertos + fallos) : 0.0) << " %" << endl;
+        }
+        if (!sistema.isDBConnected()) {
+            cout << " Estado BD: DESCONECTADO" << endl;
+        } else {
+            cout << " Estado BD: CONECTADO" << endl;
+        }
+        cout << "---------------------------------------------------------------------------------" << endl;
+    }
+    
+    // Pide un nombre de archivo y elimina espacios finales
+    // Devuelve cadena vacia si el nombre no es valido
+    string leerNombreArchivo() const {
+        string nombreArchivo;
+        cout << "Ingrese el nombre del archivo(ej: pacientes.txt): ";
+        getline(cin, nombreArchivo);
+        
+        // Limpia espacios en blanco
+        if (!nombreArchivo.empty()) {
+            nombreArchivo.erase(nombreArchivo.find_last_not_of(" \n\r\t") + 1);
+        }
+        
+        if (nombreArchivo.empty()) {
+            cout << "Nombre de archivo no valido." << endl;
+        }
+        return nombreArchivo;
+    }
+
+    // Submenu de carga: completa, incremental, siguiendo el archivo o un directorio
+    void subMenuCarga() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "----------------------------------------------------" << endl;
+            cout << "\n                 CARGA DE PACIENTES               " << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " 1. Cargar archivo completo" << endl;
+            cout << " 2. Recargar solo lineas nuevas" << endl;
+            cout << " 3. Seguir archivo (modo tail)" << endl;
+            cout << " 4. Cargar todos los archivos de un directorio" << endl;
+            cout << " 5. Volver al menu principal" << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+
+            cin.ignore();
+
+            if (opcion == 4) {
+                string directorio;
+                cout << "Ingrese el directorio: ";
+                getline(cin, directorio);
+                if (!directorio.empty()) {
+                    sistema.cargarDirectorio(directorio, max(thread::hardware_concurrency(), 1u));
+                }
+            } else if (opcion >= 1 && opcion <= 3) {
+                string nombreArchivo = leerNombreArchivo();
+                if (!nombreArchivo.empty()) {
+                    switch (opcion) {
+                        case 1:
+                            if (sistema.cargarDesdeArchivoCompacto(nombreArchivo)) {
+                                cout << "Archivo cargado exitosamente." << endl;
+                            } else {
+                                cout << "Error al cargar el archivo compacto." << endl;
+                            }
+                            break;
+                        case 2:
+                            sistema.recargarIncremental(nombreArchivo);
+                            break;
+                        case 3: {
+                            // El seguimiento corre en otro hilo mientras este espera la tecla Enter
+                            atomic<bool> detener(false);
+                            cout << "Siguiendo " << nombreArchivo << ". Presione Enter para detener..." << endl;
+                            thread seguidor([this, &nombreArchivo, &detener]() {
+                                sistema.seguirArchivo(nombreArchivo, detener);
+                            });
+                            cin.get();
+                            detener = true;
+                            seguidor.join();
+                            cout << "Seguimiento detenido." << endl;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (opcion != 5) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+
+        } while (opcion != 5);
+    }
+
+    // Submenu para busquedas usando Boost Multi-Index
+    void subMenuBusqueda() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "-------------------------------------------------------" << endl;
+            cout << "\n           BUSQUEDA CON BOOST MULTI-INDEX           " << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " 1. Buscar por nombre " << endl;
+            cout << " 2. Buscar por ID" << endl;
+            cout << " 3. Buscar por modalidad " << endl;
+            cout << " 4. Buscar por sexo" << endl;
+            cout << " 5. Busqueda exacta por ID" << endl;
+            cout << " 6. Volver al menu principal" << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+            
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+            
+            cin.ignore();
+            
+            if (opcion >= 1 && opcion <= 5) {
+                string termino;
+                vector<DataPaciente> resultados;
+                
+                switch(opcion) {
+                    case 1: 
+                        cout << "Ingrese el nombre o parte del nombre: ";
+                        getline(cin, termino);
+                        resultados = sistema.buscarPorNombre(termino); 
+                        cout << "[Busqueda en indice ordenado por nombre:]" << endl;
+                        break;
+                    case 2: 
+                        cout << "Ingrese el ID o parte del ID: ";
+                        getline(cin, termino);
+                        resultados = sistema.buscarPorID(termino); 
+                        cout << "[Busqueda en indice unico por ID:]" << endl;
+                        break;
+                    case 3: 
+                        cout << "Ingrese la modalidad (CT, MRI, XRAY, US, PET): ";
+                        getline(cin, termino);
+                        resultados = sistema.buscarPorModalidad(termino); 
+                        cout << "[Busqueda en indice agrupado por modalidad:]" << endl;
+                        break;
+                    case 4: 
+                        cout << "Ingrese el sexo (M, F, Otro): ";
+                        getline(cin, termino);
+                        resultados = sistema.buscarPorSexo(termino); 
+                        cout << "[Busqueda en indice agrupado por sexo:]" << endl;
+                        break;
+                    case 5:
+                        cout << "Ingrese el ID exacto: ";
+                        getline(cin, termino);
+                        {
+                            // Busqueda exacta que devuelve puntero para mayor eficiencia
+                            DataPaciente* resultadoExacto = sistema.buscarExactoPorID(termino);
+                            if (resultadoExacto != nullptr) {
+                                cout << "---------------------------------------------------------------------------------" << endl;
+                                cout << "                                RESULTADO EXACTO                                 " << endl;
+                                cout << "---------------------------------------------------------------------------------" << endl;
+                                resultadoExacto->mostrarInfo();
+                                delete resultadoExacto; // Liberar memoria
+                            } else {
+                                cout << "No se encontro paciente con ID: " << termino << endl;
+                            }
+                        }
+                        cout << "[Busqueda exacta en indice unico:]" << endl;
+                        break;
+                }
+                
+                // Muestra resultados para busquedas multiples
+                if (opcion >= 1 && opcion <= 4) {
+                    mostrarResultadosBusqueda(resultados);
+                }
+                
+                if (!resultados.empty() || opcion == 5) {
+                    cout << "\nPresione Enter para continuar...";
+                    cin.get();
+                }
+            }
+            
+        } while (opcion != 6);
+    }
+    
+    // Submenu de reportes sobre las tablas de agregados (pacientes en LevelDB)
+    void subMenuReportes() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "-------------------------------------------------------" << endl;
+            cout << "\n                REPORTES AGREGADOS                 " << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " 1. Por modalidad" << endl;
+            cout << " 2. Por sexo" << endl;
+            cout << " 3. Por mes de estudio" << endl;
+            cout << " 4. Agrupacion personalizada" << endl;
+            cout << " 5. Percentiles de tamano por modalidad (memoria)" << endl;
+            cout << " 6. Recalcular agregados y percentiles" << endl;
+            cout << " 7. Volver al menu principal" << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+
+            cin.ignore();
+
+            AgrupacionAgregados agrupacion;
+            switch (opcion) {
+                case 1: agrupacion.modalidad = true; break;
+                case 2: agrupacion.sexo = true; break;
+                case 3: agrupacion.mes = true; break;
+                case 4: {
+                    string dimensiones;
+                    cout << "Dimensiones separadas por coma (modalidad,sexo,mes; vacio = total): ";
+                    getline(cin, dimensiones);
+                    if (!parsearAgrupacion(dimensiones, agrupacion)) {
+                        cout << "Agrupacion no valida." << endl;
+                        opcion = 0;
+                    }
+                    break;
+                }
+                case 5:
+                    mostrarPercentilesTamano(sistema.distribucionTamanos(), cout);
+                    break;
+                case 6:
+                    sistema.recalcularAgregados();
+                    sistema.reconstruirDistribucion();
+                    cout << "Agregados y percentiles recalculados." << endl;
+                    break;
+            }
+            if (opcion >= 1 && opcion <= 4) {
+                mostrarReporteAgregados(sistema.reporteAgregados(agrupacion), cout);
+            }
+
+            if (opcion != 7) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+
+        } while (opcion != 7);
+    }
+
+    // Submenu de estadisticas de rendimiento (latencias, contadores y cerrojos)
+    void subMenuEstadisticas() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "-------------------------------------------------------" << endl;
+            cout << "\n             ESTADISTICAS DE RENDIMIENTO            " << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " 1. Latencias por operacion y contadores" << endl;
+            cout << " 2. Contencion de cerrojos" << endl;
+            cout << " 3. Uso real de memoria por indice y campo" << endl;
+            cout << " 4. Volcar estadisticas a archivo" << endl;
+            cout << " 5. Reiniciar estadisticas" << endl;
+            cout << " 6. Volver al menu principal" << endl;
+            cout << "-------------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+
+            cin.ignore();
+
+            switch (opcion) {
+                case 1:
+                    mostrarEstadisticasRendimiento(estadisticas().instantanea(), cout);
+                    break;
+                case 2:
+                    sistema.mostrarEstadisticasCerrojo();
+                    break;
+                case 3:
+                    mostrarUsoMemoria(sistema.usoMemoria(), cout);
+                    break;
+                case 4: {
+                    string ruta;
+                    cout << "Archivo de destino [estadisticas.txt]: ";
+                    getline(cin, ruta);
+                    if (ruta.empty()) ruta = "estadisticas.txt";
+                    if (volcarEstadisticasRendimiento(ruta)) cout << "Estadisticas agregadas a: " << ruta << endl;
+                    break;
+                }
+                case 5:
+                    estadisticas().reiniciar();
+                    sistema.reiniciarEstadisticasCerrojo();
+                    cout << "Estadisticas reiniciadas." << endl;
+                    break;
+            }
+
+            if (opcion != 6) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+
+        } while (opcion != 6);
+    }
+
+    // Submenu para corregir registros existentes sin borrarlos
+    void subMenuActualizacion() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "----------------------------------------------------" << endl;
+            cout << "\n              ACTUALIZACION DE PACIENTES          " << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " 1. Corregir tamano de archivo" << endl;
+            cout << " 2. Reclasificar modalidad" << endl;
+            cout << " 3. Editar nombre, fecha o sexo" << endl;
+            cout << " 4. Aplicar archivo de parches" << endl;
+            cout << " 5. Volver al menu principal" << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+
+            cin.ignore();
+
+            if (opcion >= 1 && opcion <= 3) {
+                string id;
+                cout << "Ingrese el ID del paciente: ";
+                getline(cin, id);
+
+                ActualizacionPaciente cambios;
+                string valor;
+                switch (opcion) {
+                    case 1:
+                        cout << "Nuevo tamano en bytes: ";
+                        getline(cin, valor);
+                        try {
+                            cambios.tamanoArchivo = stoll(valor);
+                        } catch (...) {
+                            cout << "Tamano no valido." << endl;
+                        }
+                        break;
+                    case 2:
+                        cout << "Nueva modalidad (CT, MRI, XRAY, US, PET): ";
+                        getline(cin, valor);
+                        if (!valor.empty()) cambios.modality = valor;
+                        break;
+                    case 3:
+                        // Un valor vacio conserva el dato actual
+                        cout << "Nuevo nombre (Enter para conservar): ";
+                        getline(cin, valor);
+                        if (!valor.empty()) cambios.patientName = valor;
+                        cout << "Nueva fecha AAAAMMDD (Enter para conservar): ";
+                        getline(cin, valor);
+                        if (!valor.empty()) cambios.studyDate = valor;
+                        cout << "Nuevo sexo M/F/O (Enter para conservar): ";
+                        getline(cin, valor);
+                        if (!valor.empty()) cambios.sex = valor;
+                        break;
+                }
+
+                if (cambios.vacia()) {
+                    cout << "No se indicaron cambios." << endl;
+                } else if (cambios.contieneSeparador()) {
+                    cout << "El caracter '|' no esta permitido en los datos del paciente." << endl;
+                } else if (sistema.actualizarPaciente(id, cambios)) {
+                    cout << "Paciente actualizado exitosamente." << endl;
+                } else {
+                    cout << "No se actualizo: el paciente no existe, los datos son iguales"
+                         << " o no se pudo guardar en LevelDB." << endl;
+                }
+            } else if (opcion == 4) {
+                string nombreArchivo;
+                cout << "Ingrese el archivo de parches (ID|campo=valor|...): ";
+                getline(cin, nombreArchivo);
+                sistema.actualizarDesdeArchivo(nombreArchivo);
+            }
+
+            if (opcion != 5) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+
+        } while (opcion != 5);
+    }
+
+    // Submenu para busquedas directas en LevelDB
+    void subMenuLevelDB() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+
+            cout << "\n------------------------------------------------------------------" << endl;
+            cout << "                 BUSQUEDA EN BASE DE DATOS (Clave-Valor)               " << endl;
+            cout << "------------------------------------------------------------------" << endl;
+            cout << " 1. Buscar por nombre" << endl;
+            cout << " 2. Buscar por ID" << endl;
+            cout << " 3. Buscar por modalidad" << endl;
+            cout << " 4. Buscar por sexo" << endl;
+            cout << " 5. Volver al menu principal" << endl;
+            cout << "------------------------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+            
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+            
+            cin.ignore();
+            
+            if (opcion >= 1 && opcion <= 4) {
+                string termino;
+                string campo;
+                
+                switch(opcion) {
+                    case 1: campo = "nombre"; break;
+                    case 2: campo = "_id"; break;  // Busqueda directa por clave
+                    case 3: campo = "modalidad"; break;
+                    case 4: campo = "sexo"; break;
+                }
+                
+                cout << "Ingrese el termino de busqueda: ";
+                getline(cin, termino);
+                
+                sistema.buscarEnLevelDB(campo, termino);
+                
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+            
+        } while (opcion != 5);
+    }
+    
+    // Submenu para operaciones de borrado
+    void subMenuBorrado() {
+        int opcion;
+        do {
+            #ifdef _WIN32
+                system("cls");
+            #else
+                system("clear");
+            #endif
+            
+            cout << "----------------------------------------------------" << endl;
+            cout << "\n                  MENU DE BORRADO                 " << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " 1. Borrar paciente por ID" << endl;
+            cout << " 2. Borrar todos los registros" << endl;
+            cout << " 3. Borrar pacientes por posicion" << endl;
+            cout << " 4. Borrar por criterio (modalidad, fechas, tamano)" << endl;
+            cout << " 5. Volver al menu principal" << endl;
+            cout << "----------------------------------------------------" << endl;
+            cout << " Seleccione una opcion: ";
+            
+            if (!(cin >> opcion)) {
+                cin.clear();
+                cin.ignore(10000, '\n');
+                cout << "Entrada no valida." << endl;
+                continue;
+            }
+            
+            cin.ignore();
+            
+            if (opcion == 1) {
+                // Verifica que haya pacientes antes de borrar
+                if (sistema.getCantidadPacientes() == 0) {
+                    cout << "No hay pacientes registrados para borrar." << endl;
+                    cout << "\nPresione Enter para continuar...";
+                    cin.get();
+                    continue;
+                }
+                
+                sistema.mostrarTodos();
+                cout << "Ingrese el ID del paciente a borrar: ";
+                string id;
+                getline(cin, id);
+                
+                if (id.empty()) {
+                    cout << "ID no valido." << endl;
+                } else {
+                    // Busca el paciente y pide confirmacion antes de borrar
+                    DataPaciente* paciente = sistema.buscarExactoPorID(id);
+                    if (paciente != nullptr) {
+                        cout << "Paciente encontrado: " << paciente->getPatientName() << endl;
+                        cout << "¿Esta seguro de que desea borrar este paciente? (s/n): ";
+                        char confirmacion;
+                        cin >> confirmacion;
+                        cin.ignore();
+                        
+                        if (confirmacion == 's' || confirmacion == 'S') {
+                            if (sistema.borrarPaciente(id)) {
+                                cout << "Paciente borrado exitosamente." << endl;
+                            } else {
+                                cout << "Error al borrar el paciente." << endl;
+                            }
+                        } else {
+                            cout << "Operacion cancelada." << endl;
+                        }
+                        delete paciente;
+                    } else {
+                        cout << "No se encontro paciente con ID: " << id << endl;
+                    }
+                }
+                
+            } else if (opcion == 2) {
+                // Borrado masivo con confirmacion
+                cout << "¿Esta seguro de que desea borrar todos los registros? (s/n): ";
+                char confirmacion;
+                cin >> confirmacion;
+                cin.ignore();
+                
+                if (confirmacion == 's' || confirmacion == 'S') {
+                    sistema.borrarTodos();
+                } else {
+                    cout << "Operacion cancelada." << endl;
+                }
+
+            } else if (opcion == 3) {
+                // Borrado por lotes usando las posiciones mostradas en el listado
+                cout << "Ingrese las posiciones a borrar separadas por espacios (ej: 1 5 12): ";
+                string linea;
+                getline(cin, linea);
+
+                vector<size_t> posiciones;
+                size_t inicio = 0;
+                while (inicio < linea.size()) {
+                    size_t fin = linea.find(' ', inicio);
+                    if (fin == string::npos) fin = linea.size();
+                    string token = linea.substr(inicio, fin - inicio);
+                    try {
+                        long valor = token.empty() ? 0 : stol(token);
+                        if (valor >= 1) posiciones.push_back((size_t) valor - 1);  // El listado empieza en 1
+                    } catch (...) {
+                        cout << "Posicion ignorada: " << token << endl;
+                    }
+                    inicio = fin + 1;
+                }
+
+                if (posiciones.empty()) {
+                    cout << "No se indicaron posiciones validas." << endl;
+                } else {
+                    size_t borrados = sistema.borrarPacientesPorPosicion(posiciones);
+                    cout << "Pacientes borrados: " << borrados << endl;
+                }
+
+            } else if (opcion == 4) {
+                // Purga masiva: cada condicion vacia se ignora
+                CriterioBorrado criterio;
+                string valor;
+                cout << "Modalidad (Enter para cualquiera): ";
+                getline(cin, valor);
+                if (!valor.empty()) criterio.modality = valor;
+                cout << "Fecha desde AAAAMMDD (Enter para sin limite): ";
+                getline(cin, valor);
+                if (!valor.empty()) criterio.fechaDesde = valor;
+                cout << "Fecha hasta AAAAMMDD (Enter para sin limite): ";
+                getline(cin, valor);
+                if (!valor.empty()) criterio.fechaHasta = valor;
+                try {
+                    cout << "Tamano minimo en bytes (Enter para sin limite): ";
+                    getline(cin, valor);
+                    if (!valor.empty()) criterio.tamanoMinimo = stoll(valor);
+                    cout << "Tamano maximo en bytes (Enter para sin limite): ";
+                    getline(cin, valor);
+                    if (!valor.empty()) criterio.tamanoMaximo = stoll(valor);
+                } catch (...) {
+                    cout << "Tamano no valido." << endl;
+                    criterio = CriterioBorrado();
+                }
+
+                if (criterio.vacio()) {
+                    cout << "Debe indicar al menos una condicion." << endl;
+                } else {
+                    cout << "¿Esta seguro de que desea borrar los pacientes que cumplen el criterio? (s/n): ";
+                    char confirmacion;
+                    cin >> confirmacion;
+                    cin.ignore();
+
+                    if (confirmacion == 's' || confirmacion == 'S') {
+                        sistema.borrarPorCriterio(criterio);
+                    } else {
+                        cout << "Operacion cancelada." << endl;
+                    }
+                }
+            }
+
+            if (opcion != 5) {
+                cout << "\nPresione Enter para continuar...";
+                cin.get();
+            }
+
+        } while (opcion != 5);
+    }
+};
+
+#endif  // SIN_MENU
+
+
+// Benchmark de lectores concurrentes
+// Mide busquedas por ID por segundo con 1, 2, 4... y hilosMax lectores mientras
+// un hilo escritor ingesta lotes sinteticos sin pausa. Usa una base temporal propia.
+// Con fragmentos > 0 mide el modo fragmentado.
+void benchLecturasConcurrentes(const string& nombreArchivo, int hilosMax, int segundos, size_t fragmentos) {
+    const string rutaBench = "./leveldb_bench";
+    filesystem::remove_all(rutaBench);
+    {
+        SistemaPacientes sistema(rutaBench, fragmentos);
+        if (!sistema.cargarDesdeArchivoCompacto(nombreArchivo)) {
+            cerr << "Error: no se pudieron cargar pacientes para el benchmark" << endl;
+            return;
+        }
+
+        // IDs existentes para las consultas de los lectores
+        vector<string> ids;
+        ifstream archivo(nombreArchivo);
+        string linea;
+        while (getline(archivo, linea)) {
+            DataPaciente paciente;
+            if (!linea.empty() && linea[0] != '#' && paciente.cargarDesdeFormatoCompacto(linea)) {
+                ids.push_back(paciente.getPatientID());
+            }
+        }
+
+        cout << "\nHilos lectores | Consultas/s | Consultas/s por hilo | Insertados/s" << endl;
+        long contadorSintetico = 0;
+        // hilosMax siempre es el ultimo punto, aunque no sea potencia de 2
+        vector<int> puntos;
+        for (int hilos = 1; hilos < hilosMax; hilos *= 2) puntos.push_back(hilos);
+        puntos.push_back(hilosMax);
+        for (int hilos : puntos) {
+            atomic<bool> detener(false);
+            atomic<long> consultas(0);
+            atomic<long> insertados(0);
+            sistema.reiniciarEstadisticasCerrojo();
+
+            // Escritor: lotes de 256 pacientes nuevos mientras dure la medicion
+            thread escritor([&]() {
+                vector<DataPaciente> lote;
+                while (!detener.load()) {
+                    lote.clear();
+                    for (int i = 0; i < 256; ++i) {
+                        DataPaciente paciente;
+                        paciente.cargarDesdeFormatoCompacto("BENCH" + to_string(contadorSintetico++) +
+                                                            "|Paciente Sintetico|20240101|CT|M|1048576");
+                        lote.push_back(paciente);
+                    }
+                    insertados += sistema.agregarPacientes(lote);
+                }
+            });
+
+            vector<thread> lectores;
+            for (int h = 0; h < hilos; ++h) {
+                lectores.emplace_back([&, h]() {
+                    mt19937_64 generador(h + 1);
+                    uniform_int_distribution<size_t> distribucion(0, ids.size() - 1);
+                    long propias = 0;
+                    while (!detener.load(memory_order_relaxed)) {
+                        sistema.buscarPorID(ids[distribucion(generador)]);
+                        propias++;
+                    }
+                    consultas += propias;
+                });
+            }
+
+            this_thread::sleep_for(chrono::seconds(segundos));
+            detener = true;
+            for (auto& lector : lectores) lector.join();
+            escritor.join();
+
+            double porSegundo = consultas.load() / (double) segundos;
+            cout << hilos << " | " << (long) porSegundo << " | " << (long) (porSegundo / hilos)
+                 << " | " << insertados.load() / segundos << endl;
+            sistema.mostrarEstadisticasCerrojo();
+        }
+    }
+    filesystem::remove_all(rutaBench);
+}
+
+
+// Configuracion del generador de pacientes sinteticos
+struct ConfiguracionGenerador {
+    uint64_t cantidad = 1000000;                            // Filas a generar (incluye duplicados)
+    uint64_t semilla = 1;                                   // Misma semilla, misma salida
+    double proporcionDuplicados = 0.0;                      // Fraccion de filas que repiten un ID anterior
+    size_t hilos = max(thread::hardware_concurrency(), 1u); // Hilos que generan bloques
+};
+
+// Resultado de una generacion
+struct ResultadoGeneracion {
+    uint64_t filas = 0;        // Filas producidas
+    uint64_t duplicados = 0;   // Filas que repiten un ID (en LevelDB no se escriben)
+    uint64_t bytes = 0;        // Bytes escritos en el archivo
+    double segundos = 0;
+};
+
+
+// Clase GeneradorSintetico
+// Genera pacientes en formato compacto por bloques de FILAS_POR_BLOQUE filas. Cada bloque
+// usa su propio generador sembrado con (semilla, numero de bloque), y si una fila es un
+// duplicado depende solo de (semilla, fila), por lo que la salida es la misma con
+// cualquier cantidad de hilos. Nombres, sexo, modalidad y fecha siguen distribuciones
+// sesgadas (unos pocos valores muy frecuentes, fines de semana con menos estudios)
+class GeneradorSintetico {
+    private:
+        static const size_t FILAS_POR_BLOQUE = 65536;
+
+        ConfiguracionGenerador configuracion;
+        PoolHilos pool;
+
+        // Una fila generada antes de darle formato
+        struct FilaSintetica {
+            string id;
+            string nombre;
+            char fecha[36];
+            const char* modalidad;
+            char sexo;            // Codigo M, F u O
+            long long tamano;
+            bool duplicado;
+        };
+
+        // Paso de splitmix64: deriva valores independientes de la semilla
+        static uint64_t mezclar(uint64_t x) {
+            x += 0x9E3779B97F4A7C15ULL;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+            return x ^ (x >> 31);
+        }
+
+        // Real uniforme en [0, 1) con la misma secuencia en cualquier plataforma
+        static double uniforme(mt19937_64& generador) {
+            return (generador() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // Indice en [0, n) donde los primeros valores salen mucho mas seguido
+        static size_t elegirSesgado(mt19937_64& generador, size_t n) {
+            double u = uniforme(generador);
+            return min(n - 1, (size_t) (n * u * u));
+        }
+
+        static string idDe(uint64_t fila) {
+            char id[24];
+            snprintf(id, sizeof(id), "S%010llu", (unsigned long long) fila + 1);
+            return id;
+        }
+
+        // Si una fila repite un ID se decide solo con (semilla, fila)
+        bool esDuplicado(uint64_t fila) const {
+            if (fila == 0 || configuracion.proporcionDuplicados <= 0) return false;
+            return mezclar(configuracion.semilla ^ mezclar(fila)) <
+                   configuracion.proporcionDuplicados * 18446744073709551615.0;
+        }
+
+        // Fila original (no duplicada) anterior a 'fila', elegida de forma reproducible
+        uint64_t originalAnterior(uint64_t fila) const {
+            for (uint64_t intento = 1; ; ++intento) {
+                uint64_t candidata = mezclar(configuracion.semilla + fila * 0x100000001B3ULL + intento) % fila;
+                if (!esDuplicado(candidata)) return candidata;
+            }
+        }
+
+        void generarFila(mt19937_64& generador, uint64_t fila, FilaSintetica& salida) const {
+            static const char* const NOMBRES_F[] = {
+                "María", "Ana", "Carmen", "Laura", "Isabel", "Rosa", "Patricia", "Elena", "Lucía", "Sofía",
+                "Marta", "Claudia", "Valentina", "Paula", "Andrea", "Gabriela", "Camila", "Teresa", "Silvia", "Daniela"
+            };
+            static const char* const NOMBRES_M[] = {
+                "José", "Juan", "Carlos", "Luis", "Jorge", "Pedro", "Miguel", "Francisco", "Manuel", "Diego",
+                "Andrés", "Javier", "Fernando", "Ricardo", "Pablo", "Sergio", "Alejandro", "Raúl", "Tomás", "Gabriel"
+            };
+            static const char* const APELLIDOS[] = {
+                "González", "Rodríguez", "Pérez", "Fernández", "López", "Martínez", "Sánchez", "García",
+                "Gómez", "Díaz", "Hernández", "Muñoz", "Rojas", "Romero", "Torres", "Flores", "Ramírez",
+                "Castro", "Vargas", "Morales", "Silva", "Ortiz", "Reyes", "Núñez", "Jiménez", "Ruiz",
+                "Álvarez", "Moreno", "Navarro", "Vega"
+            };
+            // Volumen relativo por modalidad (porcentaje acumulado)
+            static const char* const MODALIDADES[] = {"XRAY", "CT", "US", "MRI", "PET"};
+            static const int ACUMULADO_MODALIDAD[] = {40, 62, 82, 94, 100};
+            static const int DIAS_MES[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+            salida.duplicado = esDuplicado(fila);
+            salida.id = idDe(salida.duplicado ? originalAnterior(fila) : fila);
+
+            // Sexo: 51% F, 48% M, 1% O
+            double u = uniforme(generador);
+            salida.sexo = u < 0.51 ? 'F' : (u < 0.99 ? 'M' : 'O');
+            const char* const* nombres = salida.sexo == 'F' ? NOMBRES_F :
+                                         salida.sexo == 'M' ? NOMBRES_M : (u < 0.995 ? NOMBRES_F : NOMBRES_M);
+            salida.nombre = nombres[elegirSesgado(generador, 20)];
+            salida.nombre += ' ';
+            salida.nombre += APELLIDOS[elegirSesgado(generador, 30)];
+            salida.nombre += ' ';
+            salida.nombre += APELLIDOS[elegirSesgado(generador, 30)];
+
+            int porcentaje = (int) (uniforme(generador) * 100);
+            int m = 0;
+            while (porcentaje >= ACUMULADO_MODALIDAD[m]) m++;
+            salida.modalidad = MODALIDADES[m];
+
+            // Fecha entre 2015 y 2024 (01/01/2015 es jueves); un dia de fin de semana
+            // sorteado solo se acepta el 30% de las veces
+            int dia;
+            do {
+                dia = (int) (generador() % 3653);
+            } while ((dia + 3) % 7 >= 5 && uniforme(generador) >= 0.3);
+            int anio = 2015;
+            while (dia >= (anio % 4 == 0 ? 366 : 365)) {
+                dia -= (anio % 4 == 0 ? 366 : 365);
+                anio++;
+            }
+            int mes = 0;
+            while (dia >= DIAS_MES[mes] + (mes == 1 && anio % 4 == 0 ? 1 : 0)) {
+                dia -= DIAS_MES[mes] + (mes == 1 && anio % 4 == 0 ? 1 : 0);
+                mes++;
+            }
+            snprintf(salida.fecha, sizeof(salida.fecha), "%04d%02d%02d", anio, mes + 1, dia + 1);
+
+            salida.tamano = DataPaciente::generarTamanoPorModalidad(salida.modalidad, generador);
+        }
+
+        // Genera las filas de un bloque y llama a 'consumir' con cada una
+        template <typename Consumidor>
+        void generarBloque(uint64_t bloque, Consumidor consumir) const {
+            mt19937_64 generador(mezclar(configuracion.semilla ^ mezclar(bloque + 1)));
+            uint64_t desde = bloque * FILAS_POR_BLOQUE;
+            uint64_t hasta = min<uint64_t>(configuracion.cantidad, desde + FILAS_POR_BLOQUE);
+            FilaSintetica fila;
+            for (uint64_t i = desde; i < hasta; ++i) {
+                generarFila(generador, i, fila);
+                consumir(fila);
+            }
+        }
+
+        uint64_t cantidadBloques() const {
+            return (configuracion.cantidad + FILAS_POR_BLOQUE - 1) / FILAS_POR_BLOQUE;
+        }
+
+        // Procesa los bloques en rondas de un bloque por hilo; 'ronda' recibe el primer
+        // bloque y la cantidad, y devuelve cuando todos terminaron
+        void recorrerRondas(const function<void(uint64_t, size_t)>& ronda) {
+            uint64_t bloques = cantidadBloques();
+            uint64_t siguienteAviso = bloques / 10;
+            for (uint64_t inicio = 0; inicio < bloques; inicio += pool.getNumHilos()) {
+                size_t enRonda = (size_t) min<uint64_t>(pool.getNumHilos(), bloques - inicio);
+                ronda(inicio, enRonda);
+                if (siguienteAviso > 0 && inicio + enRonda >= siguienteAviso) {
+                    registro().info("generador", "Generados " + to_string((inicio + enRonda) * 100 / bloques) + "%");
+                    siguienteAviso += bloques / 10;
+                }
+            }
+        }
+
+    public:
+        explicit GeneradorSintetico(const ConfiguracionGenerador& config)
+            : configuracion(config), pool(max<size_t>(config.hilos, 1)) {}
+
+        // Escribe las filas en un archivo compacto. En cada ronda los hilos generan un
+        // bloque cada uno en memoria y luego lo escriben en su posicion con pwrite
+        bool escribirArchivo(const string& ruta, ResultadoGeneracion& resultado) {
+            auto inicio = chrono::steady_clock::now();
+            int descriptor = open(ruta.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (descriptor < 0) {
+                cerr << "Error al crear archivo: " << ruta << endl;
+                return false;
+            }
+
+            resultado = ResultadoGeneracion();
+            atomic<bool> error(false);
+            atomic<uint64_t> duplicados(0);
+            off_t desplazamiento = 0;
+            recorrerRondas([&](uint64_t primerBloque, size_t enRonda) {
+                vector<string> textos(enRonda);
+                vector<future<void>> pendientes;
+                for (size_t b = 0; b < enRonda; ++b) {
+                    pendientes.push_back(pool.encolar([&, b]() {
+                        string& texto = textos[b];
+                        texto.reserve(FILAS_POR_BLOQUE * 64);
+                        uint64_t propios = 0;
+                        generarBloque(primerBloque + b, [&](const FilaSintetica& fila) {
+                            texto += fila.id;
+                            texto += '|';
+                            texto += fila.nombre;
+                            texto += '|';
+                            texto += fila.fecha;
+                            texto += '|';
+                            texto += fila.modalidad;
+                            texto += '|';
+                            texto += fila.sexo;
+                            texto += '|';
+                            texto += to_string(fila.tamano);
+                            texto += '\n';
+                            if (fila.duplicado) propios++;
+                        });
+                        duplicados += propios;
+                    }));
+                }
+                for (auto& pendiente : pendientes) pendiente.get();
+
+                // Con los tamanos conocidos cada bloque se escribe en paralelo en su posicion
+                pendientes.clear();
+                for (size_t b = 0; b < enRonda; ++b) {
+                    off_t posicion = desplazamiento;
+                    desplazamiento += textos[b].size();
+                    pendientes.push_back(pool.encolar([&, b, posicion]() {
+                        const string& texto = textos[b];
+                        size_t escritos = 0;
+                        while (escritos < texto.size()) {
+                            ssize_t n = pwrite(descriptor, texto.data() + escritos, texto.size() - escritos,
+                                               posicion + escritos);
+                            if (n <= 0) {
+                                error = true;
+                                return;
+                            }
+                            escritos += n;
+                        }
+                    }));
+                }
+                for (auto& pendiente : pendientes) pendiente.get();
+            });
+            close(descriptor);
+
+            if (error) {
+                cerr << "Error escribiendo en: " << ruta << endl;
+                return false;
+            }
+            resultado.filas = configuracion.cantidad;
+            resultado.duplicados = duplicados.load();
+            resultado.bytes = desplazamiento;
+            resultado.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            return true;
+        }
+
+        // Escribe los pacientes directamente en LevelDB, un WriteBatch por bloque desde
+        // cada hilo. Las filas duplicadas se omiten, igual que al cargar el archivo
+        bool cargarEnLevelDB(const string& rutaBD, ResultadoGeneracion& resultado) {
+            auto inicio = chrono::steady_clock::now();
+            LevelDBManager leveldb(rutaBD);
+            if (!leveldb.isConnected()) return false;
+            // Las filas se escriben sin registro de cambios: saltar una secuencia y recortar
+            // el registro descarta las instantaneas tomadas antes de la generacion
+            leveldb.configurarRegistroCambios(false);
+
+            resultado = ResultadoGeneracion();
+            atomic<bool> error(false);
+            atomic<uint64_t> duplicados(0);
+            recorrerRondas([&](uint64_t primerBloque, size_t enRonda) {
+                vector<future<void>> pendientes;
+                for (size_t b = 0; b < enRonda; ++b) {
+                    pendientes.push_back(pool.encolar([&, b]() {
+                        leveldb::WriteBatch lote;
+                        uint64_t propios = 0;
+                        PacienteData paciente;  // Se reutiliza para no reservar memoria por fila
+                        generarBloque(primerBloque + b, [&](const FilaSintetica& fila) {
+                            if (fila.duplicado) {
+                                propios++;
+                                return;
+                            }
+                            paciente.patientName = fila.nombre;
+                            paciente.studyDate = fila.fecha;
+                            paciente.modality = fila.modalidad;
+                            paciente.sex = convertirCodigoSexo(string(1, fila.sexo));
+                            paciente.tamanoArchivo = fila.tamano;
+                            lote.Put(fila.id, EsquemaPaciente::serializar(paciente));
+                        });
+                        duplicados += propios;
+                        if (!leveldb.aplicarLote(lote)) error = true;
+                    }));
+                }
+                for (auto& pendiente : pendientes) pendiente.get();
+            });
+
+            if (error) return false;
+            resultado.filas = configuracion.cantidad;
+            resultado.duplicados = duplicados.load();
+            resultado.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            // Al abrir la base, SistemaPacientes recalcula los agregados porque no cubren estas
+            // altas, y descarta la instantanea anterior por el registro de cambios recortado
+            return true;
+        }
+};
+
+
+// Resultado de exportar o importar un respaldo
+struct ResultadoRespaldo {
+    uint64_t registros = 0;
+    uint64_t invalidos = 0;       // Lineas que no se pudieron leer (solo al importar)
+    size_t partes = 0;
+    uint64_t bytesTexto = 0;      // Bytes del formato compacto sin comprimir
+    uint64_t bytesComprimidos = 0;
+    double segundos = 0;
+};
+
+// Clase RespaldoLevelDB
+// Exporta la base a partes comprimidas (gzip) en el formato compacto ID|nombre|...
+// y las vuelve a importar. La exportacion lee una vista fija de LevelDB, la reparte
+// en rangos de IDs de tamano parecido y comprime cada rango en un hilo del pool; el
+// manifiesto (escrito al final, cuando todas las partes estan completas) lista cada
+// parte con su rango, registros, bytes y CRC32. La importacion lee las partes en
+// paralelo, verifica su CRC32 antes de escribir y escribe en lotes grandes.
+class RespaldoLevelDB {
+    private:
+        static const int NIVEL_COMPRESION = 1;             // Prioriza velocidad sobre tamano
+        static const size_t TAMANO_BUFFER = 256 * 1024;    // Bytes por llamada a gzwrite/gzread
+        static const size_t TAMANO_LOTE = 4 * 1024 * 1024; // Bytes por WriteBatch al importar
+        static const size_t PARTES_POR_HILO = 4;           // Rangos de mas para repartir mejor la carga
+        static const size_t MUESTRAS_POR_PARTE = 16;
+
+        // Una parte del respaldo: rango [desde, hasta) de IDs (vacio = sin limite)
+        struct ParteRespaldo {
+            string archivo;
+            string desde;
+            string hasta;
+            uint64_t registros = 0;
+            uint64_t bytesTexto = 0;
+            uint64_t bytesComprimidos = 0;
+            uint32_t crc = 0;
+        };
+
+        PoolHilos pool;
+
+        static string rutaEn(const string& directorio, const string& archivo) {
+            return (filesystem::path(directorio) / archivo).string();
+        }
+
+        // Limites de 'partes' rangos con cantidades parecidas de pacientes, a partir de
+        // una muestra de claves tomada en una pasada con memoria acotada (como el arbol
+        // de reconciliacion): cuando la muestra se llena se descarta una de cada dos
+        vector<string> limitesDeRangos(const LevelDBManager& leveldb, const leveldb::Snapshot* vista,
+                                       size_t partes) const {
+            vector<string> muestra;
+            size_t paso = 1;
+            size_t i = 0;
+            size_t maximo = max<size_t>(2 * partes * MUESTRAS_POR_PARTE, 2);
+            leveldb.recorrerRango(nullptr, nullptr, [&](const leveldb::Slice& clave, const leveldb::Slice&) {
+                if (i++ % paso != 0) return;
+                muestra.push_back(clave.ToString());
+                if (muestra.size() >= maximo) {
+                    size_t j = 0;
+                    for (size_t k = 0; k < muestra.size(); k += 2) muestra[j++] = muestra[k];
+                    muestra.resize(j);
+                    paso *= 2;
+                }
+            }, vista);
+
+            vector<string> limites;
+            for (size_t k = 1; k < partes && muestra.size() > 1; ++k) {
+                const string& limite = muestra[k * muestra.size() / partes];
+                if (limite != muestra.front() && (limites.empty() || limite != limites.back())) {
+                    limites.push_back(limite);
+                }
+            }
+            return limites;
+        }
+
+        // Escribe una parte: las entradas de su rango en la vista, comprimidas
+        bool exportarParte(const LevelDBManager& leveldb, const leveldb::Snapshot* vista,
+                           const string& directorio, ParteRespaldo& parte) const {
+            string ruta = rutaEn(directorio, parte.archivo);
+            char modo[8];
+            snprintf(modo, sizeof(modo), "wb%d", NIVEL_COMPRESION);
+            gzFile archivo = gzopen(ruta.c_str(), modo);
+            if (!archivo) return false;
+            gzbuffer(archivo, TAMANO_BUFFER);
+
+            string buffer;
+            buffer.reserve(TAMANO_BUFFER + 1024);
+            bool correcto = true;
+            uLong crc = crc32(0L, Z_NULL, 0);
+            auto vaciar = [&]() {
+                if (buffer.empty() || !correcto) return;
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()), buffer.size());
+                correcto = gzwrite(archivo, buffer.data(), buffer.size()) == (int) buffer.size();
+                parte.bytesTexto += buffer.size();
+                buffer.clear();
+            };
+            // La linea compacta es la clave y el valor guardado unidos por '|'
+            leveldb.recorrerRango(parte.desde.empty() ? nullptr : &parte.desde,
+                                  parte.hasta.empty() ? nullptr : &parte.hasta,
+                                  [&](const leveldb::Slice& clave, const leveldb::Slice& valor) {
+                buffer.append(clave.data(), clave.size());
+                buffer += '|';
+                buffer.append(valor.data(), valor.size());
+                buffer += '\n';
+                parte.registros++;
+                if (buffer.size() >= TAMANO_BUFFER) vaciar();
+            }, vista);
+            vaciar();
+            correcto = gzclose(archivo) == Z_OK && correcto;
+            parte.crc = crc;
+
+            struct stat info;
+            if (correcto && stat(ruta.c_str(), &info) == 0) parte.bytesComprimidos = info.st_size;
+            return correcto;
+        }
+
+        // Recorre las lineas de una parte comprimida y acumula el CRC32 del texto.
+        // Devuelve false si no se pudo abrir o el archivo comprimido esta danado
+        template <typename FuncionLinea>
+        static bool recorrerLineasParte(const string& ruta, uLong& crc, FuncionLinea alLinea) {
+            gzFile archivo = gzopen(ruta.c_str(), "rb");
+            if (!archivo) {
+                cerr << "Error al abrir parte del respaldo: " << ruta << endl;
+                return false;
+            }
+            gzbuffer(archivo, TAMANO_BUFFER);
+
+            vector<char> buffer(TAMANO_BUFFER);
+            string pendiente;            // Linea cortada al final del bloque anterior
+            crc = crc32(0L, Z_NULL, 0);
+            auto procesarLinea = [&](string_view linea) {
+                if (!linea.empty() && linea.back() == '\r') linea.remove_suffix(1);
+                if (!linea.empty()) alLinea(linea);
+            };
+
+            int leido;
+            while ((leido = gzread(archivo, buffer.data(), buffer.size())) > 0) {
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()), leido);
+                string_view bloque(buffer.data(), leido);
+                size_t inicio = 0;
+                size_t salto;
+                while ((salto = bloque.find('\n', inicio)) != string_view::npos) {
+                    if (pendiente.empty()) {
+                        procesarLinea(bloque.substr(inicio, salto - inicio));
+                    } else {
+                        pendiente.append(bloque.data() + inicio, salto - inicio);
+                        procesarLinea(pendiente);
+                        pendiente.clear();
+                    }
+                    inicio = salto + 1;
+                }
+                pendiente.append(bloque.data() + inicio, bloque.size() - inicio);
+            }
+            gzclose(archivo);
+            if (leido != 0) return false;  // -1: archivo comprimido danado
+            procesarLinea(pendiente);
+            return true;
+        }
+
+        // Lee una parte y escribe sus pacientes en lotes. Antes de escribir nada se
+        // hace una pasada que solo descomprime y verifica registros y CRC32 contra el
+        // manifiesto, para que una parte danada no quede importada a medias
+        bool importarParte(LevelDBManager& leveldb, const string& directorio, const ParteRespaldo& parte,
+                           uint64_t& registros, uint64_t& invalidos) const {
+            string ruta = rutaEn(directorio, parte.archivo);
+            uLong crc = 0;
+            uint64_t leidos = 0;
+            bool legible = recorrerLineasParte(ruta, crc, [&leidos](string_view) { leidos++; });
+            if (!legible || crc != parte.crc || leidos != parte.registros) {
+                cerr << "La parte " << parte.archivo << " no coincide con el manifiesto (CRC32 o registros)." << endl;
+                return false;
+            }
+
+            leveldb::WriteBatch lote;
+            PacienteData paciente;       // Se reutiliza para validar cada linea
+            bool correcto = true;
+            legible = recorrerLineasParte(ruta, crc, [&](string_view linea) {
+                size_t barra = linea.find('|');
+                if (barra == 0 || barra == string_view::npos ||
+                    EsquemaPaciente::parsear(linea.substr(barra + 1), paciente) != 0) {
+                    invalidos++;
+                    return;
+                }
+                lote.Put(leveldb::Slice(linea.data(), barra),
+                         leveldb::Slice(linea.data() + barra + 1, linea.size() - barra - 1));
+                registros++;
+                if (lote.ApproximateSize() >= TAMANO_LOTE) {
+                    correcto = leveldb.aplicarLote(lote) && correcto;
+                    lote.Clear();
+                }
+            });
+            if (lote.ApproximateSize() > 12) correcto = leveldb.aplicarLote(lote) && correcto;
+            // El archivo podria haber cambiado entre las dos pasadas
+            correcto = legible && crc == parte.crc && correcto;
+            if (!correcto) cerr << "Error al importar la parte: " << ruta << endl;
+            return correcto;
+        }
+
+        // Lee el manifiesto: "respaldo|version|registros|partes" y una linea
+        // "parte|archivo|desde|hasta|registros|bytes|crc32" por parte
+        static bool leerManifiesto(const string& ruta, vector<ParteRespaldo>& partes) {
+            ifstream manifiesto(ruta);
+            if (!manifiesto.is_open()) {
+                cerr << "No se encontro el manifiesto del respaldo: " << ruta << endl;
+                return false;
+            }
+            string linea;
+            size_t esperadas = 0;
+            try {
+                while (getline(manifiesto, linea)) {
+                    vector<string> campos;
+                    stringstream lector(linea);
+                    string campo;
+                    while (getline(lector, campo, '|')) campos.push_back(campo);
+                    if (campos.size() == 4 && campos[0] == "respaldo") {
+                        if (campos[1] != "1") {
+                            cerr << "Version de respaldo no soportada: " << campos[1] << endl;
+                            return false;
+                        }
+                        esperadas = stoull(campos[3]);
+                    } else if (campos.size() == 7 && campos[0] == "parte") {
+                        ParteRespaldo parte;
+                        parte.archivo = campos[1];
+                        parte.desde = campos[2];
+                        parte.hasta = campos[3];
+                        parte.registros = stoull(campos[4]);
+                        parte.bytesTexto = stoull(campos[5]);
+                        parte.crc = (uint32_t) stoul(campos[6], nullptr, 16);
+                        partes.push_back(parte);
+                    } else if (!linea.empty()) {
+                        cerr << "Linea no valida en el manifiesto: " << linea << endl;
+                        return false;
+                    }
+                }
+            } catch (...) {
+                cerr << "Linea no valida en el manifiesto: " << linea << endl;
+                return false;
+            }
+            if (partes.empty() || partes.size() != esperadas) {
+                cerr << "El manifiesto esta incompleto: " << ruta << endl;
+                return false;
+            }
+            return true;
+        }
+
+    public:
+        static constexpr const char* MANIFIESTO = "manifiesto.txt";
+
+        explicit RespaldoLevelDB(size_t hilos) : pool(hilos) {}
+
+        // Exporta la base a 'directorio' (se crea si no existe) desde una vista fija:
+        // las escrituras concurrentes no aparecen a medias en el respaldo
+        bool exportar(const LevelDBManager& leveldb, const string& directorio, ResultadoRespaldo& resultado) {
+            auto inicio = chrono::steady_clock::now();
+            resultado = ResultadoRespaldo();
+            if (!leveldb.isConnected()) return false;
+            error_code error;
+            filesystem::create_directories(directorio, error);
+            if (error) {
+                cerr << "No se pudo crear el directorio del respaldo: " << directorio << endl;
+                return false;
+            }
+
+            const leveldb::Snapshot* vista = leveldb.abrirVista();
+            vector<string> limites = limitesDeRangos(leveldb, vista, pool.getNumHilos() * PARTES_POR_HILO);
+            vector<ParteRespaldo> partes(limites.size() + 1);
+            for (size_t i = 0; i < partes.size(); ++i) {
+                char nombre[32];
+                snprintf(nombre, sizeof(nombre), "parte-%05zu.txt.gz", i);
+                partes[i].archivo = nombre;
+                if (i > 0) partes[i].desde = limites[i - 1];
+                if (i < limites.size()) partes[i].hasta = limites[i];
+            }
+
+            vector<future<bool>> pendientes;
+            for (auto& parte : partes) {
+                ParteRespaldo* actual = &parte;
+                pendientes.push_back(pool.encolar([&, actual]() {
+                    return exportarParte(leveldb, vista, directorio, *actual);
+                }));
+            }
+            bool correcto = true;
+            for (auto& pendiente : pendientes) correcto = pendiente.get() && correcto;
+            leveldb.cerrarVista(vista);
+            if (!correcto) {
+                cerr << "Error al escribir las partes del respaldo en " << directorio << endl;
+                return false;
+            }
+
+            string ruta = rutaEn(directorio, MANIFIESTO);
+            ofstream manifiesto(ruta + ".tmp", ios::trunc);
+            for (const auto& parte : partes) {
+                resultado.registros += parte.registros;
+                resultado.bytesTexto += parte.bytesTexto;
+                resultado.bytesComprimidos += parte.bytesComprimidos;
+            }
+            manifiesto << "respaldo|1|" << resultado.registros << "|" << partes.size() << "\n";
+            char crc[16];
+            for (const auto& parte : partes) {
+                snprintf(crc, sizeof(crc), "%08x", parte.crc);
+                manifiesto << "parte|" << parte.archivo << "|" << parte.desde << "|" << parte.hasta << "|"
+                           << parte.registros << "|" << parte.bytesTexto << "|" << crc << "\n";
+            }
+            manifiesto.close();
+            if (!manifiesto || rename((ruta + ".tmp").c_str(), ruta.c_str()) != 0) {
+                cerr << "Error al escribir el manifiesto: " << ruta << endl;
+                return false;
+            }
+            resultado.partes = partes.size();
+            resultado.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            return true;
+        }
+
+        // Importa un respaldo completo (con manifiesto) a la base, parte por parte en
+        // paralelo. Los pacientes existentes con el mismo ID se reemplazan
+        bool importar(LevelDBManager& leveldb, const string& directorio, ResultadoRespaldo& resultado) {
+            auto inicio = chrono::steady_clock::now();
+            resultado = ResultadoRespaldo();
+            vector<ParteRespaldo> partes;
+            if (!leveldb.isConnected() || !leerManifiesto(rutaEn(directorio, MANIFIESTO), partes)) return false;
+
+            // Las partes se escriben sin registro de cambios: se salta una secuencia y se
+            // recorta el registro antes de empezar, asi ninguna instantanea anterior (ni
+            // una importacion interrumpida) se acepta al abrir la base
+            leveldb.configurarRegistroCambios(false);
+
+            atomic<uint64_t> registros(0);
+            atomic<uint64_t> invalidos(0);
+            vector<future<bool>> pendientes;
+            for (const auto& parte : partes) {
+                const ParteRespaldo* actual = &parte;
+                pendientes.push_back(pool.encolar([&, actual]() {
+                    uint64_t propios = 0;
+                    uint64_t propiosInvalidos = 0;
+                    bool correcto = importarParte(leveldb, directorio, *actual, propios, propiosInvalidos);
+                    registros += propios;
+                    invalidos += propiosInvalidos;
+                    return correcto;
+                }));
+            }
+            bool correcto = true;
+            for (auto& pendiente : pendientes) correcto = pendiente.get() && correcto;
+
+            // Las celdas de agregados ya no describen la base: se borran para que
+            // SistemaPacientes las recalcule al abrirla
+            leveldb::WriteBatch lote;
+            leveldb.recorrerPrefijo(TablaAgregados::PREFIJO, [&lote](const leveldb::Slice& clave, const leveldb::Slice&) {
+                lote.Delete(clave);
+            });
+            leveldb.aplicarLote(lote);
+
+            resultado.registros = registros.load();
+            resultado.invalidos = invalidos.load();
+            resultado.partes = partes.size();
+            for (const auto& parte : partes) resultado.bytesTexto += parte.bytesTexto;
+            resultado.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+            return correcto;
+        }
+};
+
+
+// Una medicion del banco de pruebas
+struct MedicionBench {
+    string operacion;
+    uint64_t tamano = 0;        // Pacientes del conjunto de datos
+    uint64_t iteraciones = 0;   // Operaciones (o filas, en la carga) medidas
+    double segundos = 0;
+};
+
+// Repite 'operacion(i)' hasta maxIteraciones o hasta agotar 'presupuesto' segundos
+// (siempre al menos una vez) y devuelve el tiempo medido
+template <typename Operacion>
+MedicionBench medirBench(const string& nombre, uint64_t tamano, uint64_t maxIteraciones,
+                         double presupuesto, Operacion operacion) {
+    MedicionBench medicion;
+    medicion.operacion = nombre;
+    medicion.tamano = tamano;
+    auto inicio = chrono::steady_clock::now();
+    do {
+        operacion(medicion.iteraciones++);
+        medicion.segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+    } while (medicion.iteraciones < maxIteraciones && medicion.segundos < presupuesto);
+    return medicion;
+}
+
+// Banco de pruebas de ingesta, busquedas y persistencia
+// Para cada tamano genera un conjunto sintetico reproducible (semilla fija) y mide:
+// carga desde archivo, cada buscarPor*, escaneos por campo de LevelDB (el recorrido
+// de buscarEnLevelDB, sin la salida por consola), contarPacientes, busquedas puntuales
+// en LevelDB con la cache de bloques vacia (fria) y llena (caliente) y eliminarTodos.
+// Cada medicion se agrega como una linea JSON a archivoSalida con la etiqueta dada
+// (por ejemplo el commit), para comparar corridas entre versiones.
+bool ejecutarBenchSuite(const vector<uint64_t>& tamanos, const string& archivoSalida,
+                        const string& etiqueta, size_t hilos) {
+    const string directorio = "./bench_suite_tmp";
+    const string rutaDatos = directorio + "/datos.txt";
+    const string rutaBD = directorio + "/bd";
+    const double PRESUPUESTO = 1.0;           // Segundos maximos por medicion repetida
+    const uint64_t CONSULTAS = 100000;        // Tope de consultas puntuales por medicion
+    const uint64_t CONSULTAS_RECORRIDO = 50;  // Tope de consultas que recorren muchos pacientes
+
+    ofstream salida(archivoSalida, ios::app);
+    if (!salida.is_open()) {
+        cerr << "Error al abrir archivo de resultados: " << archivoSalida << endl;
+        return false;
+    }
+
+    time_t ahora = time(nullptr);
+    char fecha[32];
+    strftime(fecha, sizeof(fecha), "%Y-%m-%dT%H:%M:%S", localtime(&ahora));
+
+    // Una linea por medicion; los textos son nombres fijos, sin caracteres a escapar
+    auto registrarMedicion = [&](const MedicionBench& m) {
+        double porSegundo = m.segundos > 0 ? m.iteraciones / m.segundos : 0;
+        double microsPorOperacion = m.iteraciones ? m.segundos * 1e6 / m.iteraciones : 0;
+        char linea[512];
+        snprintf(linea, sizeof(linea),
+                 "{\"etiqueta\":\"%s\",\"fecha\":\"%s\",\"operacion\":\"%s\",\"tamano\":%llu,"
+                 "\"iteraciones\":%llu,\"segundos\":%.6f,\"ops_por_segundo\":%.1f,\"us_por_op\":%.3f}\n",
+                 etiqueta.c_str(), fecha, m.operacion.c_str(), (unsigned long long) m.tamano,
+                 (unsigned long long) m.iteraciones, m.segundos, porSegundo, microsPorOperacion);
+        salida << linea;
+        salida.flush();
+        snprintf(linea, sizeof(linea), "%-26s %10llu %12llu %12.4f %14.1f %12.3f\n", m.operacion.c_str(),
+                 (unsigned long long) m.tamano, (unsigned long long) m.iteraciones, m.segundos,
+                 porSegundo, microsPorOperacion);
+        cout << linea << flush;
+    };
+
+    char encabezado[160];
+    snprintf(encabezado, sizeof(encabezado), "%-26s %10s %12s %12s %14s %12s\n",
+             "Operacion", "Tamano", "Iteraciones", "Segundos", "Ops/s", "us/op");
+    cout << encabezado;
+
+    for (uint64_t tamano : tamanos) {
+        filesystem::remove_all(directorio);
+        filesystem::create_directories(directorio);
+
+        ConfiguracionGenerador configuracion;
+        configuracion.cantidad = tamano;
+        configuracion.semilla = 2024;
+        configuracion.proporcionDuplicados = 0.01;
+        configuracion.hilos = hilos;
+        ResultadoGeneracion generados;
+        if (!GeneradorSintetico(configuracion).escribirArchivo(rutaDatos, generados)) return false;
+
+        // Terminos de busqueda tomados del propio conjunto de datos
+        vector<string> ids;
+        vector<string> apellidos;
+        {
+            SistemaPacientes sistema(rutaBD);
+
+            // Los mensajes de la carga no deben mezclarse con la tabla de resultados
+            streambuf* consola = cout.rdbuf(nullptr);
+            MedicionBench carga = medirBench("cargarDesdeArchivoCompacto", tamano, 1, 0,
+                                             [&](uint64_t) { sistema.cargarDesdeArchivoCompacto(rutaDatos); });
+            cout.rdbuf(consola);
+            carga.iteraciones = generados.filas;  // Se informa en filas por segundo
+            registrarMedicion(carga);
+
+            size_t cantidad = sistema.getCantidadPacientes();
+            mt19937_64 generador(tamano);
+            for (int i = 0; i < 1024 && cantidad > 0; ++i) {
+                optional<DataPaciente> paciente = sistema.obtenerPorPosicion(generador() % cantidad);
+                if (!paciente) continue;
+                ids.push_back(paciente->getPatientID());
+                string nombre = paciente->getPatientName();
+                apellidos.push_back(nombre.substr(nombre.find_last_of(' ') + 1));
+            }
+            if (ids.empty()) {
+                cerr << "Error: el conjunto de datos del benchmark quedo vacio" << endl;
+                return false;
+            }
+
+            const vector<string> modalidades = {"XRAY", "CT", "US", "MRI", "PET"};
+            const vector<string> sexos = {"Femenino", "Masculino", "Otro"};
+            registrarMedicion(medirBench("buscarPorID", tamano, CONSULTAS, PRESUPUESTO, [&](uint64_t i) {
+                sistema.buscarPorID(ids[i % ids.size()]);
+            }));
+            registrarMedicion(medirBench("buscarExactoPorID", tamano, CONSULTAS, PRESUPUESTO, [&](uint64_t i) {
+                delete sistema.buscarExactoPorID(ids[i % ids.size()]);
+            }));
+            registrarMedicion(medirBench("buscarPorNombre", tamano, CONSULTAS_RECORRIDO, PRESUPUESTO, [&](uint64_t i) {
+                sistema.buscarPorNombre(apellidos[i % apellidos.size()]);
+            }));
+            registrarMedicion(medirBench("buscarPorModalidad", tamano, CONSULTAS_RECORRIDO, PRESUPUESTO, [&](uint64_t i) {
+                sistema.buscarPorModalidad(modalidades[i % modalidades.size()]);
+            }));
+            registrarMedicion(medirBench("buscarPorSexo", tamano, CONSULTAS_RECORRIDO, PRESUPUESTO, [&](uint64_t i) {
+                sistema.buscarPorSexo(sexos[i % sexos.size()]);
+            }));
+
+            const vector<pair<string, vector<string>>> escaneos = {
+                {"nombre", apellidos}, {"modalidad", modalidades}, {"sexo", sexos}
+            };
+            for (const auto& escaneo : escaneos) {
+                vector<string> resultados;
+                registrarMedicion(medirBench("buscarEnLevelDB:" + escaneo.first, tamano, CONSULTAS_RECORRIDO,
+                                             PRESUPUESTO, [&](uint64_t i) {
+                    resultados.clear();
+                    sistema.consultarLevelDB(escaneo.first, escaneo.second[i % escaneo.second.size()], resultados);
+                }));
+            }
+        }
+
+        // Sin SistemaPacientes, cuyo constructor recorre la base y llenaria la cache
+        {
+            LevelDBManager leveldb(rutaBD);
+            uint64_t consultasFrias = min<uint64_t>(ids.size(), CONSULTAS);
+            registrarMedicion(medirBench("leveldb:get_frio", tamano, consultasFrias, 1e9, [&](uint64_t i) {
+                leveldb.buscarPacientePorID(ids[i]);
+            }));
+            registrarMedicion(medirBench("leveldb:get_caliente", tamano, CONSULTAS, PRESUPUESTO, [&](uint64_t i) {
+                leveldb.buscarPacientePorID(ids[i % ids.size()]);
+            }));
+            registrarMedicion(medirBench("contarPacientes", tamano, CONSULTAS_RECORRIDO, PRESUPUESTO, [&](uint64_t) {
+                leveldb.contarPacientes();
+            }));
+
+            streambuf* consola = cout.rdbuf(nullptr);
+            MedicionBench borrado = medirBench("eliminarTodos", tamano, 1, 0, [&](uint64_t) {
+                leveldb.eliminarTodos();
+            });
+            cout.rdbuf(consola);
+            borrado.iteraciones = generados.filas - generados.duplicados;  // En claves por segundo
+            registrarMedicion(borrado);
+        }
+    }
+
+    filesystem::remove_all(directorio);
+    cout << "Resultados agregados a: " << archivoSalida << endl;
+    return true;
+}
+
+
+// Muestra las opciones de linea de comandos
+void mostrarUso(const char* programa) {
+    cerr << "Uso:" << endl;
+#ifndef SIN_MENU
+    cerr << "  " << programa << " [--fragmentos <n> | --cache-mb <n>]" << endl;
+#endif
+    cerr << "  " << programa << " --lote <consultas> <salida> [opciones]" << endl;
+    cerr << "  " << programa << " --servidor <socket | tcp:puerto> [opciones]" << endl;
+    cerr << "  " << programa << " --volcar <tabla|csv|jsonl> <salida | -> [opciones]" << endl;
+    cerr << "  " << programa << " --reporte <modalidad,sexo,mes | total> [opciones]" << endl;
+    cerr << "  " << programa << " --percentiles [opciones]" << endl;
+    cerr << "  " << programa << " --memoria [opciones]" << endl;
+    cerr << "  " << programa << " --cliente-carga <socket | tcp:puerto> <solicitudes>"
+         << " [conexiones] [segundos] [profundidad]" << endl;
+    cerr << "  " << programa << " --bench-concurrencia <archivo> [hilos] [segundos] [fragmentos]" << endl;
+    cerr << "  " << programa << " --generar <cantidad> <archivo | bd:ruta>"
+         << " [--semilla <n>] [--duplicados <0-0.9>] [--hilos <n>]" << endl;
+    cerr << "  " << programa << " --bench <tamano,tamano...> [--salida <archivo.jsonl>] [--etiqueta <texto>]"
+         << " [--hilos <n>]" << endl;
+    cerr << "  " << programa << " --respaldo <directorio> [--bd <ruta>] [--hilos <n>]" << endl;
+    cerr << "  " << programa << " --restaurar <directorio> [--bd <ruta>] [--hilos <n>]" << endl;
+    cerr << "Opciones: --cargar <archivo | directorio> --hilos <n> --fragmentos <n> --cache-mb <n> --bd <ruta>"
+         << " --log <depuracion|info|advertencia|error> --estadisticas <archivo> --instantanea <archivo>" << endl;
+}
+
+// Opciones comunes de los modos sin menu (--lote, --servidor, --volcar, --reporte, --percentiles y --memoria)
+struct OpcionesModo {
+    string archivoCarga;                                    // Archivo compacto a cargar al inicio
+    string rutaBD = "./leveldb_data";                       // Directorio de LevelDB
+    size_t hilos = max(thread::hardware_concurrency(), 1u); // Hilos de trabajo
+    size_t fragmentos = 0;                                  // 0 = contenedor unico
+    size_t cacheMB = 0;                                     // > 0 = modo acotado con esa cache
+    string archivoEstadisticas;                             // Donde volcar las estadisticas al terminar
+    string archivoInstantanea;                              // Instantanea de la memoria (carga y guarda)
+};
+
+// Interpreta pares "--opcion valor" desde argv[desde]
+bool parsearOpcionesModo(int argc, char* argv[], int desde, OpcionesModo& opciones) {
+    for (int i = desde; i < argc; i += 2) {
+        string opcion = argv[i];
+        if (i + 1 >= argc) {
+            mostrarUso(argv[0]);
+            return false;
         }
-        
-        if (sistema.cargarDesdeArchivoCompacto(nombreArchivo)) {
-            cout << "Archivo cargado exitosamente." << endl;
-        } else {
-            cout << "Error al cargar el archivo compacto." << endl;
+        string valor = argv[i + 1];
+        try {
+            if (opcion == "--cargar") opciones.archivoCarga = valor;
+            else if (opcion == "--bd") opciones.rutaBD = valor;
+            else if (opcion == "--hilos") opciones.hilos = max(stoi(valor), 1);
+            else if (opcion == "--fragmentos") opciones.fragmentos = max(stoi(valor), 0);
+            else if (opcion == "--cache-mb") opciones.cacheMB = max(stoi(valor), 0);
+            else if (opcion == "--estadisticas") opciones.archivoEstadisticas = valor;
+            else if (opcion == "--instantanea") opciones.archivoInstantanea = valor;
+            else if (opcion == "--log") {
+                NivelLog nivel;
+                if (!parsearNivelLog(valor, nivel)) {
+                    cerr << "Nivel de registro no valido: " << valor << endl;
+                    return false;
+                }
+                registro().setNivel(nivel);
+            }
+            else {
+                mostrarUso(argv[0]);
+                return false;
+            }
+        } catch (...) {
+            cerr << "Valor no valido para " << opcion << ": " << valor << endl;
+            return false;
         }
     }
+    if (opciones.fragmentos > 0 && opciones.cacheMB > 0) {
+        cerr << "--fragmentos y --cache-mb no se pueden combinar." << endl;
+        return false;
+    }
+    return true;
+}
 
-    // Submenu para busquedas usando Boost Multi-Index
-    void subMenuBusqueda() {
-        int opcion;
-        do {
-            #ifdef _WIN32
-                system("cls");
-            #else
-                system("clear");
-            #endif
+// Carga el archivo (o el directorio de archivos) inicial indicado en las opciones, si lo hay
+void cargarSegunOpciones(SistemaPacientes& sistema, const OpcionesModo& opciones) {
+    if (opciones.archivoCarga.empty()) return;
+    bool cargado = filesystem::is_directory(opciones.archivoCarga)
+                       ? sistema.cargarDirectorio(opciones.archivoCarga, opciones.hilos) > 0
+                       : sistema.cargarDesdeArchivoCompacto(opciones.archivoCarga);
+    if (!cargado && sistema.getCantidadPacientes() == 0) {
+        cerr << "Advertencia: no hay pacientes en memoria; solo las consultas leveldb tendran resultados." << endl;
+    }
+}
 
-            cout << "-------------------------------------------------------" << endl;
-            cout << "\n           BUSQUEDA CON BOOST MULTI-INDEX           " << endl;
-            cout << "-------------------------------------------------------" << endl;
-            cout << " 1. Buscar por nombre " << endl;
-            cout << " 2. Buscar por ID" << endl;
-            cout << " 3. Buscar por modalidad " << endl;
-            cout << " 4. Buscar por sexo" << endl;
-            cout << " 5. Busqueda exacta por ID" << endl;
-            cout << " 6. Volver al menu principal" << endl;
-            cout << "-------------------------------------------------------" << endl;
-            cout << " Seleccione una opcion: ";
-            
-            if (!(cin >> opcion)) {
-                cin.clear();
-                cin.ignore(10000, '\n');
-                cout << "Entrada no valida." << endl;
-                continue;
+
+// Funcion principal del programa
+// Sin argumentos ejecuta el menu interactivo (salvo si se compila con -DSIN_MENU)
+// --lote <consultas> <salida> [opciones]: ejecuta consultas desde archivo sin menu
+// --servidor <socket | tcp:puerto> [opciones]: atiende consultas de otros procesos
+// --volcar <tabla|csv|jsonl> <salida | -> [opciones]: vuelca LevelDB en el formato indicado
+// --reporte <dimensiones> [opciones]: agregados de LevelDB agrupados por modalidad, sexo y/o mes
+// --percentiles [opciones]: p50/p95/p99 de tamanos por modalidad
+// --memoria [opciones]: memoria real por indice y campo, comparada con LevelDB
+// --cliente-carga <socket | tcp:puerto> <solicitudes> [...]: genera carga contra el servidor
+// --bench-concurrencia <archivo> [hilos] [segundos] [fragmentos]: benchmark de lectores concurrentes
+// --generar <cantidad> <archivo | bd:ruta> [...]: genera pacientes sinteticos reproducibles
+// --respaldo <directorio> [opciones]: exporta LevelDB a partes comprimidas con manifiesto
+// --restaurar <directorio> [opciones]: importa en paralelo un respaldo a LevelDB
+// --bench <tamanos> [...]: banco de pruebas de ingesta, busquedas y persistencia (JSON por linea)
+// --fragmentos <n>: menu interactivo con la memoria repartida en n fragmentos
+// --cache-mb <n>: menu interactivo en modo acotado (LevelDB y una cache de n MB)
+int main(int argc, char* argv[]) {
+
+    try {
+        size_t numFragmentos = 0;
+        size_t cacheMB = 0;
+        if (argc > 1) {
+            string modo = argv[1];
+            if (modo == "--bench-concurrencia" && argc > 2) {
+                int hilos = argc > 3 ? atoi(argv[3]) : (int) thread::hardware_concurrency();
+                int segundos = argc > 4 ? atoi(argv[4]) : 2;
+                int fragmentos = argc > 5 ? atoi(argv[5]) : 0;
+                benchLecturasConcurrentes(argv[2], max(hilos, 1), max(segundos, 1), max(fragmentos, 0));
+                return 0;
             }
-            
-            cin.ignore();
-            
-            if (opcion >= 1 && opcion <= 5) {
-                string termino;
-                vector<DataPaciente> resultados;
-                
-                switch(opcion) {
-                    case 1: 
-                        cout << "Ingrese el nombre o parte del nombre: ";
-                        getline(cin, termino);
-                        resultados = sistema.buscarPorNombre(termino); 
-                        cout << "[Busqueda en indice ordenado por nombre:]" << endl;
-                        break;
-                    case 2: 
-                        cout << "Ingrese el ID o parte del ID: ";
-                        getline(cin, termino);
-                        resultados = sistema.buscarPorID(termino); 
-                        cout << "[Busqueda en indice unico por ID:]" << endl;
-                        break;
-                    case 3: 
-                        cout << "Ingrese la modalidad (CT, MRI, XRAY, US, PET): ";
-                        getline(cin, termino);
-                        resultados = sistema.buscarPorModalidad(termino); 
-                        cout << "[Busqueda en indice agrupado por modalidad:]" << endl;
-                        break;
-                    case 4: 
-                        cout << "Ingrese el sexo (M, F, Otro): ";
-                        getline(cin, termino);
-                        resultados = sistema.buscarPorSexo(termino); 
-                        cout << "[Busqueda en indice agrupado por sexo:]" << endl;
-                        break;
-                    case 5:
-                        cout << "Ingrese el ID exacto: ";
-                        getline(cin, termino);
-                        {
-                            // Busqueda exacta que devuelve puntero para mayor eficiencia
-                            DataPaciente* resultadoExacto = sistema.buscarExactoPorID(termino);
-                            if (resultadoExacto != nullptr) {
-                                cout << "---------------------------------------------------------------------------------" << endl;
-                                cout << "                                RESULTADO EXACTO                                 " << endl;
-                                cout << "---------------------------------------------------------------------------------" << endl;
-                                resultadoExacto->mostrarInfo();
-                                delete resultadoExacto; // Liberar memoria
-                            } else {
-                                cout << "No se encontro paciente con ID: " << termino << endl;
-                            }
+            if (modo == "--bench" && argc > 2) {
+                vector<uint64_t> tamanos;
+                string archivoSalida = "bench_resultados.jsonl";
+                string etiqueta = "sin-etiqueta";
+                size_t hilos = max(thread::hardware_concurrency(), 1u);
+                try {
+                    string lista = argv[2];
+                    size_t inicio = 0;
+                    while (inicio < lista.size()) {
+                        size_t coma = lista.find(',', inicio);
+                        if (coma == string::npos) coma = lista.size();
+                        tamanos.push_back(stoull(lista.substr(inicio, coma - inicio)));
+                        inicio = coma + 1;
+                    }
+                    for (int i = 3; i + 1 < argc; i += 2) {
+                        string opcion = argv[i];
+                        if (opcion == "--salida") archivoSalida = argv[i + 1];
+                        else if (opcion == "--etiqueta") etiqueta = argv[i + 1];
+                        else if (opcion == "--hilos") hilos = max(stoi(argv[i + 1]), 1);
+                        else {
+                            mostrarUso(argv[0]);
+                            return 1;
                         }
-                        cout << "[Busqueda exacta en indice unico:]" << endl;
-                        break;
-                }
-                
-                // Muestra resultados para busquedas multiples
-                if (opcion >= 1 && opcion <= 4) {
-                    mostrarResultadosBusqueda(resultados);
+                    }
+                } catch (...) {
+                    mostrarUso(argv[0]);
+                    return 1;
                 }
-                
-                if (!resultados.empty() || opcion == 5) {
-                    cout << "\nPresione Enter para continuar...";
-                    cin.get();
+                if (tamanos.empty() || argc % 2 == 0) {
+                    mostrarUso(argv[0]);
+                    return 1;
                 }
+                registro().setNivel(NivelLog::ADVERTENCIA);
+                return ejecutarBenchSuite(tamanos, archivoSalida, etiqueta, hilos) ? 0 : 1;
             }
-            
-        } while (opcion != 6);
-    }
-    
-    // Submenu para busquedas directas en LevelDB
-    void subMenuLevelDB() {
-        int opcion;
-        do {
-            #ifdef _WIN32
-                system("cls");
-            #else
-                system("clear");
-            #endif
+            if (modo == "--generar" && argc > 3) {
+                ConfiguracionGenerador configuracion;
+                try {
+                    configuracion.cantidad = stoull(argv[2]);
+                    for (int i = 4; i + 1 < argc; i += 2) {
+                        string opcion = argv[i];
+                        if (opcion == "--semilla") configuracion.semilla = stoull(argv[i + 1]);
+                        else if (opcion == "--duplicados") configuracion.proporcionDuplicados = stod(argv[i + 1]);
+                        else if (opcion == "--hilos") configuracion.hilos = max(stoi(argv[i + 1]), 1);
+                        else {
+                            mostrarUso(argv[0]);
+                            return 1;
+                        }
+                    }
+                } catch (...) {
+                    mostrarUso(argv[0]);
+                    return 1;
+                }
+                if (argc % 2 == 1 || configuracion.proporcionDuplicados < 0 || configuracion.proporcionDuplicados > 0.9) {
+                    mostrarUso(argv[0]);
+                    return 1;
+                }
 
-            cout << "\n------------------------------------------------------------------" << endl;
-            cout << "                 BUSQUEDA EN BASE DE DATOS (Clave-Valor)               " << endl;
-            cout << "------------------------------------------------------------------" << endl;
-            cout << " 1. Buscar por nombre" << endl;
-            cout << " 2. Buscar por ID" << endl;
-            cout << " 3. Buscar por modalidad" << endl;
-            cout << " 4. Buscar por sexo" << endl;
-            cout << " 5. Volver al menu principal" << endl;
-            cout << "------------------------------------------------------------------" << endl;
-            cout << " Seleccione una opcion: ";
-            
-            if (!(cin >> opcion)) {
-                cin.clear();
-                cin.ignore(10000, '\n');
-                cout << "Entrada no valida." << endl;
-                continue;
+                GeneradorSintetico generador(configuracion);
+                ResultadoGeneracion resultado;
+                string destino = argv[3];
+                bool enBaseDatos = destino.compare(0, 3, "bd:") == 0;
+                bool correcto = enBaseDatos ? generador.cargarEnLevelDB(destino.substr(3), resultado)
+                                            : generador.escribirArchivo(destino, resultado);
+                if (!correcto) return 1;
+                cout << "Generadas " << resultado.filas << " filas (" << resultado.duplicados
+                     << " duplicadas) en " << resultado.segundos << " s";
+                if (!enBaseDatos) cout << ", " << resultado.bytes << " bytes";
+                cout << " -> " << destino << endl;
+                return 0;
             }
-            
-            cin.ignore();
-            
-            if (opcion >= 1 && opcion <= 4) {
-                string termino;
-                string campo;
-                
-                switch(opcion) {
-                    case 1: campo = "nombre"; break;
-                    case 2: campo = "_id"; break;  // Busqueda directa por clave
-                    case 3: campo = "modalidad"; break;
-                    case 4: campo = "sexo"; break;
+            if ((modo == "--respaldo" || modo == "--restaurar") && argc > 2) {
+                // Respaldo de LevelDB en partes comprimidas, o restauracion desde ellas
+                OpcionesModo opciones;
+                if (!parsearOpcionesModo(argc, argv, 3, opciones)) return 1;
+                LevelDBManager leveldb(opciones.rutaBD);
+                if (!leveldb.isConnected()) return 1;
+                RespaldoLevelDB respaldo(opciones.hilos);
+                ResultadoRespaldo resultado;
+                if (modo == "--respaldo") {
+                    if (!respaldo.exportar(leveldb, argv[2], resultado)) return 1;
+                    cout << "Exportados " << resultado.registros << " pacientes en " << resultado.partes
+                         << " partes (" << resultado.bytesTexto << " bytes, " << resultado.bytesComprimidos
+                         << " comprimidos) en " << resultado.segundos << " s -> " << argv[2] << endl;
+                    return 0;
                 }
-                
-                cout << "Ingrese el termino de busqueda: ";
-                getline(cin, termino);
-                
-                sistema.buscarEnLevelDB(campo, termino);
-                
-                cout << "\nPresione Enter para continuar...";
-                cin.get();
+                bool correcto = respaldo.importar(leveldb, argv[2], resultado);
+                cout << "Importados " << resultado.registros << " pacientes de " << resultado.partes
+                     << " partes en " << resultado.segundos << " s";
+                if (resultado.invalidos > 0) cout << " (" << resultado.invalidos << " lineas no validas)";
+                cout << endl;
+                return correcto ? 0 : 1;
             }
-            
-        } while (opcion != 5);
-    }
-    
-    // Submenu para operaciones de borrado
-    void subMenuBorrado() {
-        int opcion;
-        do {
-            #ifdef _WIN32
-                system("cls");
-            #else
-                system("clear");
-            #endif
-            
-            cout << "----------------------------------------------------" << endl;
-            cout << "\n                  MENU DE BORRADO                 " << endl;
-            cout << "----------------------------------------------------" << endl;
-            cout << " 1. Borrar paciente por ID" << endl;
-            cout << " 2. Borrar todos los registros" << endl;
-            cout << " 3. Volver al menu principal" << endl;
-            cout << "----------------------------------------------------" << endl;
-            cout << " Seleccione una opcion: ";
-            
-            if (!(cin >> opcion)) {
-                cin.clear();
-                cin.ignore(10000, '\n');
-                cout << "Entrada no valida." << endl;
-                continue;
+            if (modo == "--lote" && argc > 3) {
+                // Modo por lotes sin menu
+                OpcionesModo opciones;
+                if (!parsearOpcionesModo(argc, argv, 4, opciones)) return 1;
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+                cargarSegunOpciones(sistema, opciones);
+                bool correcto = ejecutarLoteConsultas(sistema, argv[2], argv[3], opciones.hilos);
+                if (!opciones.archivoEstadisticas.empty()) volcarEstadisticasRendimiento(opciones.archivoEstadisticas);
+                return correcto ? 0 : 1;
             }
-            
-            cin.ignore();
-            
-            if (opcion == 1) {
-                // Verifica que haya pacientes antes de borrar
-                if (sistema.getCantidadPacientes() == 0) {
-                    cout << "No hay pacientes registrados para borrar." << endl;
-                    cout << "\nPresione Enter para continuar...";
-                    cin.get();
-                    continue;
+            if (modo == "--servidor" && argc > 2) {
+                // Servidor de consultas sobre socket Unix o TCP local
+                OpcionesModo opciones;
+                if (!parsearOpcionesModo(argc, argv, 3, opciones)) return 1;
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+                cargarSegunOpciones(sistema, opciones);
+                bool correcto = ejecutarServidor(sistema, argv[2], opciones.hilos);
+                if (!opciones.archivoEstadisticas.empty()) volcarEstadisticasRendimiento(opciones.archivoEstadisticas);
+                return correcto ? 0 : 1;
+            }
+            if (modo == "--volcar" && argc > 3) {
+                // Volcado de LevelDB a un archivo o a la salida estandar ("-")
+                FormatoSalida formato;
+                OpcionesModo opciones;
+                if (!parsearFormatoSalida(argv[2], formato)) {
+                    cerr << "Formato no valido: " << argv[2] << endl;
+                    return 1;
                 }
-                
-                sistema.mostrarTodos();
-                cout << "Ingrese el ID del paciente a borrar: ";
-                string id;
-                getline(cin, id);
-                
-                if (id.empty()) {
-                    cout << "ID no valido." << endl;
-                } else {
-                    // Busca el paciente y pide confirmacion antes de borrar
-                    DataPaciente* paciente = sistema.buscarExactoPorID(id);
-                    if (paciente != nullptr) {
-                        cout << "Paciente encontrado: " << paciente->getPatientName() << endl;
-                        cout << "¿Esta seguro de que desea borrar este paciente? (s/n): ";
-                        char confirmacion;
-                        cin >> confirmacion;
-                        cin.ignore();
-                        
-                        if (confirmacion == 's' || confirmacion == 'S') {
-                            if (sistema.borrarPaciente(id)) {
-                                cout << "Paciente borrado exitosamente." << endl;
-                            } else {
-                                cout << "Error al borrar el paciente." << endl;
-                            }
-                        } else {
-                            cout << "Operacion cancelada." << endl;
-                        }
-                        delete paciente;
-                    } else {
-                        cout << "No se encontro paciente con ID: " << id << endl;
+                if (!parsearOpcionesModo(argc, argv, 4, opciones)) return 1;
+                string rutaSalida = argv[3];
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+
+                // Con salida estandar los mensajes de la carga van a stderr para no mezclarse
+                streambuf* consola = cout.rdbuf();
+                if (rutaSalida == "-") cout.rdbuf(cerr.rdbuf());
+                cargarSegunOpciones(sistema, opciones);
+                cout.rdbuf(consola);
+
+                ofstream archivo;
+                if (rutaSalida != "-") {
+                    archivo.open(rutaSalida, ios::binary);
+                    if (!archivo.is_open()) {
+                        cerr << "Error al crear archivo de salida: " << rutaSalida << endl;
+                        return 1;
                     }
                 }
-                
-            } else if (opcion == 2) {
-                // Borrado masivo con confirmacion
-                cout << "¿Esta seguro de que desea borrar todos los registros? (s/n): ";
-                char confirmacion;
-                cin >> confirmacion;
-                cin.ignore();
-                
-                if (confirmacion == 's' || confirmacion == 'S') {
-                    sistema.borrarTodos();
-                } else {
-                    cout << "Operacion cancelada." << endl;
+                size_t escritos = sistema.volcarLevelDB(formato, rutaSalida == "-" ? cout : archivo);
+                cerr << "Volcados " << escritos << " pacientes." << endl;
+                return 0;
+            }
+            if (modo == "--reporte" && argc > 2) {
+                // Reporte agrupado de los agregados persistidos en LevelDB
+                AgrupacionAgregados agrupacion;
+                OpcionesModo opciones;
+                if (!parsearAgrupacion(argv[2], agrupacion)) {
+                    cerr << "Agrupacion no valida: " << argv[2] << endl;
+                    return 1;
                 }
+                if (!parsearOpcionesModo(argc, argv, 3, opciones)) return 1;
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+                cargarSegunOpciones(sistema, opciones);
+                mostrarReporteAgregados(sistema.reporteAgregados(agrupacion), cout);
+                return 0;
             }
-            
-            if (opcion != 3) {
-                cout << "\nPresione Enter para continuar...";
-                cin.get();
+            if (modo == "--percentiles") {
+                // p50/p95/p99 de tamanos por modalidad de los pacientes cargados
+                OpcionesModo opciones;
+                if (!parsearOpcionesModo(argc, argv, 2, opciones)) return 1;
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+                cargarSegunOpciones(sistema, opciones);
+                mostrarPercentilesTamano(sistema.distribucionTamanos(), cout);
+                return 0;
             }
-            
-        } while (opcion != 3);
-    }
-};
-
-
-// Funcion principal del programa
-int main() {
+            if (modo == "--memoria") {
+                // Memoria real por indice y por campo despues de la carga
+                OpcionesModo opciones;
+                if (!parsearOpcionesModo(argc, argv, 2, opciones)) return 1;
+                SistemaPacientes sistema(opciones.rutaBD, opciones.fragmentos, opciones.cacheMB << 20,
+                                         opciones.archivoInstantanea);
+                cargarSegunOpciones(sistema, opciones);
+                mostrarUsoMemoria(sistema.usoMemoria(), cout);
+                return 0;
+            }
+            if (modo == "--cliente-carga" && argc > 3) {
+                size_t conexiones = argc > 4 ? max(atoi(argv[4]), 1) : 4;
+                int segundos = argc > 5 ? max(atoi(argv[5]), 1) : 5;
+                size_t profundidad = argc > 6 ? max(atoi(argv[6]), 1) : 8;
+                return ejecutarClienteCarga(argv[2], argv[3], conexiones, segundos, profundidad) ? 0 : 1;
+            }
+            if (modo == "--fragmentos" && argc > 2 && atoi(argv[2]) > 0) {
+                numFragmentos = atoi(argv[2]);
+            } else if (modo == "--cache-mb" && argc > 2 && atoi(argv[2]) > 0) {
+                cacheMB = atoi(argv[2]);
+            } else {
+                mostrarUso(argv[0]);
+                return 1;
+            }
+        }
 
-    try {
+#ifdef SIN_MENU
+        // Compilado sin menu interactivo: solo hay modos por linea de comandos
+        (void) numFragmentos;
+        (void) cacheMB;
+        mostrarUso(argv[0]);
+        return 1;
+#else
         // Mensaje de inicio del sistema
         cout << "Inicializando sistema de pacientes..." << endl;
         
         // Crea la instancia del menu principal
-        MenuPrincipal menu;
+        MenuPrincipal menu(numFragmentos, cacheMB << 20);
         
         // Ejecuta el bucle principal de la aplicacion
         menu.ejecutar();
+#endif
         
     } catch (const exception& e) {
         // Captura y muestra cualquier excepcion no controlada
@@ -1236,4 +8912,3 @@ int main() {
 
     return 0;
 }
-